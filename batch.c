@@ -0,0 +1,295 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Lots of games played side by side, with no screen and no clock, for
+// bots to play as fast as they can go. Each tick the bot gets a view of
+// every game that's still going in one go (see snekbot.h) and hands back a
+// direction for each, so the cost of calling it is spread over the batch
+// instead of paid for every game.
+//
+// Snacks and mushrooms get topped up on a tick count rather than the clock,
+// about as often as the real game does it at its starting speed, so a game
+// plays out the same every time from the same seed.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+// ticks between top ups, at the starting speed of ten ticks a second
+#define SNACK_TICKS 100
+#define MUSHROOM_TICKS 150
+
+struct batch *batch_new(uint32_t count, uint32_t rows, uint32_t cols, bool wrap)
+{
+  struct batch *batch = calloc(1, sizeof(struct batch));
+  if (!batch)
+    die("calloc");
+
+  batch->count = count;
+  batch->rows = rows;
+  batch->cols = cols;
+  batch->wrap = wrap;
+  batch->games = calloc(count, sizeof(struct batch_game));
+  batch->views = calloc(count, sizeof(struct snekbot_view));
+  batch->live = calloc(count, sizeof(uint32_t));
+  if (!batch->games || !batch->views || !batch->live)
+    die("calloc");
+
+  for (uint32_t g = 0; g < count; g++) {
+    arena_init(&batch->games[g].arena, game_arena_size(rows, cols));
+    batch->games[g].done = true;
+  }
+
+  return batch;
+}
+
+void batch_free(struct batch *batch)
+{
+  for (uint32_t g = 0; g < batch->count; g++)
+    arena_destroy(&batch->games[g].arena);
+  free(batch->games);
+  free(batch->views);
+  free(batch->live);
+  free(batch);
+}
+
+// Start game g over, as a new game from seed
+void batch_reset(struct batch *batch, uint32_t g, uint64_t seed)
+{
+  struct batch_game *game = &batch->games[g];
+
+  arena_reset(&game->arena);
+  game->gs = (struct game_state) { .arena = &game->arena, .wrap = batch->wrap,
+                                      .speed = 100000, .rng = seed };
+  board_init(&game->gs, batch->rows, batch->cols);
+  game->snek = snek_init(&game->gs);
+  add_snacks(&game->gs, game->snek, 20);
+  generate_obstacles(&game->gs, game->snek);
+  game->ticks = 0;
+  game->hash = 0;
+  game->done = false;
+}
+
+// Fill in a bot's view of a game
+void game_view(const struct game_state *gs, const struct snek *snek, uint32_t ticks,
+                 struct snekbot_view *view)
+{
+  *view = (struct snekbot_view) {
+    .rows = gs->rows, .cols = gs->cols, .stride = gs->stride, .words = gs->words,
+    .wrap = gs->wrap,
+    .walls = gs->walls, .body = gs->body, .snacks = gs->snacks, .mushrooms = gs->mushrooms,
+    .cells = snek->cells, .mask = snek->mask, .head = snek->head, .len = snek->len,
+    .grow = snek->grow, .dir = snek->dir,
+    .score = gs->score, .ticks = ticks
+  };
+}
+
+// Views of the games that are still going, for a bot to decide on.
+// batch->live says which game each one is. Returns how many there are.
+size_t batch_views(struct batch *batch)
+{
+  size_t n = 0;
+  for (uint32_t g = 0; g < batch->count; g++) {
+    struct batch_game *game = &batch->games[g];
+    if (game->done)
+      continue;
+
+    game_view(&game->gs, game->snek, game->ticks, &batch->views[n]);
+    batch->live[n++] = g;
+  }
+
+  return n;
+}
+
+// Move every game from the last batch_views() one tick, with dirs[j] the
+// direction for the jth view. Returns how many games are still going.
+size_t batch_step(struct batch *batch, size_t n, const uint32_t *dirs)
+{
+  size_t going = 0;
+
+  for (size_t j = 0; j < n; j++) {
+    struct batch_game *game = &batch->games[batch->live[j]];
+    struct game_state *gs = &game->gs;
+
+    // a bot that says something silly just keeps going the way it was
+    if (dirs[j] < 4)
+      game->snek->dir = dirs[j];
+
+    game->ticks++;
+    bool over = gs->step(game->snek, gs);
+    game->hash = tick_hash(gs, game->snek, game->hash);
+    if (over) {
+      game->done = true;
+      continue;
+    }
+
+    if (game->ticks % SNACK_TICKS == 0)
+      add_snacks(gs, game->snek, 5);
+    if (gs->score > 200 && game->ticks % MUSHROOM_TICKS == 0)
+      add_mushrooms(gs, game->snek, 2);
+    going++;
+  }
+
+  return going;
+}
+
+// Let a bot play every game in the batch until it's over or has gone
+// max_ticks ticks. Returns how many times the bot was asked to decide.
+size_t batch_play(struct batch *batch, struct plugin *plugin, uint32_t max_ticks)
+{
+  uint32_t *dirs = malloc(batch->count * sizeof(uint32_t));
+  if (!dirs)
+    die("malloc");
+
+  size_t calls = 0;
+  for (uint32_t t = 0; t < max_ticks; t++) {
+    size_t n = batch_views(batch);
+    if (n == 0)
+      break;
+
+    plugin_decide(plugin, batch->views, n, dirs);
+    calls++;
+    batch_step(batch, n, dirs);
+  }
+
+  // whatever's left has run out of time
+  for (uint32_t g = 0; g < batch->count; g++)
+    batch->games[g].done = true;
+
+  free(dirs);
+
+  return calls;
+}
+
+// Directions for every live game from the last batch_views() that wander
+// about without running into anything if they can help it, and are the
+// same every time for the same game and tick, so two runs can be played
+// side by side
+void batch_wander(struct batch *batch, size_t n, uint32_t *dirs)
+{
+  for (size_t j = 0; j < n; j++) {
+    const struct snekbot_view *view = &batch->views[j];
+    uint64_t x = (uint64_t) batch->live[j] << 32 | view->ticks;
+    uint64_t r = splitmix64(&x);
+    uint32_t head = view->cells[view->head];
+    int32_t moves[4] = { -(int32_t) view->stride, (int32_t) view->stride, 1, -1 };
+
+    // keep going most of the time, otherwise start from somewhere random
+    uint32_t first = r % 8 == 0 ? (uint32_t) (r >> 8) % 4 : view->dir;
+    dirs[j] = first;
+    for (uint32_t k = 0; k < 4; k++) {
+      uint32_t d = (first + k) % 4;
+      size_t i = head + moves[d];
+      if (!plane_test(view->walls, i) && !plane_test(view->body, i)) {
+        dirs[j] = d;
+        break;
+      }
+    }
+  }
+}
+
+// Play the same seeds in two batches in lockstep and check their tick
+// hashes agree on every tick, then knock one game's random numbers off by
+// one and check the very next tick notices. Also times how much hashing
+// every tick adds to stepping.
+int bench_hash(void)
+{
+  uint32_t count = 256, max_ticks = 2000;
+  struct batch *a = batch_new(count, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  struct batch *b = batch_new(count, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  uint32_t *dirs = malloc(count * sizeof(uint32_t));
+  if (!dirs)
+    die("malloc");
+
+  for (uint32_t g = 0; g < count; g++) {
+    batch_reset(a, g, g + 1);
+    batch_reset(b, g, g + 1);
+  }
+
+  size_t ticks = 0, mismatches = 0;
+  for (uint32_t t = 0; t < max_ticks; t++) {
+    size_t n = batch_views(a);
+    if (n == 0 || batch_views(b) != n)
+      break;
+
+    batch_wander(a, n, dirs);
+    batch_step(a, n, dirs);
+    batch_step(b, n, dirs);
+    ticks += n;
+    for (uint32_t g = 0; g < count; g++)
+      mismatches += a->games[g].hash != b->games[g].hash;
+  }
+  printf("%zu ticks over %u games, %zu hash mismatches\n", ticks, count, mismatches);
+
+  // a desync: the same game with its random numbers nudged partway through
+  uint32_t caught = 0, nudged = 0, tries = 64;
+  for (uint32_t g = 0; g < tries; g++) {
+    batch_reset(a, g, g + 1);
+    batch_reset(b, g, g + 1);
+  }
+  for (uint32_t t = 0; t < 50; t++) {
+    size_t n = batch_views(a);
+    if (n == 0 || batch_views(b) != n)
+      break;
+
+    if (t == 20) {
+      for (uint32_t g = 0; g < tries; g++) {
+        if (!b->games[g].done) {
+          b->games[g].gs.rng++;
+          nudged++;
+        }
+      }
+    }
+    batch_wander(a, n, dirs);
+    batch_step(a, n, dirs);
+    batch_step(b, n, dirs);
+    if (t == 20) {
+      for (uint32_t g = 0; g < tries; g++)
+        caught += a->games[g].hash != b->games[g].hash;
+      break;
+    }
+  }
+  printf("desync caught on the tick it happened in %u of %u games\n", caught, nudged);
+
+  // what hashing costs on top of a step
+  double elapsed[2] = { 0 };
+  uint64_t sink = 0;
+  for (int hashing = 0; hashing < 2; hashing++) {
+    for (uint32_t g = 0; g < count; g++)
+      batch_reset(a, g, g + 1);
+
+    size_t n = batch_views(a);
+    double start = now_secs();
+    for (uint32_t t = 0; t < 200 && n > 0; t++) {
+      for (size_t j = 0; j < n; j++) {
+        struct batch_game *game = &a->games[a->live[j]];
+        if (game->done)
+          continue;
+        game->done = game->gs.step(game->snek, &game->gs);
+        if (hashing)
+          sink ^= tick_hash(&game->gs, game->snek, sink);
+      }
+    }
+    elapsed[hashing] = now_secs() - start;
+  }
+  printf("200 ticks x %u games: %.2f ms stepping, %.2f ms stepping and hashing (%llx)\n",
+          count, elapsed[0] * 1e3, elapsed[1] * 1e3, (unsigned long long) (sink & 0xf));
+
+  free(dirs);
+  batch_free(a);
+  batch_free(b);
+
+  return mismatches == 0 && caught == nudged ? 0 : 1;
+}
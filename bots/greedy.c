@@ -0,0 +1,132 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// An example bot plugin. It heads for the nearest snack as the crow flies,
+// and won't go anywhere that crashes it next tick if it can help it. It
+// only uses snekbot.h, so it can be built on its own:
+//
+//   cc bots/greedy.c -o greedy.so -shared -fPIC
+//
+// and played with snek --bot ./greedy.so
+
+#include <stdlib.h>
+
+#include "../snekbot.h"
+
+static bool test(const uint64_t *plane, uint32_t i)
+{
+  return plane[i / 64] >> (i % 64) & 1;
+}
+
+// Where going dir from cell i ends up, or UINT32_MAX for off the board
+static uint32_t next_cell(const struct snekbot_view *v, uint32_t i, uint32_t dir)
+{
+  uint32_t row = i / v->stride, col = i % v->stride;
+  int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+  row += dr[dir];
+  col += dc[dir];
+
+  if (v->wrap) {
+    if (row == 0)
+      row = v->rows - 2;
+    else if (row == v->rows - 1)
+      row = 1;
+    if (col == 0)
+      col = v->cols - 2;
+    else if (col == v->cols - 1)
+      col = 1;
+  }
+  else if (row - 1 >= v->rows - 2 || col - 1 >= v->cols - 2) {
+    return UINT32_MAX;
+  }
+
+  return row * v->stride + col;
+}
+
+static uint32_t distance(const struct snekbot_view *v, uint32_t a, uint32_t b)
+{
+  uint32_t ar = a / v->stride, ac = a % v->stride, br = b / v->stride, bc = b % v->stride;
+
+  return (ar > br ? ar - br : br - ar) + (ac > bc ? ac - bc : bc - ac);
+}
+
+static uint32_t decide_one(const struct snekbot_view *v)
+{
+  uint32_t head = v->cells[v->head];
+
+  // the nearest snack
+  uint32_t target = UINT32_MAX, best = UINT32_MAX;
+  for (uint32_t j = 0; j < v->words; j++) {
+    uint64_t w = v->snacks[j];
+    while (w) {
+      uint32_t i = j * 64 + __builtin_ctzll(w);
+      uint32_t d = distance(v, head, i);
+      if (d < best) {
+        best = d;
+        target = i;
+      }
+      w &= w - 1;
+    }
+  }
+
+  // the safe way that gets closest to it, or failing that the way we're
+  // already going
+  uint32_t dir = v->dir;
+  best = UINT32_MAX;
+  for (uint32_t d = 0; d < 4; d++) {
+    uint32_t i = next_cell(v, head, d);
+    if (d == (v->dir ^ 1) || i == UINT32_MAX || test(v->walls, i) || test(v->body, i))
+      continue;
+
+    uint32_t score = target == UINT32_MAX ? 0 : distance(v, i, target);
+    if (test(v->mushrooms, i))
+      score += 5;
+    if (score < best) {
+      best = score;
+      dir = d;
+    }
+  }
+
+  return dir;
+}
+
+static void *create(const char *args)
+{
+  (void) args;
+
+  return NULL;
+}
+
+static void destroy(void *bot)
+{
+  (void) bot;
+}
+
+static void decide(void *bot, const struct snekbot_view *games, size_t count, uint32_t *dirs)
+{
+  (void) bot;
+
+  for (size_t g = 0; g < count; g++)
+    dirs[g] = decide_one(&games[g]);
+}
+
+static const struct snekbot greedy = {
+  .abi_version = SNEKBOT_ABI_VERSION,
+  .name = "greedy",
+  .create = create,
+  .destroy = destroy,
+  .decide = decide,
+};
+
+const struct snekbot *snekbot_entry(void)
+{
+  return &greedy;
+}
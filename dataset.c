@@ -0,0 +1,429 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Recording games for training bots on: every tick, what the snek could see
+// (the same observation the neural net bot gets), which way it went, what
+// it scored for it and whether that was the end of the game.
+//
+// A dataset is a directory with a file for each of those four columns. Each
+// file is a 64 byte header and then one fixed-size record per tick, so
+// record n of every column is the same tick and a reader can mmap the files
+// and pick out records anywhere without reading anything else. Recording
+// appends to whatever's already there. If the game gets killed halfway
+// through a write and the columns come out different lengths, the reader
+// just uses the ticks they've all got, and the next recording cuts them all
+// back to those ticks before it adds any more.
+//
+// The game only fills in records in memory. When a chunk of them is full
+// it's handed to a thread that writes it out, and the game carries on with
+// another chunk, so it never waits on the disk unless the disk falls a long
+// way behind.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snek.h"
+
+#define COLUMN_MAGIC "SNEKCOL1"
+#define COLUMN_HEADER 64
+#define CHUNK_RECORDS 4096
+#define CHUNKS 4
+
+struct column_header {
+  char magic[8];
+  char name[16];
+  uint32_t record_size;
+};
+
+static const char *column_names[] = { "obs", "action", "reward", "done" };
+static const uint32_t column_sizes[] = { POLICY_OBS_SIZE, 1, sizeof(int32_t), 1 };
+
+struct chunk {
+  uint8_t *obs;
+  uint8_t *action;
+  int32_t *reward;
+  uint8_t *done;
+  size_t count;
+};
+
+struct recorder {
+  FILE *files[4];
+  struct chunk chunks[CHUNKS];
+
+  // chunks go round in order: the game fills chunk filling, the writer
+  // writes out chunks from writing up to (but not including) filling
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  size_t filling;
+  size_t writing;
+  bool closing;
+  bool failed;
+  pthread_t writer;
+};
+
+static void *write_chunks(void *arg)
+{
+  struct recorder *rec = arg;
+
+  pthread_mutex_lock(&rec->lock);
+  while (true) {
+    while (rec->writing == rec->filling && !rec->closing)
+      pthread_cond_wait(&rec->changed, &rec->lock);
+    if (rec->writing == rec->filling)
+      break;
+
+    struct chunk *chunk = &rec->chunks[rec->writing % CHUNKS];
+    pthread_mutex_unlock(&rec->lock);
+
+    void *columns[] = { chunk->obs, chunk->action, chunk->reward, chunk->done };
+    bool ok = true;
+    for (int c = 0; c < 4; c++)
+      ok &= fwrite(columns[c], column_sizes[c], chunk->count, rec->files[c]) == chunk->count;
+    for (int c = 0; c < 4; c++)
+      ok &= fflush(rec->files[c]) == 0;
+
+    pthread_mutex_lock(&rec->lock);
+    rec->failed |= !ok;
+    rec->writing++;
+    pthread_cond_broadcast(&rec->changed);
+  }
+  pthread_mutex_unlock(&rec->lock);
+
+  return NULL;
+}
+
+static char *column_path(const char *dir, int c)
+{
+  size_t len = strlen(dir) + strlen(column_names[c]) + 6;
+  char *path = malloc(len);
+  if (!path)
+    die("malloc");
+  snprintf(path, len, "%s/%s.col", dir, column_names[c]);
+
+  return path;
+}
+
+// Start recording into the dataset in dir, making it if it isn't there.
+// Returns NULL, with errno set, if it can't.
+struct recorder *recorder_open(const char *dir)
+{
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+    return NULL;
+
+  struct recorder *rec = calloc(1, sizeof(struct recorder));
+  if (!rec)
+    die("calloc");
+
+  // how many whole ticks every column has already
+  size_t count = SIZE_MAX;
+  off_t sizes[4];
+  for (int c = 0; c < 4; c++) {
+    char *path = column_path(dir, c);
+    rec->files[c] = fopen(path, "ab");
+    free(path);
+
+    struct stat st;
+    if (!rec->files[c] || fstat(fileno(rec->files[c]), &st) == -1)
+      goto fail;
+
+    sizes[c] = st.st_size;
+    size_t records = st.st_size >= COLUMN_HEADER
+                        ? (st.st_size - COLUMN_HEADER) / column_sizes[c] : 0;
+    if (records < count)
+      count = records;
+  }
+
+  // Cut every column back to those ticks before appending, or a write that
+  // got cut off last time would leave the columns out of step from then on
+  for (int c = 0; c < 4; c++) {
+    off_t keep = sizes[c] >= COLUMN_HEADER ? COLUMN_HEADER + (off_t) count * column_sizes[c] : 0;
+    if (keep != sizes[c] && ftruncate(fileno(rec->files[c]), keep) == -1)
+      goto fail;
+
+    // a new column (or one that didn't get all of its header) gets its
+    // header
+    if (keep == 0) {
+      uint8_t header[COLUMN_HEADER] = { 0 };
+      struct column_header h = { .magic = COLUMN_MAGIC, .record_size = column_sizes[c] };
+      strncpy(h.name, column_names[c], sizeof(h.name) - 1);
+      memcpy(header, &h, sizeof(h));
+      if (fwrite(header, 1, COLUMN_HEADER, rec->files[c]) != COLUMN_HEADER)
+        goto fail;
+    }
+  }
+
+  for (int k = 0; k < CHUNKS; k++) {
+    struct chunk *chunk = &rec->chunks[k];
+    chunk->obs = malloc(CHUNK_RECORDS * POLICY_OBS_SIZE);
+    chunk->action = malloc(CHUNK_RECORDS);
+    chunk->reward = malloc(CHUNK_RECORDS * sizeof(int32_t));
+    chunk->done = malloc(CHUNK_RECORDS);
+    if (!chunk->obs || !chunk->action || !chunk->reward || !chunk->done)
+      die("malloc");
+  }
+
+  pthread_mutex_init(&rec->lock, NULL);
+  pthread_cond_init(&rec->changed, NULL);
+  if (pthread_create(&rec->writer, NULL, write_chunks, rec) != 0)
+    die("pthread_create");
+
+  return rec;
+
+fail:
+  for (int c = 0; c < 4; c++) {
+    if (rec->files[c])
+      fclose(rec->files[c]);
+  }
+  free(rec);
+
+  return NULL;
+}
+
+// Pass the chunk we're filling over to the writer and move on to the next
+// one, waiting if the writer hasn't finished with it yet
+static void hand_over(struct recorder *rec)
+{
+  pthread_mutex_lock(&rec->lock);
+  rec->filling++;
+  pthread_cond_broadcast(&rec->changed);
+  while (rec->filling - rec->writing >= CHUNKS)
+    pthread_cond_wait(&rec->changed, &rec->lock);
+  pthread_mutex_unlock(&rec->lock);
+
+  rec->chunks[rec->filling % CHUNKS].count = 0;
+}
+
+// Record a tick: what the snek could see beforehand (from
+// policy_observe()), which way it went, what it scored and whether that was
+// the end
+void recorder_add(struct recorder *rec, const uint8_t *obs, uint32_t action, int32_t reward, bool done)
+{
+  struct chunk *chunk = &rec->chunks[rec->filling % CHUNKS];
+
+  memcpy(chunk->obs + chunk->count * POLICY_OBS_SIZE, obs, POLICY_OBS_SIZE);
+  chunk->action[chunk->count] = action;
+  chunk->reward[chunk->count] = reward;
+  chunk->done[chunk->count] = done;
+  if (++chunk->count == CHUNK_RECORDS)
+    hand_over(rec);
+}
+
+// Write out what's left and stop. Returns false if anything didn't get
+// written.
+bool recorder_close(struct recorder *rec)
+{
+  if (rec->chunks[rec->filling % CHUNKS].count > 0)
+    hand_over(rec);
+
+  pthread_mutex_lock(&rec->lock);
+  rec->closing = true;
+  pthread_cond_broadcast(&rec->changed);
+  pthread_mutex_unlock(&rec->lock);
+  pthread_join(rec->writer, NULL);
+
+  bool ok = !rec->failed;
+  for (int c = 0; c < 4; c++)
+    ok &= fclose(rec->files[c]) == 0;
+  for (int k = 0; k < CHUNKS; k++) {
+    free(rec->chunks[k].obs);
+    free(rec->chunks[k].action);
+    free(rec->chunks[k].reward);
+    free(rec->chunks[k].done);
+  }
+  pthread_mutex_destroy(&rec->lock);
+  pthread_cond_destroy(&rec->changed);
+  free(rec);
+
+  return ok;
+}
+
+// Map the dataset in dir in to read. Returns false, with errno set, if it
+// can't (which includes it not having any ticks in it yet, since there'd be
+// nothing to sample).
+bool dataset_open(struct dataset *ds, const char *dir)
+{
+  *ds = (struct dataset) { .count = SIZE_MAX };
+
+  for (int c = 0; c < 4; c++) {
+    char *path = column_path(dir, c);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) {
+      dataset_close(ds);
+      return false;
+    }
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= COLUMN_HEADER)
+      base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    const struct column_header *h = base;
+    if (base == MAP_FAILED || memcmp(h->magic, COLUMN_MAGIC, 8) != 0
+          || h->record_size != column_sizes[c]) {
+      if (base != MAP_FAILED)
+        munmap(base, st.st_size);
+      dataset_close(ds);
+      errno = EINVAL;
+      return false;
+    }
+
+    ds->maps[c] = base;
+    ds->sizes[c] = st.st_size;
+    size_t count = (st.st_size - COLUMN_HEADER) / column_sizes[c];
+    ds->count = count < ds->count ? count : ds->count;
+  }
+
+  if (ds->count == 0) {
+    dataset_close(ds);
+    errno = EINVAL;
+    return false;
+  }
+
+  ds->obs = ds->maps[0] + COLUMN_HEADER;
+  ds->action = ds->maps[1] + COLUMN_HEADER;
+  ds->reward = (const int32_t *) (ds->maps[2] + COLUMN_HEADER);
+  ds->done = ds->maps[3] + COLUMN_HEADER;
+  ds->obs_size = POLICY_OBS_SIZE;
+
+  return true;
+}
+
+void dataset_close(struct dataset *ds)
+{
+  for (int c = 0; c < 4; c++) {
+    if (ds->maps[c])
+      munmap((void *) ds->maps[c], ds->sizes[c]);
+    ds->maps[c] = NULL;
+  }
+}
+
+// Pick n records at random (with replacement), for a training batch
+void dataset_sample(const struct dataset *ds, uint64_t *rng, size_t *out, size_t n)
+{
+  for (size_t j = 0; j < n; j++)
+    out[j] = splitmix64(rng) % ds->count;
+}
+
+// Record a lot of games, timing how long recording takes the game and how
+// long the writer takes to get it all out, then map the dataset back in and
+// check random records are what went in
+int bench_record(void)
+{
+  char dir[] = "/tmp/snek-dataset-XXXXXX";
+  if (!mkdtemp(dir))
+    die(dir);
+
+  uint32_t hidden[] = { 32 };
+  struct policy *policy = policy_new(1, hidden, 1);
+  struct recorder *rec = recorder_open(dir);
+  if (!rec)
+    die(dir);
+
+  // a check on each record as it goes in, to compare with when it comes
+  // back out
+  size_t max_records = 1 << 20;
+  uint64_t *sums = malloc(max_records * sizeof(uint64_t));
+  if (!sums)
+    die("malloc");
+
+  uint32_t count = 64;
+  struct batch *batch = batch_new(count, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  uint32_t *dirs = malloc(count * sizeof(uint32_t));
+  uint32_t *scores = malloc(count * sizeof(uint32_t));
+  uint8_t *obs = malloc(count * POLICY_OBS_SIZE);
+  if (!dirs || !scores || !obs)
+    die("malloc");
+
+  double recording = 0, start = now_secs();
+  size_t records = 0;
+  for (uint32_t round = 0; records + count * 2000 < max_records; round++) {
+    for (uint32_t g = 0; g < count; g++)
+      batch_reset(batch, g, round * count + g + 1);
+
+    size_t n;
+    for (int t = 0; t < 2000 && (n = batch_views(batch)) > 0; t++) {
+      for (size_t j = 0; j < n; j++) {
+        policy_observe(&batch->views[j], obs + j * POLICY_OBS_SIZE);
+        scores[j] = batch->games[batch->live[j]].gs.score;
+      }
+      policy_decide(policy, batch->views, n, dirs);
+      batch_step(batch, n, dirs);
+
+      double s = now_secs();
+      for (size_t j = 0; j < n; j++) {
+        struct batch_game *game = &batch->games[batch->live[j]];
+        recorder_add(rec, obs + j * POLICY_OBS_SIZE, dirs[j], game->gs.score - scores[j], game->done);
+      }
+      recording += now_secs() - s;
+
+      for (size_t j = 0; j < n; j++) {
+        struct batch_game *game = &batch->games[batch->live[j]];
+        uint64_t sum = dirs[j];
+        for (size_t b = 0; b < POLICY_OBS_SIZE; b++)
+          sum = sum * 31 + obs[j * POLICY_OBS_SIZE + b];
+        sums[records + j] = sum * 31 + (game->gs.score - scores[j]) * 2 + game->done;
+      }
+      records += n;
+    }
+  }
+  double closing = now_secs();
+  bool ok = recorder_close(rec);
+  double elapsed = now_secs() - start;
+  closing = now_secs() - closing;
+
+  struct dataset ds;
+  if (!dataset_open(&ds, dir))
+    die(dir);
+
+  size_t checks = 100000, bad = ds.count != records || !ok;
+  uint64_t rng = 1;
+  for (size_t c = 0; c < checks; c++) {
+    size_t j;
+    dataset_sample(&ds, &rng, &j, 1);
+    uint64_t sum = ds.action[j];
+    for (size_t b = 0; b < ds.obs_size; b++)
+      sum = sum * 31 + ds.obs[j * ds.obs_size + b];
+    sum = sum * 31 + ds.reward[j] * 2 + ds.done[j];
+    bad += sum != sums[j];
+  }
+
+  double mb = (double) records * (POLICY_OBS_SIZE + 1 + sizeof(int32_t) + 1) / (1 << 20);
+  printf("%zu records (%.0f MB) in %.2fs: %.2f us per record recording, %.0f MB/s overall, "
+          "%.3fs left to write at the end, %zu bad records\n",
+          records, mb, elapsed, recording * 1e6 / records, mb / elapsed, closing, bad);
+
+  dataset_close(&ds);
+  for (int c = 0; c < 4; c++) {
+    char *path = column_path(dir, c);
+    unlink(path);
+    free(path);
+  }
+  rmdir(dir);
+  free(sums);
+  free(dirs);
+  free(scores);
+  free(obs);
+  batch_free(batch);
+  policy_free(policy);
+
+  return bad > 0;
+}
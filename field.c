@@ -0,0 +1,330 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A distance field: for every open cell, how many moves it is to the
+// nearest snack, going around walls and the snek. It's what a bot would
+// follow downhill to find food.
+//
+// Working it out from scratch is a BFS out from every snack at once, which
+// is fine once but too much to do every tick on a big board. So once it's
+// built we repair it as things change instead. set_item() and the step
+// function tell us when a snack appears or goes away and when a cell gets
+// blocked (by the head or a new wall) or freed up (by the tail).
+//
+// Making a distance smaller is easy: BFS out from the changed cell, only
+// going where it makes things shorter. Making one bigger is the fiddly
+// part, since a cell's distance might have come by way of the cell that
+// changed, or it might have another way round that's just as short. So we
+// work outwards from the changed cell a layer at a time, and a cell whose
+// distance is one more than a cell we've thrown out only gets thrown out
+// too if none of its other neighbours is one closer. Then each cell we threw
+// out gets a fresh distance from the neighbours that are left, and we BFS
+// out from those to fill the hole back in. Either way we only touch the
+// cells whose distance actually depended on the change.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define FAR UINT32_MAX
+
+// how often bench_field() checks the field against one from scratch
+#define FIELD_CHECK_TICKS 500
+
+static bool field_open(struct game_state *gs, size_t i)
+{
+  return plane_test(gs->interior, i) && !plane_test(gs->walls, i) && !plane_test(gs->body, i);
+}
+
+// BFS out from the cells in the queue, lowering distances as we go
+static void field_lower(struct dist_field *field, size_t head, size_t tail)
+{
+  struct game_state *gs = field->gs;
+  uint32_t *dist = field->dist, *queue = field->queue;
+
+  while (head < tail) {
+    size_t i = queue[head++], around[4];
+    neighbours(gs, i, around);
+    for (int d = 0; d < 4; d++) {
+      size_t n = around[d];
+      if (dist[i] + 1 < dist[n] && field_open(gs, n)) {
+        dist[n] = dist[i] + 1;
+        queue[tail++] = n;
+        if (tail == gs->cells) {
+          // we've lapped the queue, so move what's left back to the front
+          memmove(queue, &queue[head], (tail - head) * sizeof(uint32_t));
+          tail -= head;
+          head = 0;
+        }
+      }
+    }
+  }
+}
+
+// The shortest distance cell i could have, judging by its neighbours
+static uint32_t field_best(struct dist_field *field, size_t i)
+{
+  if (plane_test(field->gs->snacks, i))
+    return 0;
+
+  size_t around[4];
+  neighbours(field->gs, i, around);
+  uint32_t best = FAR;
+  for (int d = 0; d < 4; d++) {
+    uint32_t n = field->dist[around[d]];
+    if (n != FAR && n + 1 < best)
+      best = n + 1;
+  }
+
+  return best;
+}
+
+// Cell i used to be old moves from a snack and now it's further (or not
+// reachable at all), so fix up every cell whose distance came by way of it
+static void field_raise(struct dist_field *field, size_t i, uint32_t old)
+{
+  struct game_state *gs = field->gs;
+  uint32_t *dist = field->dist, *queue = field->queue, *stale = field->stale;
+  size_t head = 0, tail = 0, num_stale = 0;
+
+  if (old == FAR)
+    return;
+
+  dist[i] = FAR;
+  stale[num_stale++] = i;
+
+  // throw out the cells that can't be that close any more, a layer at a time
+  queue[tail++] = i;
+  while (head < tail) {
+    size_t u = queue[head++], around[4];
+    uint32_t u_old = u == i ? old : field->old[u];
+    neighbours(gs, u, around);
+    for (int d = 0; d < 4; d++) {
+      size_t v = around[d];
+      if (dist[v] != u_old + 1)
+        continue;
+
+      // does v have another neighbour one closer?
+      size_t others[4];
+      bool supported = false;
+      neighbours(gs, v, others);
+      for (int e = 0; e < 4 && !supported; e++)
+        supported = dist[others[e]] == dist[v] - 1;
+      if (supported)
+        continue;
+
+      field->old[v] = dist[v];
+      dist[v] = FAR;
+      stale[num_stale++] = v;
+      queue[tail++] = v;
+    }
+  }
+
+  // give the cells we threw out what distances they can get from the cells
+  // around them, then spread from there
+  tail = 0;
+  for (size_t j = 0; j < num_stale; j++) {
+    size_t s = stale[j];
+    if (!field_open(gs, s))
+      continue;
+
+    dist[s] = field_best(field, s);
+    if (dist[s] != FAR)
+      queue[tail++] = s;
+  }
+
+  field_lower(field, 0, tail);
+}
+
+// Set up a field for the board as it is now
+void field_init(struct dist_field *field, struct game_state *gs)
+{
+  field->gs = gs;
+  field->dist = malloc(gs->cells * sizeof(uint32_t));
+  field->old = malloc(gs->cells * sizeof(uint32_t));
+  field->queue = malloc(gs->cells * sizeof(uint32_t));
+  field->stale = malloc(gs->cells * sizeof(uint32_t));
+  if (!field->dist || !field->old || !field->queue || !field->stale)
+    die("malloc");
+
+  field_rebuild(field);
+}
+
+void field_free(struct dist_field *field)
+{
+  free(field->dist);
+  free(field->old);
+  free(field->queue);
+  free(field->stale);
+}
+
+// Work the whole field out from scratch
+void field_rebuild(struct dist_field *field)
+{
+  struct game_state *gs = field->gs;
+  size_t tail = 0;
+
+  for (size_t i = 0; i < gs->cells; i++)
+    field->dist[i] = FAR;
+
+  for (size_t j = 0; j < gs->words; j++) {
+    uint64_t w = gs->snacks[j];
+    while (w) {
+      size_t i = j * 64 + __builtin_ctzll(w);
+      field->dist[i] = 0;
+      field->queue[tail++] = i;
+      w &= w - 1;
+    }
+  }
+
+  field_lower(field, 0, tail);
+}
+
+// A snack has turned up on cell i
+void field_add_source(struct dist_field *field, size_t i)
+{
+  field->dist[i] = 0;
+  field->queue[0] = i;
+  field_lower(field, 0, 1);
+}
+
+// The snack on cell i has gone
+void field_remove_source(struct dist_field *field, size_t i)
+{
+  field_raise(field, i, field->dist[i]);
+}
+
+// Something (the head or a wall) has moved onto cell i
+void field_block(struct dist_field *field, size_t i)
+{
+  field_raise(field, i, field->dist[i]);
+  field->dist[i] = FAR;
+}
+
+// Cell i has been freed up (the tail's moved off it)
+void field_unblock(struct dist_field *field, size_t i)
+{
+  field->dist[i] = field_best(field, i);
+  if (field->dist[i] != FAR) {
+    field->queue[0] = i;
+    field_lower(field, 0, 1);
+  }
+}
+
+// Which way to go from cell i to head downhill towards the nearest snack,
+// or -1 if there's no way to one from here
+int field_direction(struct dist_field *field, size_t i)
+{
+  size_t around[4];
+  neighbours(field->gs, i, around);
+
+  // around[] is north, south, east, west, the same order as the directions
+  int best = -1;
+  for (int d = 0; d < 4; d++) {
+    uint32_t n = field->dist[around[d]];
+    if (n != FAR && (best == -1 || n < field->dist[around[best]]))
+      best = d;
+  }
+
+  return best;
+}
+
+// Play a snek that follows the field around, keeping the field up to date
+// as it goes, and compare that with rebuilding the field every tick
+// How many open cells the field has a different distance for than one
+// worked out from scratch
+static size_t field_mismatches(struct game_state *gs, struct dist_field *field)
+{
+  struct dist_field fresh;
+  field_init(&fresh, gs);
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < gs->cells; i++)
+    mismatches += field_open(gs, i) && fresh.dist[i] != field->dist[i];
+  field_free(&fresh);
+
+  return mismatches;
+}
+
+int bench_field(void)
+{
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 1000, 1000 } };
+  size_t failures = 0;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    uint32_t rows = sizes[s][0], cols = sizes[s][1];
+    size_t snacks = (size_t) rows * cols / 150 < 20 ? 20 : (size_t) rows * cols / 150;
+    size_t ticks = 20000, played[2] = { 0 }, mismatches = 0;
+    double elapsed[2];
+
+    // once keeping the field up to date, then rebuilding it, with the same
+    // game both times (though rebuilding is too slow to play all of it)
+    for (int rebuild = 0; rebuild < 2; rebuild++) {
+      struct arena arena;
+      arena_init(&arena, game_arena_size(rows, cols));
+
+      struct game_state gs = { .arena = &arena, .speed = 100000, .rng = 1 };
+      board_init(&gs, rows, cols);
+      struct snek *snek = snek_init(&gs);
+      add_snacks(&gs, snek, snacks);
+      generate_obstacles(&gs, snek);
+
+      struct dist_field field;
+      field_init(&field, &gs);
+      if (!rebuild)
+        gs.field = &field;
+
+      double start = now_secs(), checking = 0;
+      size_t t;
+      for (t = 0; t < (rebuild ? ticks / 20 : ticks); t++) {
+        // check the field kept up to date against one worked out from
+        // scratch every so often (and not on the clock)
+        if (!rebuild && t % FIELD_CHECK_TICKS == 0) {
+          double check = now_secs();
+          mismatches += field_mismatches(&gs, &field);
+          checking += now_secs() - check;
+        }
+
+        if (rebuild)
+          field_rebuild(&field);
+
+        int dir = field_direction(&field, head_cell(snek));
+        if (dir >= 0)
+          snek->dir = dir;
+
+        uint32_t score = gs.score;
+        if (gs.step(snek, &gs))
+          break;
+        if (gs.score > score)
+          add_snacks(&gs, snek, 1);
+        gs.speed = 100000;
+      }
+      elapsed[rebuild] = now_secs() - start - checking;
+      played[rebuild] = t;
+      if (!rebuild)
+        mismatches += field_mismatches(&gs, &field);
+
+      field_free(&field);
+      arena_destroy(&arena);
+    }
+
+    printf("%5ux%-5u %6zu ticks: %8.2f us/tick updating the field, %8.2f us/tick rebuilding it, "
+            "%zu cells wrong\n", rows, cols, played[0], elapsed[0] * 1e6 / played[0],
+            elapsed[1] * 1e6 / played[1], mismatches);
+    failures += mismatches;
+  }
+
+  return failures > 0;
+}
@@ -0,0 +1,232 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Fuzz targets, for libFuzzer or anything that speaks its interface.
+//
+// fuzz_keys() runs bytes through the key decoder, as if they'd been typed.
+// fuzz_game() takes a board size, a seed and then keys, and plays a game
+// on them a tick per key, checking the game still makes sense after every
+// tick and that it plays out the same when it's played again. Nothing in it
+// goes by the clock (poison wears off by the game's own time), so an input
+// that crashes it always does. Anything wrong aborts, so the fuzzer saves
+// the input that did it.
+//
+// make fuzz-keys or make fuzz-game builds a libFuzzer binary for one of
+// them (with clang, and the address and undefined behaviour sanitisers).
+// Without clang, snek --fuzz TARGET FILE... runs saved inputs through a
+// target to reproduce a crash, and snek --fuzz TARGET on its own throws
+// random inputs at it for a few seconds to see how many it gets through.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+// the biggest board fuzz_game() plays on
+#define FUZZ_ROWS 40
+#define FUZZ_COLS 128
+
+#define FUZZ_CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      abort(); \
+    } \
+  } while (0)
+
+int fuzz_keys(const uint8_t *data, size_t size)
+{
+  const char *buf = (const char *) data;
+
+  while (size > 0) {
+    char key;
+    size_t used = decode_key(buf, size, &key);
+    FUZZ_CHECK(used <= size && used <= KEY_SEQ_MAX);
+
+    // the same as get_key() does with an escape sequence that's cut off
+    if (used == 0)
+      used = 1;
+
+    buf += used;
+    size -= used;
+  }
+
+  return 0;
+}
+
+// Things that should be true of any game that's still going
+static void check_game(struct game_state *gs, struct snek *snek)
+{
+  FUZZ_CHECK(gs->hash == board_hash(gs, snek));
+  FUZZ_CHECK(plane_count(gs->body, gs->words) == snek->len);
+  FUZZ_CHECK(plane_test(gs->interior, head_cell(snek)));
+  FUZZ_CHECK(gs->speed <= 100000);
+
+  // nothing's on top of anything else
+  for (size_t j = 0; j < gs->words; j++) {
+    FUZZ_CHECK(!(gs->walls[j] & (gs->body[j] | gs->snacks[j] | gs->mushrooms[j])));
+    FUZZ_CHECK(!(gs->body[j] & (gs->snacks[j] | gs->mushrooms[j])));
+    FUZZ_CHECK(!(gs->snacks[j] & gs->mushrooms[j]));
+    FUZZ_CHECK(!(gs->walls[j] & ~gs->interior[j]));
+  }
+}
+
+// The first three bytes pick the board (rows, columns and whether it wraps),
+// the next eight are the seed, and every byte after that is typed in, a
+// tick per key. Returns the hash of every tick played.
+static uint64_t play_game(struct arena *arena, const uint8_t *data, size_t size)
+{
+  uint32_t rows = 12 + data[0] % (FUZZ_ROWS - 11);
+  uint32_t cols = 20 + data[1] % (FUZZ_COLS - 19);
+  uint64_t seed;
+  memcpy(&seed, &data[3], sizeof(seed));
+
+  arena_reset(arena);
+  struct game_state gs = { .arena = arena, .wrap = data[2] & 1, .speed = 100000, .rng = seed };
+  board_init(&gs, rows, cols);
+  struct snek *snek = snek_init(&gs);
+  add_snacks(&gs, snek, 20);
+  generate_obstacles(&gs, snek);
+  check_game(&gs, snek);
+
+  uint64_t hash = 0;
+  const char *keys = (const char *) &data[11];
+  size_t left = size - 11;
+  for (uint32_t ticks = 1; left > 0; ticks++) {
+    char c;
+    size_t used = decode_key(keys, left, &c);
+    if (used == 0)
+      used = 1;
+    keys += used;
+    left -= used;
+
+    if (c == 'w')
+      snek->dir = NORTH;
+    else if (c == 'a')
+      snek->dir = WEST;
+    else if (c == 's')
+      snek->dir = SOUTH;
+    else if (c == 'd')
+      snek->dir = EAST;
+
+    bool over = gs.step(snek, &gs);
+    hash = tick_hash(&gs, snek, hash);
+    if (over)
+      break;
+    check_game(&gs, snek);
+
+    if (ticks % 100 == 0)
+      add_snacks(&gs, snek, 5);
+    if (gs.score > 200 && ticks % 150 == 0)
+      add_mushrooms(&gs, snek, 2);
+  }
+
+  return hash;
+}
+
+// The game is played twice, and has to come out the same both times, so
+// anything that crashes it will crash it again when the input's run back
+int fuzz_game(const uint8_t *data, size_t size)
+{
+  static struct arena arena;
+  if (!arena.base)
+    arena_init(&arena, game_arena_size(FUZZ_ROWS, FUZZ_COLS));
+
+  if (size < 11)
+    return 0;
+
+  uint64_t first = play_game(&arena, data, size);
+  FUZZ_CHECK(play_game(&arena, data, size) == first);
+
+  return 0;
+}
+
+#ifdef FUZZ_TARGET
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  return FUZZ_TARGET(data, size);
+}
+#else
+static int (*fuzz_target(const char *name))(const uint8_t *, size_t)
+{
+  if (strcmp(name, "keys") == 0)
+    return fuzz_keys;
+  if (strcmp(name, "game") == 0)
+    return fuzz_game;
+
+  return NULL;
+}
+
+// Random inputs that look a bit like what a fuzzer would come up with:
+// mostly keys and bits of escape sequences
+static size_t fuzz_input(uint8_t *buf, size_t max, uint64_t *rng)
+{
+  static const char bits[] = "wasd \x1b[O;1ABCD~q";
+  size_t size = splitmix64(rng) % max;
+
+  for (size_t j = 0; j < size; j++) {
+    uint64_t r = splitmix64(rng);
+    buf[j] = r % 4 == 0 ? (uint8_t) (r >> 8) : (uint8_t) bits[(r >> 8) % (sizeof(bits) - 1)];
+  }
+
+  return size;
+}
+
+int fuzz_run(const char *name, char **files, int count)
+{
+  int (*target)(const uint8_t *, size_t) = fuzz_target(name);
+  if (!target) {
+    fprintf(stderr, "no fuzz target called %s (there's keys and game)\n", name);
+    return 1;
+  }
+
+  if (count > 0) {
+    for (int f = 0; f < count; f++) {
+      FILE *fp = fopen(files[f], "rb");
+      if (!fp) {
+        perror(files[f]);
+        return 1;
+      }
+
+      uint8_t buf[1 << 16];
+      size_t size = fread(buf, 1, sizeof(buf), fp);
+      fclose(fp);
+
+      target(buf, size);
+      printf("%s: ok\n", files[f]);
+    }
+
+    return 0;
+  }
+
+  uint8_t buf[4096];
+  uint64_t rng = 1;
+  size_t execs = 0, bytes = 0;
+  double start = now_secs(), elapsed;
+  do {
+    for (int j = 0; j < 1000; j++) {
+      size_t size = fuzz_input(buf, sizeof(buf), &rng);
+      target(buf, size);
+      execs++;
+      bytes += size;
+    }
+    elapsed = now_secs() - start;
+  } while (elapsed < 3);
+
+  printf("%s: %zu execs in %.1fs, %.0f execs/s, %.1f MB/s\n", name, execs, elapsed,
+          execs / elapsed, bytes / elapsed / 1e6);
+
+  return 0;
+}
+#endif
@@ -0,0 +1,292 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// How long it takes from pressing a key to seeing the snek turn.
+//
+// snek --bench-latency runs a copy of snek on a pseudo terminal, the way
+// it'd run in a terminal window, and plays it: it presses an arrow key,
+// then watches what comes back (through the pretend terminal in vt.c) for
+// the frame where the head has turned, and times the gap. The snek is
+// steered around in a square so it lives a while, and when it dies anyway
+// the game gets started again. Each board size is played in its own copy,
+// since bigger boards mean bigger frames to draw and take in.
+//
+// Most of the wait is the game sleeping between ticks, so the numbers come
+// out somewhere between nothing and a tick. Anything much over a tick is
+// time spent drawing, writing or reading the frame.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "snek.h"
+
+#define LATENCY_SAMPLES 60
+
+// how long to wait for the game to show something before giving up
+#define LATENCY_TIMEOUT 5.0
+
+struct latency_run {
+  int fd;
+  pid_t pid;
+  struct vt *vt;
+  uint32_t rows;
+  uint32_t cols;
+};
+
+// Take in whatever the game's written, waiting up to timeout seconds for
+// something. Returns false if the game's gone.
+static bool latency_read(struct latency_run *run, double timeout)
+{
+  struct pollfd pfd = { .fd = run->fd, .events = POLLIN };
+  int ready = poll(&pfd, 1, (int) (timeout * 1000));
+  if (ready <= 0)
+    return ready == 0 || errno == EINTR;
+
+  char buf[1 << 16];
+  ssize_t n = read(run->fd, buf, sizeof(buf));
+  if (n <= 0)
+    return false;
+  vt_feed(run->vt, buf, n);
+
+  return true;
+}
+
+// Does the screen have text on it anywhere?
+static bool screen_says(struct latency_run *run, const char *text)
+{
+  size_t len = strlen(text);
+
+  for (uint32_t r = 0; r < run->vt->rows; r++) {
+    for (uint32_t c = 0; c + len <= run->vt->cols; c++) {
+      size_t k = 0;
+      while (k < len && vt_cell(run->vt, r, c + k)->glyph[0] == text[k])
+        k++;
+      if (k == len)
+        return true;
+    }
+  }
+
+  return false;
+}
+
+// Every frame starts by clearing the screen, so that's how we count them
+static size_t frames_seen(struct latency_run *run)
+{
+  return run->vt->stats.clears;
+}
+
+// The snek's head on the screen, or 0 if it's not there (or the game's
+// over, since the game over message is in the poisoned snek's purple and
+// has a v in it). It's the only thing in the snek's colours that's one of
+// ^ v < >.
+static char screen_head(struct latency_run *run)
+{
+  if (screen_says(run, "Game over"))
+    return 0;
+
+  for (uint32_t r = 1; r < run->rows - 1; r++) {
+    for (uint32_t c = 1; c < run->cols - 1; c++) {
+      struct vt_cell *cell = vt_cell(run->vt, r, c);
+      if ((cell->fg == GREEN || cell->fg == PURPLE) && cell->len == 1
+            && strchr("^v<>", cell->glyph[0]))
+        return cell->glyph[0];
+    }
+  }
+
+  return 0;
+}
+
+// Wait for count more frames, or the game to end. Returns false if
+// neither happens.
+static bool wait_frames(struct latency_run *run, size_t count)
+{
+  double give_up = now_secs() + LATENCY_TIMEOUT;
+  size_t until = frames_seen(run) + count;
+  while (frames_seen(run) < until && !screen_says(run, "Game over")) {
+    if (now_secs() > give_up || !latency_read(run, give_up - now_secs()))
+      return false;
+  }
+
+  return true;
+}
+
+static bool latency_start(struct latency_run *run, uint32_t rows, uint32_t cols, uint64_t seed)
+{
+  // a line more than the board, for the line feed after the last row
+  struct winsize ws = { .ws_row = rows + 1, .ws_col = cols };
+  run->rows = rows;
+  run->cols = cols;
+  run->pid = forkpty(&run->fd, NULL, NULL, &ws);
+  if (run->pid == -1)
+    return false;
+
+  if (run->pid == 0) {
+    char size[32], seed_arg[32];
+    snprintf(size, sizeof(size), "%ux%u", rows, cols);
+    snprintf(seed_arg, sizeof(seed_arg), "%llu", (unsigned long long) seed);
+    execl("/proc/self/exe", "snek", "-s", size, "--seed", seed_arg, (char *) NULL);
+    _exit(127);
+  }
+
+  run->vt = vt_new(rows + 1, cols);
+
+  return true;
+}
+
+static void latency_stop(struct latency_run *run)
+{
+  kill(run->pid, SIGTERM);
+  waitpid(run->pid, NULL, 0);
+  close(run->fd);
+  vt_free(run->vt);
+}
+
+// Wait for the screen to say text. Returns false if it never does.
+static bool wait_for(struct latency_run *run, const char *text)
+{
+  double give_up = now_secs() + LATENCY_TIMEOUT;
+  while (!screen_says(run, text)) {
+    if (now_secs() > give_up || !latency_read(run, give_up - now_secs()))
+      return false;
+  }
+
+  return true;
+}
+
+// Type keys at the game. Returns false if they didn't all go, in which case
+// the game's gone or stuck and there's no point timing anything more.
+static bool send_keys(struct latency_run *run, const char *keys, size_t len)
+{
+  return write(run->fd, keys, len) == (ssize_t) len;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+// Play until we've timed samples turns, putting how long each one took
+// into times. Returns how many we got.
+static size_t latency_play(struct latency_run *run, double *times, size_t samples, uint64_t *rng)
+{
+  // turning right from each way the head can point
+  static const struct { char head; char turned; const char *key; } turns[] = {
+    { '>', 'v', "\x1b[B" }, { 'v', '<', "\x1b[D" }, { '<', '^', "\x1b[A" }, { '^', '>', "\x1b[C" }
+  };
+
+  if (!wait_for(run, "press space") || !send_keys(run, " ", 1))
+    return 0;
+
+  // a turn that goes wrong doesn't count, but give up if they all do
+  size_t got = 0;
+  for (size_t tries = 0; got < samples && tries < samples * 10; tries++) {
+    if (screen_says(run, "Game over")) {
+      // wipe the message ourselves, so we don't see it again and press
+      // space in the next game (which would pause it)
+      if (!send_keys(run, " ", 1))
+        break;
+      vt_clear(run->vt, 0, (size_t) run->vt->rows * run->vt->cols);
+      if (!wait_frames(run, 1))
+        break;
+      continue;
+    }
+
+    // let it go straight for a few ticks, so it goes round in a square
+    // rather than in on itself
+    size_t ticks = 2 + splitmix64(rng) % 4;
+    double started = now_secs();
+    if (!wait_frames(run, ticks))
+      break;
+    if (screen_says(run, "Game over"))
+      continue;
+
+    // then press the key somewhere in the next tick rather than just as
+    // a frame arrives, which would always be a whole tick from the next.
+    // We keep reading while we wait, like a terminal would: a big frame
+    // doesn't fit in the pty's buffer, and the game can't get on with its
+    // tick until it's been taken in.
+    double tick = (now_secs() - started) / ticks;
+    double press = now_secs() + tick * (splitmix64(rng) % 1000) / 1000;
+    while (now_secs() < press)
+      latency_read(run, press - now_secs());
+
+    // a frame might've only been half read, so look for the head again
+    // until it's back
+    char head = 0;
+    double give_up = now_secs() + LATENCY_TIMEOUT;
+    while (!(head = screen_head(run)) && !screen_says(run, "Game over")
+             && now_secs() < give_up)
+      latency_read(run, 0.1);
+
+    size_t t = 0;
+    while (t < 4 && turns[t].head != head)
+      t++;
+    if (t == 4)
+      continue;
+
+    double sent = now_secs();
+    if (!send_keys(run, turns[t].key, 3))
+      break;
+    give_up = sent + LATENCY_TIMEOUT;
+    while (screen_head(run) != turns[t].turned && !screen_says(run, "Game over")
+             && now_secs() < give_up)
+      latency_read(run, give_up - now_secs());
+
+    if (screen_head(run) == turns[t].turned)
+      times[got++] = (now_secs() - sent) * 1e3;
+  }
+
+  return got;
+}
+
+int bench_latency(uint64_t seed)
+{
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 60, 240 }, { 120, 400 } };
+  double times[LATENCY_SAMPLES];
+  uint64_t rng = seed;
+
+  printf("board       samples   p50 ms   p90 ms   p99 ms   max ms   bytes/frame\n");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    struct latency_run run;
+    if (!latency_start(&run, sizes[s][0], sizes[s][1], seed)) {
+      perror("forkpty");
+      return 1;
+    }
+
+    size_t got = latency_play(&run, times, LATENCY_SAMPLES, &rng);
+    size_t frames = frames_seen(&run);
+    size_t bytes = run.vt->stats.bytes;
+    latency_stop(&run);
+
+    if (got == 0) {
+      printf("%4ux%-4u   couldn't get the game going\n", sizes[s][0], sizes[s][1]);
+      continue;
+    }
+
+    qsort(times, got, sizeof(double), cmp_double);
+    printf("%4ux%-4u %10zu %8.1f %8.1f %8.1f %8.1f %13.0f\n", sizes[s][0], sizes[s][1], got,
+            times[got / 2], times[got * 9 / 10], times[got * 99 / 100], times[got - 1],
+            frames ? (double) bytes / frames : 0.0);
+  }
+
+  return 0;
+}
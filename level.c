@@ -0,0 +1,384 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Designed levels. They're written as text and compiled into a pack file
+// (snek --pack), which the game mmaps and copies levels out of directly.
+//
+// In the text form each level is a block of lines with a blank line between
+// levels. Each line is one row of the board inside the border:
+//
+//   #        wall
+//   o        snek snack
+//   %        mushroom
+//   > < ^ v  where the snek starts, and which way it's heading
+//
+// Anything else is an empty cell, and lines starting with ';' are comments.
+// A level without a start starts the snek in the middle of the board, so
+// that has to be clear of walls.
+// The board is as big as the level plus the border, or the smallest board
+// snek can be played on if that's bigger. Since editors like to trim
+// trailing spaces, short lines are treated as being padded with empty cells.
+//
+// The pack file is a header, an index with an entry for each level, and then
+// the levels themselves. Each level is stored as its wall, snack and mushroom
+// bitplanes laid out exactly as board_init() lays out a board of that size,
+// so loading one is three memcpy()s. Everything is in the byte order of the
+// machine that built the pack.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snek.h"
+
+#define LEVEL_MAGIC "SNEKLVL1"
+
+struct level_header {
+  char magic[8];
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct level_entry {
+  uint64_t offset;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t stride;
+  uint32_t start;
+  uint32_t dir;
+  uint32_t reserved;
+};
+
+// the three bitplanes of a level, one after the other
+static size_t level_words(uint32_t rows, uint32_t stride)
+{
+  return ((size_t) rows * stride + 63) / 64;
+}
+
+// Is there room for the snek to start where the level says (or in the
+// middle of the board, where snek_init() puts it if the level doesn't say)?
+// It has to be inside the border and not on a wall.
+static bool level_start_ok(uint32_t rows, uint32_t cols, uint32_t stride, uint32_t start,
+                             const uint64_t *walls)
+{
+  if (start) {
+    uint32_t r = start / stride, c = start % stride;
+    return r >= 1 && r <= rows - 2 && c >= 1 && c <= cols - 2 && !plane_test(walls, start);
+  }
+
+  uint32_t r = rows / 2, c = cols / 2 + 2;
+  for (uint32_t j = 0; j <= INIT_SKEN_LEN; j++) {
+    if (plane_test(walls, (size_t) r * stride + c - j))
+      return false;
+  }
+
+  return true;
+}
+
+bool level_pack_open(struct level_pack *pack, const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+
+  void *base = MAP_FAILED;
+  if ((size_t) st.st_size >= sizeof(struct level_header))
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    errno = EINVAL;
+    return false;
+  }
+
+  pack->base = base;
+  pack->size = st.st_size;
+
+  const struct level_header *header = base;
+  size_t index_end = sizeof(struct level_header)
+                        + (size_t) header->count * sizeof(struct level_entry);
+  if (memcmp(header->magic, LEVEL_MAGIC, 8) != 0 || index_end > pack->size) {
+    level_pack_close(pack);
+    errno = EINVAL;
+    return false;
+  }
+
+  pack->count = header->count;
+  pack->index = (const struct level_entry *) (pack->base + sizeof(struct level_header));
+
+  // check every level is where the index says it is up front, so loading
+  // them later can't fail
+  for (uint32_t j = 0; j < pack->count; j++) {
+    const struct level_entry *e = &pack->index[j];
+    size_t len = 3 * level_words(e->rows, e->stride) * sizeof(uint64_t);
+    if (e->rows < MIN_WIN_HEIGHT || e->cols < MIN_WIN_WIDTH || e->stride < e->cols
+          || e->offset % 8 != 0 || e->offset > pack->size
+          || len > pack->size - e->offset || e->dir > WEST
+          || !level_start_ok(e->rows, e->cols, e->stride, e->start,
+                               (const uint64_t *) (pack->base + e->offset))) {
+      level_pack_close(pack);
+      errno = EINVAL;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void level_pack_close(struct level_pack *pack)
+{
+  munmap((void *) pack->base, pack->size);
+  pack->base = NULL;
+  pack->size = 0;
+  pack->count = 0;
+  pack->index = NULL;
+}
+
+void level_size(const struct level_pack *pack, uint32_t n, uint32_t *rows, uint32_t *cols)
+{
+  *rows = pack->index[n].rows;
+  *cols = pack->index[n].cols;
+}
+
+// Copy level n onto a board board_init() has already set up at the level's
+// size.
+void level_load(const struct level_pack *pack, uint32_t n, struct game_state *gs)
+{
+  const struct level_entry *e = &pack->index[n];
+  const uint64_t *planes = (const uint64_t *) (pack->base + e->offset);
+  size_t words = level_words(e->rows, e->stride);
+  uint64_t *dst[3] = { gs->walls, gs->snacks, gs->mushrooms };
+
+  for (int p = 0; p < 3; p++) {
+    const uint64_t *src = &planes[p * words];
+    if (e->stride == gs->stride) {
+      memcpy(dst[p], src, words * sizeof(uint64_t));
+    }
+    else {
+      // the pack was built when this size had a different layout
+      memset(dst[p], 0, gs->words * sizeof(uint64_t));
+      for (size_t r = 0; r < e->rows; r++) {
+        for (size_t c = 0; c < e->cols; c++) {
+          if (plane_test(src, r * e->stride + c))
+            plane_set(dst[p], r * gs->stride + c);
+        }
+      }
+    }
+
+    // don't trust the file to keep things off the border
+    for (size_t j = 0; j < gs->words; j++)
+      dst[p][j] &= gs->interior[j];
+  }
+
+  index_items(gs);
+
+  if (e->start) {
+    gs->start = e->start / e->stride * gs->stride + e->start % e->stride;
+    gs->start_dir = e->dir;
+  }
+}
+
+// building packs
+
+struct level_src {
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t stride;
+  uint32_t start;
+  uint32_t dir;
+  uint64_t *planes;
+};
+
+static void parse_level(char **lines, size_t count, struct level_src *level)
+{
+  size_t width = 0;
+  for (size_t j = 0; j < count; j++) {
+    if (strlen(lines[j]) > width)
+      width = strlen(lines[j]);
+  }
+
+  level->rows = count + 2 > MIN_WIN_HEIGHT ? count + 2 : MIN_WIN_HEIGHT;
+  level->cols = width + 2 > MIN_WIN_WIDTH ? width + 2 : MIN_WIN_WIDTH;
+
+  level->stride = board_stride(level->rows, level->cols);
+  level->start = 0;
+  level->dir = EAST;
+
+  size_t words = level_words(level->rows, level->stride);
+  level->planes = calloc(3 * words, sizeof(uint64_t));
+  if (!level->planes)
+    die("calloc");
+
+  for (size_t r = 0; r < count; r++) {
+    for (size_t c = 0; lines[r][c]; c++) {
+      size_t i = (r + 1) * level->stride + c + 1;
+      switch (lines[r][c]) {
+        case '#':
+          plane_set(&level->planes[0], i);
+          break;
+        case 'o':
+          plane_set(&level->planes[words], i);
+          break;
+        case '%':
+          plane_set(&level->planes[2 * words], i);
+          break;
+        case '^':
+        case 'v':
+        case '>':
+        case '<':
+          level->start = i;
+          level->dir = lines[r][c] == '^' ? NORTH : lines[r][c] == 'v' ? SOUTH
+                          : lines[r][c] == '>' ? EAST : WEST;
+          break;
+      }
+    }
+  }
+}
+
+// Read every level in a text file, appending them to levels
+static bool read_levels(const char *path, struct level_src **levels, size_t *count, size_t *cap)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  char **lines = NULL;
+  size_t num_lines = 0, lines_cap = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+
+  while (true) {
+    ssize_t len = getline(&line, &line_cap, f);
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (len > 0 && line[len - 1] == '\r')
+      line[--len] = '\0';
+
+    if (len > 0 && line[0] == ';')
+      continue;
+
+    if (len > 0) {
+      if (num_lines == lines_cap) {
+        lines_cap = lines_cap ? lines_cap * 2 : 64;
+        char **grown = realloc(lines, lines_cap * sizeof(char *));
+        if (!grown)
+          die("realloc");
+        lines = grown;
+      }
+      if (!(lines[num_lines++] = strdup(line)))
+        die("strdup");
+      continue;
+    }
+
+    // a blank line or the end of the file finishes the level
+    if (num_lines > 0) {
+      if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        struct level_src *grown = realloc(*levels, *cap * sizeof(struct level_src));
+        if (!grown)
+          die("realloc");
+        *levels = grown;
+      }
+
+      parse_level(lines, num_lines, &(*levels)[(*count)++]);
+
+      for (size_t j = 0; j < num_lines; j++)
+        free(lines[j]);
+      num_lines = 0;
+    }
+
+    if (len < 0)
+      break;
+  }
+
+  free(lines);
+  free(line);
+  fclose(f);
+
+  return true;
+}
+
+// Compile the levels in the given text files, in order, into a pack file
+int level_pack_build(const char *out, char *paths[], int num_paths)
+{
+  struct level_src *levels = NULL;
+  size_t count = 0, cap = 0;
+
+  for (int j = 0; j < num_paths; j++) {
+    if (!read_levels(paths[j], &levels, &count, &cap))
+      return 1;
+  }
+
+  for (size_t j = 0; j < count; j++) {
+    const struct level_src *l = &levels[j];
+    if (!level_start_ok(l->rows, l->cols, l->stride, l->start, l->planes)) {
+      fprintf(stderr, "level %zu: the snek starts on a wall (put a > < ^ or v somewhere open)\n", j);
+      return 1;
+    }
+  }
+
+  struct level_header header = { .count = count };
+  memcpy(header.magic, LEVEL_MAGIC, 8);
+
+  struct level_entry *index = calloc(count ? count : 1, sizeof(struct level_entry));
+  if (!index)
+    die("calloc");
+  uint64_t offset = sizeof(header) + count * sizeof(struct level_entry);
+  for (size_t j = 0; j < count; j++) {
+    index[j].offset = offset;
+    index[j].rows = levels[j].rows;
+    index[j].cols = levels[j].cols;
+    index[j].stride = levels[j].stride;
+    index[j].start = levels[j].start;
+    index[j].dir = levels[j].dir;
+    offset += 3 * level_words(levels[j].rows, levels[j].stride) * sizeof(uint64_t);
+  }
+
+  FILE *f = fopen(out, "wb");
+  if (!f) {
+    perror(out);
+    return 1;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+              && fwrite(index, sizeof(struct level_entry), count, f) == count;
+  for (size_t j = 0; ok && j < count; j++) {
+    size_t words = 3 * level_words(levels[j].rows, levels[j].stride);
+    ok = fwrite(levels[j].planes, sizeof(uint64_t), words, f) == words;
+    free(levels[j].planes);
+  }
+
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    perror(out);
+  else
+    printf("%s: %zu levels\n", out, count);
+
+  free(index);
+  free(levels);
+
+  return ok ? 0 : 1;
+}
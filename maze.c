@@ -0,0 +1,315 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Random obstacles. Whatever we put down, every open cell on the board has
+// to stay reachable from every other one (and so from the snek's head), or
+// we could wall off snacks or leave the snek a dead end it can't see coming.
+// The snek's own body counts as open here, since it'll move out of the way.
+//
+// Checking that by flooding the whole board after every placement would be
+// fine on a small board but not on a huge one, so we check locally first.
+// The only open cells whose connections a new obstacle can break are the
+// ones right next to it, and if those can all still reach each other within
+// a small box around the obstacle, any path that used to go through the
+// obstacle can go around it instead. Only when that fails (the obstacle
+// might be sealing something off, or the way around is long) do we fall
+// back to a flood fill of the whole board.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define MAX_SHAPE 16
+#define LOCAL_RADIUS 4
+#define LOCAL_SIZE (2 * LOCAL_RADIUS + 8)
+
+struct shape {
+  int len;
+  int dr[MAX_SHAPE];
+  int dc[MAX_SHAPE];
+};
+
+static void shape_add(struct shape *shape, int dr, int dc)
+{
+  shape->dr[shape->len] = dr;
+  shape->dc[shape->len] = dc;
+  shape->len++;
+}
+
+// Bars, Ls, Ts and small blocks, none bigger than 7 cells across
+static void random_shape(struct game_state *gs, struct shape *shape)
+{
+  shape->len = 0;
+
+  int a = game_rand(gs) % 5 + 3, b = game_rand(gs) % 4 + 2;
+  switch (game_rand(gs) % 4) {
+    case 0:
+      for (int j = 0; j < a; j++)
+        shape_add(shape, 0, j);
+      break;
+    case 1:
+      for (int j = 0; j < a; j++)
+        shape_add(shape, j, 0);
+      for (int j = 1; j < b; j++)
+        shape_add(shape, a - 1, j);
+      break;
+    case 2:
+      for (int j = 0; j < a; j++)
+        shape_add(shape, 0, j);
+      for (int j = 1; j < b; j++)
+        shape_add(shape, j, a / 2);
+      break;
+    case 3:
+      for (int r = 0; r < b / 2 + 1; r++) {
+        for (int c = 0; c < b; c++)
+          shape_add(shape, r, c);
+      }
+      break;
+  }
+
+  // flip it on its side half the time
+  if (game_rand(gs) % 2) {
+    for (int j = 0; j < shape->len; j++) {
+      int t = shape->dr[j];
+      shape->dr[j] = shape->dc[j];
+      shape->dc[j] = t;
+    }
+  }
+}
+
+static bool cell_open(struct game_state *gs, size_t i)
+{
+  return plane_test(gs->interior, i) && !plane_test(gs->walls, i);
+}
+
+// The cells north, south, east and west of cell i, which is inside the border.
+// On a wrap-around board the ones across the border are on the far side.
+void neighbours(struct game_state *gs, size_t i, size_t around[4])
+{
+  around[0] = i - gs->stride;
+  around[1] = i + gs->stride;
+  around[2] = i + 1;
+  around[3] = i - 1;
+
+  if (gs->wrap) {
+    size_t r = i / gs->stride, c = i % gs->stride;
+    if (r == 1)
+      around[0] = (gs->rows - 2) * gs->stride + c;
+    if (r == gs->rows - 2)
+      around[1] = gs->stride + c;
+    if (c == gs->cols - 2)
+      around[2] = r * gs->stride + 1;
+    if (c == 1)
+      around[3] = r * gs->stride + gs->cols - 2;
+  }
+}
+
+// Can all of the open cells in nbrs still reach each other without leaving
+// the box of rows r0 to r1 and columns c0 to c1? The obstacle is already
+// marked in the walls plane.
+static bool locally_connected(struct game_state *gs, const size_t *nbrs, int num_nbrs,
+                                uint32_t r0, uint32_t r1, uint32_t c0, uint32_t c1)
+{
+  uint32_t w = c1 - c0 + 1;
+  bool seen[LOCAL_SIZE * LOCAL_SIZE] = { false };
+  uint16_t queue[LOCAL_SIZE * LOCAL_SIZE];
+  int head = 0, tail = 0;
+
+  // on a wrap-around board a neighbour can be across the edge, outside the
+  // box altogether
+  uint32_t r = nbrs[0] / gs->stride, c = nbrs[0] % gs->stride;
+  if (r < r0 || r > r1 || c < c0 || c > c1)
+    return false;
+  seen[(r - r0) * w + c - c0] = true;
+  queue[tail++] = (r - r0) * w + c - c0;
+
+  while (head < tail) {
+    uint32_t lr = queue[head] / w, lc = queue[head] % w;
+    head++;
+
+    int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+    for (int d = 0; d < 4; d++) {
+      uint32_t nr = r0 + lr + dr[d], nc = c0 + lc + dc[d];
+      if (nr < r0 || nr > r1 || nc < c0 || nc > c1)
+        continue;
+
+      uint32_t k = (nr - r0) * w + nc - c0;
+      if (!seen[k] && cell_open(gs, nr * gs->stride + nc)) {
+        seen[k] = true;
+        queue[tail++] = k;
+      }
+    }
+  }
+
+  for (int j = 1; j < num_nbrs; j++) {
+    r = nbrs[j] / gs->stride;
+    c = nbrs[j] % gs->stride;
+    if (r < r0 || r > r1 || c < c0 || c > c1 || !seen[(r - r0) * w + c - c0])
+      return false;
+  }
+
+  return true;
+}
+
+static bool globally_connected(struct game_state *gs, const size_t *nbrs, int num_nbrs)
+{
+  uint64_t *open = gs->scratch;
+  for (size_t j = 0; j < gs->words; j++)
+    open[j] = gs->interior[j] & ~gs->walls[j];
+
+  flood_plane(gs, open, nbrs[0], gs->reach);
+  for (int j = 1; j < num_nbrs; j++) {
+    if (!plane_test(gs->reach, nbrs[j]))
+      return false;
+  }
+
+  return true;
+}
+
+// Is the cell within a few moves straight ahead of the snek (or right
+// beside its head)? Dropping a wall there would be a bit mean.
+static bool in_front_of_snek(struct game_state *gs, struct snek *snek, uint32_t row, uint32_t col)
+{
+  uint32_t stride = gs->stride, head = head_cell(snek);
+  int dr = (int) row - (int) (head / stride), dc = (int) col - (int) (head % stride);
+
+  if (abs(dr) <= 1 && abs(dc) <= 1)
+    return true;
+
+  switch (snek->dir) {
+    case NORTH:
+      return dc == 0 && dr < 0 && dr >= -6;
+    case SOUTH:
+      return dc == 0 && dr > 0 && dr <= 6;
+    case EAST:
+      return dr == 0 && dc > 0 && dc <= 6;
+    default:
+      return dr == 0 && dc < 0 && dc >= -6;
+  }
+}
+
+// Try a random obstacle in a random spot. Returns true if it went down.
+static bool try_obstacle(struct game_state *gs, struct snek *snek)
+{
+  struct shape shape;
+  random_shape(gs, &shape);
+
+  uint32_t row = game_rand(gs) % (gs->rows - 2) + 1;
+  uint32_t col = game_rand(gs) % (gs->cols - 2) + 1;
+
+  size_t cells[MAX_SHAPE];
+  uint32_t r0 = row, r1 = row, c0 = col, c1 = col;
+  for (int j = 0; j < shape.len; j++) {
+    uint32_t r = row + shape.dr[j], c = col + shape.dc[j];
+    if (r >= gs->rows - 1 || c >= gs->cols - 1)
+      return false;
+
+    size_t i = r * gs->stride + c;
+    if (!cell_open(gs, i) || plane_test(gs->body, i) || item_at(gs, i) != EMPTY
+          || in_front_of_snek(gs, snek, r, c))
+      return false;
+
+    cells[j] = i;
+    r1 = r > r1 ? r : r1;
+    c1 = c > c1 ? c : c1;
+  }
+
+  // mark the obstacle, then gather up the open cells around it
+  for (int j = 0; j < shape.len; j++)
+    plane_set(gs->walls, cells[j]);
+
+  size_t nbrs[4 * MAX_SHAPE];
+  int num_nbrs = 0;
+  for (int j = 0; j < shape.len; j++) {
+    size_t around[4];
+    neighbours(gs, cells[j], around);
+    for (int d = 0; d < 4; d++) {
+      if (cell_open(gs, around[d]))
+        nbrs[num_nbrs++] = around[d];
+    }
+  }
+
+  r0 = r0 > LOCAL_RADIUS ? r0 - LOCAL_RADIUS : 1;
+  c0 = c0 > LOCAL_RADIUS ? c0 - LOCAL_RADIUS : 1;
+  r1 = r1 + LOCAL_RADIUS < gs->rows - 1 ? r1 + LOCAL_RADIUS : gs->rows - 2;
+  c1 = c1 + LOCAL_RADIUS < gs->cols - 1 ? c1 + LOCAL_RADIUS : gs->cols - 2;
+
+  bool ok = num_nbrs < 2
+              || locally_connected(gs, nbrs, num_nbrs, r0, r1, c0, c1)
+              || globally_connected(gs, nbrs, num_nbrs);
+
+  for (int j = 0; j < shape.len; j++) {
+    plane_clear(gs->walls, cells[j]);
+    if (ok)
+      set_item(gs, cells[j], WALL);
+  }
+
+  return ok;
+}
+
+// Make up to tries attempts to put an obstacle down
+bool place_obstacle(struct game_state *gs, struct snek *snek, int tries)
+{
+  for (int j = 0; j < tries; j++) {
+    if (try_obstacle(gs, snek))
+      return true;
+  }
+
+  return false;
+}
+
+// The starting layout for a random game: about one obstacle per 500 cells
+void generate_obstacles(struct game_state *gs, struct snek *snek)
+{
+  size_t count = (size_t) (gs->rows - 2) * (gs->cols - 2) / 500;
+  for (size_t j = 0; j < count; j++)
+    place_obstacle(gs, snek, 10);
+}
+
+// How long placing an obstacle takes, on a board that's filling up with them
+int bench_obstacles(void)
+{
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 1000, 1000 }, { 2000, 3000 } };
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    uint32_t rows = sizes[s][0], cols = sizes[s][1];
+    struct arena arena;
+    arena_init(&arena, game_arena_size(rows, cols));
+
+    struct game_state gs = { .arena = &arena, .rng = 1 };
+    board_init(&gs, rows, cols);
+    struct snek *snek = snek_init(&gs);
+
+    size_t attempts = (size_t) rows * cols / 200, placed = 0;
+    double start = now_secs();
+    for (size_t j = 0; j < attempts; j++)
+      placed += try_obstacle(&gs, snek);
+    double elapsed = now_secs() - start;
+
+    // and make sure nothing got cut off
+    uint64_t *open = gs.scratch;
+    for (size_t j = 0; j < gs.words; j++)
+      open[j] = gs.interior[j] & ~gs.walls[j];
+    size_t reached = flood_plane(&gs, open, head_cell(snek), gs.reach);
+
+    printf("%5ux%-5u %8zu attempts %8zu placed %8.2f us/attempt   %zu of %zu open cells reachable\n",
+            rows, cols, attempts, placed, elapsed * 1e6 / attempts, reached,
+            plane_count(open, gs.words));
+
+    arena_destroy(&arena);
+  }
+
+  return 0;
+}
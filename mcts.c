@@ -0,0 +1,407 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A bot that plays by Monte Carlo tree search. Each tick it grows a tree of
+// the moves it could make from here for as long as it's allowed to think,
+// and then goes whichever way it tried most.
+//
+// Each thread has its own copy of the real game (game_copy(), which is just
+// the bitplanes and the live part of the snek's ring). A trip down the tree
+// plays the moves along the way with gs->make(), and once it gets to the
+// bottom plays on at random for a while to see how things turn out. How
+// long the snek lasts and how much it eats on the way is the reward, which
+// gets added to every node on the path. Then every move gets taken back
+// with unmake_move(), leaving the copy ready for the next trip.
+//
+// Trips run on as many threads as we're given, all sharing the one tree.
+// The nodes are updated with atomics rather than locks, and a thread going
+// down through a node adds a "virtual loss" to it until its result comes
+// back, so the other threads see that node as a little worse for a while and
+// tend to go and look somewhere else instead of all piling down the same
+// path.
+//
+// What the search finds out about each state also goes into a transposition
+// table keyed by the state's hash. The first time the search reaches a node
+// it looks the node's state up there, and if it's been seen before (on the
+// last tick, say, or down another path) the node starts out with those
+// visits and rewards instead of from nothing.
+
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define MCTS_NODES (1 << 18)
+#define MAX_DEPTH 64
+#define ROLLOUT_TICKS 60
+#define EXPAND_AFTER 2
+#define EXPLORATION 0.7
+#define TT_BITS 20
+
+// the most visits a node can start out with from the transposition table,
+// so old results don't drown out new ones
+#define TT_PRIOR 16
+
+// what a node's children field holds while some thread is adding them
+#define EXPANDING UINT32_MAX
+
+// rewards are added up in fixed point, 1 << 16 to a whole reward
+#define REWARD_ONE 65536
+
+struct node {
+  _Atomic uint32_t visits;
+  _Atomic uint32_t virtual_loss;
+  _Atomic uint64_t reward;
+  _Atomic uint32_t children;
+  atomic_bool seeded;
+};
+
+struct mcts_worker {
+  struct mcts *mcts;
+  pthread_t thread;
+  struct arena arena;
+  struct game_state gs;
+  struct snek *snek;
+  uint64_t rng;
+  size_t rollouts;
+  size_t tt_hits;
+};
+
+struct mcts {
+  uint32_t threads;
+  double budget;
+  struct node *nodes;
+  _Atomic uint32_t used;
+  double deadline;
+  struct mcts_worker *workers;
+  struct tt *tt;
+  size_t rollouts;
+  size_t tt_hits;
+};
+
+// A bot for games on boards the size (and wrapping) of gs's, thinking for
+// budget seconds a move on the given number of threads
+struct mcts *mcts_new(const struct game_state *gs, uint32_t threads, double budget)
+{
+  struct mcts *mcts = calloc(1, sizeof(struct mcts));
+  if (!mcts)
+    die("calloc");
+
+  mcts->threads = threads ? threads : 1;
+  mcts->budget = budget;
+  mcts->nodes = malloc(MCTS_NODES * sizeof(struct node));
+  mcts->workers = calloc(mcts->threads, sizeof(struct mcts_worker));
+  if (!mcts->nodes || !mcts->workers)
+    die("malloc");
+  mcts->tt = tt_new(TT_BITS);
+
+  // each thread gets a board of its own to play things out on
+  for (uint32_t j = 0; j < mcts->threads; j++) {
+    struct mcts_worker *w = &mcts->workers[j];
+    w->mcts = mcts;
+    arena_init(&w->arena, game_arena_size(gs->rows, gs->cols));
+    w->gs = (struct game_state) { .arena = &w->arena, .wrap = gs->wrap };
+    board_init(&w->gs, gs->rows, gs->cols);
+    w->snek = snek_init(&w->gs);
+  }
+
+  return mcts;
+}
+
+void mcts_free(struct mcts *mcts)
+{
+  for (uint32_t j = 0; j < mcts->threads; j++)
+    arena_destroy(&mcts->workers[j].arena);
+  free(mcts->workers);
+  free(mcts->nodes);
+  tt_free(mcts->tt);
+  free(mcts);
+}
+
+static void node_init(struct node *node)
+{
+  atomic_init(&node->visits, 0);
+  atomic_init(&node->virtual_loss, 0);
+  atomic_init(&node->reward, 0);
+  atomic_init(&node->children, 0);
+  atomic_init(&node->seeded, false);
+}
+
+// The first time we get to a node, start it off with whatever the
+// transposition table knows about its state
+static void seed(struct mcts_worker *w, struct node *node, uint64_t hash)
+{
+  uint32_t visits;
+  double mean;
+
+  if (atomic_exchange(&node->seeded, true) || !tt_probe(w->mcts->tt, hash, &visits, &mean))
+    return;
+
+  visits = visits < TT_PRIOR ? visits : TT_PRIOR;
+  atomic_fetch_add(&node->visits, visits);
+  atomic_fetch_add(&node->reward, (uint64_t) (mean * visits * REWARD_ONE));
+  w->tt_hits++;
+}
+
+// Give node n its four children, one for each direction, unless another
+// thread beat us to it or we've run out of nodes
+static void expand(struct mcts *mcts, uint32_t n)
+{
+  uint32_t none = 0;
+  if (!atomic_compare_exchange_strong(&mcts->nodes[n].children, &none, EXPANDING))
+    return;
+
+  uint32_t first = atomic_fetch_add(&mcts->used, 4);
+  if (first + 4 > MCTS_NODES)
+    return;
+
+  for (int d = 0; d < 4; d++)
+    node_init(&mcts->nodes[first + d]);
+  atomic_store(&mcts->nodes[n].children, first);
+}
+
+// The child of the node to go down next: the one with the best upper
+// confidence bound, where the virtual losses count as visits that got
+// nothing
+static uint32_t select_child(struct mcts *mcts, uint32_t n, uint32_t first, uint64_t *rng)
+{
+  struct node *parent = &mcts->nodes[n];
+  double total = atomic_load(&parent->visits) + atomic_load(&parent->virtual_loss);
+  double log_total = log(total + 1);
+  double best_score = -1;
+  uint32_t best = 0;
+
+  // start at a random child so ties don't always go the same way
+  uint32_t offset = splitmix64(rng) % 4;
+  for (uint32_t k = 0; k < 4; k++) {
+    uint32_t d = (k + offset) % 4;
+    struct node *child = &mcts->nodes[first + d];
+    double visits = atomic_load(&child->visits) + atomic_load(&child->virtual_loss);
+    double score;
+    if (visits == 0)
+      score = 1e9;
+    else
+      score = atomic_load(&child->reward) / (REWARD_ONE * visits)
+                + EXPLORATION * sqrt(log_total / visits);
+
+    if (score > best_score) {
+      best_score = score;
+      best = d;
+    }
+  }
+
+  return best;
+}
+
+// A random direction that doesn't run straight into something, if there is
+// one
+static uint32_t random_move(struct game_state *gs, struct snek *snek, uint64_t *rng)
+{
+  size_t around[4];
+  neighbours(gs, head_cell(snek), around);
+
+  uint32_t offset = splitmix64(rng) % 4;
+  for (uint32_t k = 0; k < 4; k++) {
+    uint32_t d = (k + offset) % 4;
+    size_t i = around[d];
+    if (plane_test(gs->interior, i) && !plane_test(gs->walls, i) && !plane_test(gs->body, i))
+      return d;
+  }
+
+  return snek->dir;
+}
+
+// One trip down the tree and back up again
+static void iterate(struct mcts_worker *w)
+{
+  struct mcts *mcts = w->mcts;
+  struct game_state *gs = &w->gs;
+  struct snek *snek = w->snek;
+
+  uint32_t start_score = gs->score, start_dir = snek->dir;
+  struct undo undo[MAX_DEPTH + ROLLOUT_TICKS];
+  int moves = 0;
+
+  uint32_t path[MAX_DEPTH + 1];
+  uint64_t hashes[MAX_DEPTH + 1];
+  int depth = 0;
+  uint32_t n = 0;
+  path[depth++] = n;
+  atomic_fetch_add(&mcts->nodes[n].virtual_loss, 1);
+
+  bool dead = false;
+  int ticks = 0, lived = 0;
+  while (true) {
+    uint32_t first = atomic_load(&mcts->nodes[n].children);
+    if (first == 0 || first == EXPANDING) {
+      if (first == 0 && depth < MAX_DEPTH
+            && atomic_load(&mcts->nodes[n].visits) >= EXPAND_AFTER)
+        expand(mcts, n);
+      break;
+    }
+
+    uint32_t d = select_child(mcts, n, first, &w->rng);
+    n = first + d;
+    path[depth++] = n;
+    atomic_fetch_add(&mcts->nodes[n].virtual_loss, 1);
+
+    snek->dir = d;
+    ticks++;
+    dead = gs->make(snek, gs, &undo[moves++]);
+    hashes[depth - 1] = state_hash(gs, snek);
+    seed(w, &mcts->nodes[n], hashes[depth - 1]);
+    if (dead)
+      break;
+    lived++;
+  }
+
+  // play on at random from the bottom of the tree
+  for (int t = 0; !dead && t < ROLLOUT_TICKS; t++) {
+    snek->dir = random_move(gs, snek, &w->rng);
+    dead = gs->make(snek, gs, &undo[moves++]);
+    lived += !dead;
+  }
+
+  // half for staying alive, half for eating
+  double gained = gs->score - start_score;
+  double reward = 0.5 * lived / (ticks + ROLLOUT_TICKS)
+                    + 0.5 * (gained > 30 ? 1 : gained / 30);
+  uint64_t fixed = reward * REWARD_ONE;
+
+  for (int j = 0; j < depth; j++) {
+    struct node *node = &mcts->nodes[path[j]];
+    uint32_t visits = atomic_fetch_add(&node->visits, 1) + 1;
+    uint64_t total = atomic_fetch_add(&node->reward, fixed) + fixed;
+    atomic_fetch_sub(&node->virtual_loss, 1);
+
+    if (j > 0)
+      tt_store(mcts->tt, hashes[j], visits, (double) total / ((uint64_t) visits * REWARD_ONE));
+  }
+
+  while (moves > 0)
+    unmake_move(gs, snek, &undo[--moves]);
+  snek->dir = start_dir;
+
+  w->rollouts++;
+}
+
+static void *work(void *arg)
+{
+  struct mcts_worker *w = arg;
+  while (now_secs() < w->mcts->deadline)
+    iterate(w);
+
+  return NULL;
+}
+
+// Think about the game for the bot's time budget and return which way to go
+uint32_t mcts_choose(struct mcts *mcts, const struct game_state *gs, const struct snek *snek)
+{
+  mcts->deadline = now_secs() + mcts->budget;
+
+  atomic_store(&mcts->used, 1);
+  node_init(&mcts->nodes[0]);
+  expand(mcts, 0);
+
+  for (uint32_t j = 0; j < mcts->threads; j++) {
+    struct mcts_worker *w = &mcts->workers[j];
+    game_copy(&w->gs, w->snek, gs, snek);
+    w->rng = gs->rng + j;
+    w->rollouts = 0;
+    w->tt_hits = 0;
+    if (j > 0 && pthread_create(&w->thread, NULL, work, w) != 0)
+      die("pthread_create");
+  }
+
+  work(&mcts->workers[0]);
+  mcts->rollouts = mcts->workers[0].rollouts;
+  mcts->tt_hits = mcts->workers[0].tt_hits;
+  for (uint32_t j = 1; j < mcts->threads; j++) {
+    pthread_join(mcts->workers[j].thread, NULL);
+    mcts->rollouts += mcts->workers[j].rollouts;
+    mcts->tt_hits += mcts->workers[j].tt_hits;
+  }
+
+  // go whichever way got looked at the most
+  uint32_t first = atomic_load(&mcts->nodes[0].children), best = snek->dir, most = 0;
+  for (uint32_t d = 0; d < 4; d++) {
+    uint32_t visits = atomic_load(&mcts->nodes[first + d].visits);
+    if (visits > most) {
+      most = visits;
+      best = d;
+    }
+  }
+
+  return best;
+}
+
+// Play a few games with the bot on different numbers of threads, giving it
+// the same time to think each move
+int bench_mcts(void)
+{
+  uint32_t thread_counts[] = { 1, 2, 4, 8 };
+  int games = 3, max_ticks = 300;
+  double budget = 0.005;
+
+  for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+    uint32_t total_score = 0, total_ticks = 0;
+    size_t rollouts = 0, tt_hits = 0, bad_hashes = 0;
+    double thinking = 0;
+
+    for (int g = 0; g < games; g++) {
+      struct arena arena;
+      arena_init(&arena, game_arena_size(MIN_WIN_HEIGHT, MIN_WIN_WIDTH));
+      struct game_state gs = { .arena = &arena, .speed = 100000, .rng = g + 1 };
+      board_init(&gs, MIN_WIN_HEIGHT, MIN_WIN_WIDTH);
+      struct snek *snek = snek_init(&gs);
+      add_snacks(&gs, snek, 20);
+      generate_obstacles(&gs, snek);
+
+      struct mcts *mcts = mcts_new(&gs, thread_counts[t], budget);
+      int tick;
+      for (tick = 0; tick < max_ticks; tick++) {
+        double start = now_secs();
+        snek->dir = mcts_choose(mcts, &gs, snek);
+        thinking += now_secs() - start;
+        rollouts += mcts->rollouts;
+        tt_hits += mcts->tt_hits;
+
+        if (gs.step(snek, &gs))
+          break;
+
+        // the game tops up the snacks every ten seconds or so
+        if (tick % 100 == 99)
+          add_snacks(&gs, snek, 5);
+
+        // and make sure the hash kept up
+        bad_hashes += gs.hash != board_hash(&gs, snek);
+      }
+
+      total_score += gs.score;
+      total_ticks += tick;
+      mcts_free(mcts);
+      arena_destroy(&arena);
+    }
+
+    printf("%u threads: average score %6.1f, %5.1f ticks survived, %8.0f rollouts/s, "
+            "%4.1f table hits per 100 rollouts, %zu bad hashes\n",
+            thread_counts[t], (double) total_score / games, (double) total_ticks / games,
+            rollouts / thinking, 100.0 * tt_hits / rollouts, bad_hashes);
+  }
+
+  return 0;
+}
@@ -0,0 +1,322 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Finding the items nearest a cell. The inside of the board is cut into
+// 8x8 buckets, and for snacks and for mushrooms we keep a count of how many
+// are in each bucket. set_item() keeps the counts up to date as things get
+// spawned and eaten. To find what's near a cell we look at the buckets in
+// rings around the cell's bucket, skipping the empty ones, and only pull
+// cells out of the bitplanes for buckets that have something in them. Once
+// we've got enough and nothing in the next ring out could be closer, we stop,
+// so a query costs about as much as the items near the cell rather than the
+// whole board.
+//
+// Distances are in moves (so rows apart plus columns apart), and on a
+// wrap-around board they count the way across the edges.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+uint8_t *item_buckets(struct game_state *gs, int item)
+{
+  switch (item) {
+    case SNEK_SNACK:
+      return gs->snack_buckets;
+    case MUSHROOM:
+      return gs->mushroom_buckets;
+    default:
+      return NULL;
+  }
+}
+
+// The bucket cell i (which is inside the border) is in
+size_t bucket_of(struct game_state *gs, size_t i)
+{
+  size_t r = i / gs->stride - 1, c = i % gs->stride - 1;
+
+  return (r / BUCKET_SIZE) * gs->bucket_cols + c / BUCKET_SIZE;
+}
+
+// Recount the buckets from the bitplanes, for when the items have been put
+// down without going through set_item()
+void index_items(struct game_state *gs)
+{
+  int items[] = { SNEK_SNACK, MUSHROOM };
+  size_t count = (size_t) gs->bucket_rows * gs->bucket_cols;
+
+  for (int p = 0; p < 2; p++) {
+    uint8_t *buckets = item_buckets(gs, items[p]);
+    const uint64_t *plane = item_plane(gs, items[p]);
+    memset(buckets, 0, count);
+
+    for (size_t j = 0; j < gs->words; j++) {
+      uint64_t w = plane[j];
+      while (w) {
+        buckets[bucket_of(gs, j * 64 + __builtin_ctzll(w))]++;
+        w &= w - 1;
+      }
+    }
+  }
+}
+
+uint32_t cell_distance(struct game_state *gs, size_t a, size_t b)
+{
+  uint32_t ar = a / gs->stride, ac = a % gs->stride;
+  uint32_t br = b / gs->stride, bc = b % gs->stride;
+  uint32_t dr = ar > br ? ar - br : br - ar;
+  uint32_t dc = ac > bc ? ac - bc : bc - ac;
+
+  if (gs->wrap) {
+    if (dr > (gs->rows - 2) - dr)
+      dr = (gs->rows - 2) - dr;
+    if (dc > (gs->cols - 2) - dc)
+      dc = (gs->cols - 2) - dc;
+  }
+
+  return dr + dc;
+}
+
+// Bits i to i + n - 1 of the plane, for n up to 57
+static uint64_t plane_bits(struct game_state *gs, const uint64_t *plane, size_t i, size_t n)
+{
+  size_t j = i / 64, s = i % 64;
+  uint64_t w = plane[j] >> s;
+  if (s && j + 1 < gs->words)
+    w |= plane[j + 1] << (64 - s);
+
+  return w & (((uint64_t) 1 << n) - 1);
+}
+
+// The range of bucket offsets to look at along one side of the bucket grid
+// from bucket q: on a bounded board, whatever stays on the grid, and on a
+// wrap-around one, a window that takes in every bucket exactly once.
+static void offset_range(bool wrap, uint32_t q, uint32_t n, int *lo, int *hi)
+{
+  if (wrap) {
+    *lo = -(int) (n / 2);
+    *hi = (int) n - 1 - (int) (n / 2);
+  }
+  else {
+    *lo = -(int) q;
+    *hi = (int) (n - 1 - q);
+  }
+}
+
+// What we've found so far, kept sorted by distance, and no more than max of
+// them
+struct found {
+  size_t *cells;
+  uint32_t *dists;
+  size_t count;
+  size_t max;
+};
+
+static void found_add(struct found *found, size_t cell, uint32_t dist)
+{
+  if (found->count == found->max && dist >= found->dists[found->count - 1])
+    return;
+
+  size_t j = found->count < found->max ? found->count++ : found->count - 1;
+  while (j > 0 && found->dists[j - 1] > dist) {
+    found->cells[j] = found->cells[j - 1];
+    found->dists[j] = found->dists[j - 1];
+    j--;
+  }
+  found->cells[j] = cell;
+  found->dists[j] = dist;
+}
+
+// Check every item in bucket (br, bc) against the query
+static void scan_bucket(struct game_state *gs, const uint64_t *plane, uint32_t br, uint32_t bc,
+                          size_t from, uint32_t radius, struct found *found, size_t *total)
+{
+  uint32_t r0 = br * BUCKET_SIZE + 1, c0 = bc * BUCKET_SIZE + 1;
+  uint32_t width = gs->cols - 1 - c0 < BUCKET_SIZE ? gs->cols - 1 - c0 : BUCKET_SIZE;
+
+  for (uint32_t r = r0; r < r0 + BUCKET_SIZE && r < gs->rows - 1; r++) {
+    uint64_t w = plane_bits(gs, plane, r * gs->stride + c0, width);
+    while (w) {
+      size_t i = r * gs->stride + c0 + __builtin_ctzll(w);
+      uint32_t dist = cell_distance(gs, from, i);
+      if (dist <= radius) {
+        found_add(found, i, dist);
+        ++*total;
+      }
+      w &= w - 1;
+    }
+  }
+}
+
+// Look through the buckets ring by ring out from the one cell from is in.
+// With stop_early set we quit once found is full and nothing further out
+// can be closer than what's in it.
+static size_t search(struct game_state *gs, int item, size_t from, uint32_t radius,
+                       struct found *found, bool stop_early)
+{
+  const uint8_t *buckets = item_buckets(gs, item);
+  const uint64_t *plane = item_plane(gs, item);
+  size_t total = 0;
+
+  uint32_t qr = (from / gs->stride - 1) / BUCKET_SIZE, qc = (from % gs->stride - 1) / BUCKET_SIZE;
+  int rlo, rhi, clo, chi;
+  offset_range(gs->wrap, qr, gs->bucket_rows, &rlo, &rhi);
+  offset_range(gs->wrap, qc, gs->bucket_cols, &clo, &chi);
+
+  int max_ring = -rlo;
+  max_ring = rhi > max_ring ? rhi : max_ring;
+  max_ring = -clo > max_ring ? -clo : max_ring;
+  max_ring = chi > max_ring ? chi : max_ring;
+
+  for (int ring = 0; ring <= max_ring; ring++) {
+    // Everything in this ring or beyond is at least this far away. A
+    // wrap-around board's last bucket can be a partial one, which lets
+    // the buckets across the edge be up to a bucket closer than they look.
+    int nearest = (ring - 1 - gs->wrap) * BUCKET_SIZE + 1;
+    if (nearest > 0 && (uint32_t) nearest > radius)
+      break;
+    if (stop_early && nearest > 0 && found->count == found->max
+          && (uint32_t) nearest >= found->dists[found->count - 1])
+      break;
+
+    for (int dr = -ring; dr <= ring; dr++) {
+      if (dr < rlo || dr > rhi)
+        continue;
+
+      // the top and bottom of the ring are whole rows of buckets, the
+      // sides are just the two ends
+      int step = (dr == -ring || dr == ring) ? 1 : 2 * ring;
+      for (int dc = -ring; dc <= ring; dc += step) {
+        if (dc < clo || dc > chi)
+          continue;
+
+        uint32_t br = (qr + dr + gs->bucket_rows) % gs->bucket_rows;
+        uint32_t bc = (qc + dc + gs->bucket_cols) % gs->bucket_cols;
+        if (buckets[br * gs->bucket_cols + bc])
+          scan_bucket(gs, plane, br, bc, from, radius, found, &total);
+      }
+    }
+  }
+
+  return total;
+}
+
+// The (up to) k snacks or mushrooms closest to cell from, nearest first.
+// Returns how many there were. k can't be more than NEAREST_MAX; for more
+// than that, items_within() with a big radius does the same job.
+size_t nearest_items(struct game_state *gs, int item, size_t from, size_t *out, size_t k)
+{
+  if (k == 0)
+    return 0;
+  if (k > NEAREST_MAX)
+    k = NEAREST_MAX;
+
+  uint32_t dists[NEAREST_MAX];
+  struct found found = { out, dists, 0, k };
+  search(gs, item, from, UINT32_MAX, &found, true);
+
+  return found.count;
+}
+
+// The snacks or mushrooms no more than radius moves from cell from, nearest
+// first. Returns how many there are, of which the first max go in out.
+size_t items_within(struct game_state *gs, int item, size_t from, uint32_t radius,
+                      size_t *out, size_t max)
+{
+  if (max == 0) {
+    size_t cell;
+    uint32_t dist;
+    struct found found = { &cell, &dist, 0, 1 };
+    return search(gs, item, from, radius, &found, false);
+  }
+
+  uint32_t *dists = malloc(max * sizeof(uint32_t));
+  if (!dists)
+    die("malloc");
+  struct found found = { out, dists, 0, max };
+  size_t total = search(gs, item, from, radius, &found, false);
+  free(dists);
+
+  return total;
+}
+
+// Time nearest-snack queries against just scanning the snack plane, and
+// check they agree
+int bench_nearest(void)
+{
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 1000, 1000 } };
+
+  size_t failures = 0;
+  srand(1);
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (int wrap = 0; wrap < 2; wrap++) {
+      uint32_t rows = sizes[s][0], cols = sizes[s][1];
+      struct arena arena;
+      arena_init(&arena, game_arena_size(rows, cols));
+
+      struct game_state gs = { .arena = &arena, .wrap = wrap, .rng = 1 };
+      board_init(&gs, rows, cols);
+      struct snek *snek = snek_init(&gs);
+      size_t snacks = (size_t) rows * cols / 150;
+      add_snacks(&gs, snek, snacks);
+
+      size_t queries = 20000, mismatches = 0, k = 4;
+      size_t *from = malloc(queries * sizeof(size_t));
+      size_t *fast = malloc(queries * sizeof(size_t));
+      for (size_t q = 0; q < queries; q++)
+        from[q] = (rand() % (rows - 2) + 1) * gs.stride + rand() % (cols - 2) + 1;
+
+      double start = now_secs();
+      for (size_t q = 0; q < queries; q++) {
+        size_t out[4];
+        nearest_items(&gs, SNEK_SNACK, from[q], out, k);
+        fast[q] = cell_distance(&gs, from[q], out[k - 1]);
+      }
+      double fast_time = now_secs() - start;
+
+      start = now_secs();
+      for (size_t q = 0; q < queries; q++) {
+        uint32_t best[4] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+        for (size_t j = 0; j < gs.words; j++) {
+          uint64_t w = gs.snacks[j];
+          while (w) {
+            uint32_t d = cell_distance(&gs, from[q], j * 64 + __builtin_ctzll(w));
+            for (size_t m = 0; m < k; m++) {
+              if (d < best[m]) {
+                uint32_t t = best[m];
+                best[m] = d;
+                d = t;
+              }
+            }
+            w &= w - 1;
+          }
+        }
+        mismatches += best[k - 1] != fast[q];
+      }
+      double scan_time = now_secs() - start;
+
+      printf("%5ux%-5u %-5s %7zu snacks  nearest %zu: %8.2f us/query (scan %9.2f us)  %zu mismatches\n",
+              rows, cols, wrap ? "wrap" : "", snacks, k, fast_time * 1e6 / queries,
+              scan_time * 1e6 / queries, mismatches);
+      failures += mismatches;
+
+      free(from);
+      free(fast);
+      arena_destroy(&arena);
+    }
+  }
+
+  return failures > 0;
+}
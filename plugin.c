@@ -0,0 +1,141 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Loading bots that were built as shared objects against snekbot.h. A bot
+// is named on the command line as the path to its .so, optionally followed
+// by a ':' and arguments for it, like ./greedy.so or ./policy.so:weights.bin
+
+#define _DEFAULT_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+// the bot ABI has its own copy of the directions, so they'd better agree
+_Static_assert(SNEKBOT_NORTH == NORTH && SNEKBOT_SOUTH == SOUTH
+                  && SNEKBOT_EAST == EAST && SNEKBOT_WEST == WEST,
+                "snekbot.h directions don't match the game's");
+
+struct plugin {
+  void *handle;
+  const struct snekbot *api;
+  void *bot;
+};
+
+// Load and start up the bot named by spec. Returns NULL (after saying why)
+// if it can't.
+struct plugin *plugin_load(const char *spec)
+{
+  char path[4096];
+  const char *colon = strchr(spec, ':');
+  size_t len = colon ? (size_t) (colon - spec) : strlen(spec);
+  if (len >= sizeof(path)) {
+    fprintf(stderr, "bot path too long: %s\n", spec);
+    return NULL;
+  }
+  memcpy(path, spec, len);
+  path[len] = '\0';
+
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    fprintf(stderr, "couldn't load bot: %s\n", dlerror());
+    return NULL;
+  }
+
+  const struct snekbot *(*entry)(void);
+  *(void **) &entry = dlsym(handle, "snekbot_entry");
+  const struct snekbot *api = entry ? entry() : NULL;
+  if (!api) {
+    fprintf(stderr, "%s doesn't look like a bot (no snekbot_entry)\n", path);
+    dlclose(handle);
+    return NULL;
+  }
+  if (api->abi_version != SNEKBOT_ABI_VERSION) {
+    fprintf(stderr, "%s was built for bot ABI version %u, but this is version %u\n",
+              path, api->abi_version, SNEKBOT_ABI_VERSION);
+    dlclose(handle);
+    return NULL;
+  }
+
+  struct plugin *plugin = malloc(sizeof(struct plugin));
+  if (!plugin)
+    die("malloc");
+  plugin->handle = handle;
+  plugin->api = api;
+  plugin->bot = api->create ? api->create(colon ? colon + 1 : "") : NULL;
+
+  return plugin;
+}
+
+void plugin_free(struct plugin *plugin)
+{
+  if (plugin->api->destroy)
+    plugin->api->destroy(plugin->bot);
+  dlclose(plugin->handle);
+  free(plugin);
+}
+
+const char *plugin_name(const struct plugin *plugin)
+{
+  return plugin->api->name ? plugin->api->name : "?";
+}
+
+void plugin_decide(struct plugin *plugin, const struct snekbot_view *views, size_t count, uint32_t *dirs)
+{
+  plugin->api->decide(plugin->bot, views, count, dirs);
+}
+
+// Play the same games with the bot in batches of different sizes, to see
+// what calling it once for lots of games saves
+int bench_plugin(const char *spec)
+{
+  struct plugin *plugin = plugin_load(spec);
+  if (!plugin)
+    return 1;
+
+  uint32_t sizes[] = { 1, 16, 256 };
+  uint32_t games = 256, max_ticks = 2000;
+
+  printf("%s:\n", plugin_name(plugin));
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    struct batch *batch = batch_new(sizes[s], MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+    size_t ticks = 0, calls = 0;
+    uint64_t total_score = 0;
+
+    double start = now_secs();
+    for (uint32_t first = 0; first < games; first += sizes[s]) {
+      for (uint32_t g = 0; g < sizes[s]; g++)
+        batch_reset(batch, g, first + g + 1);
+
+      calls += batch_play(batch, plugin, max_ticks);
+      for (uint32_t g = 0; g < sizes[s]; g++) {
+        ticks += batch->games[g].ticks;
+        total_score += batch->games[g].gs.score;
+      }
+    }
+    double elapsed = now_secs() - start;
+
+    // the same seeds get played whatever the batch size, so the scores
+    // should come out the same every time
+    printf("  batches of %3u: %9.0f ticks/s, %7.0f games/s, %8.2f us per call, average score %.1f\n",
+            sizes[s], ticks / elapsed, games / elapsed, elapsed * 1e6 / calls,
+            (double) total_score / games);
+
+    batch_free(batch);
+  }
+
+  plugin_free(plugin);
+
+  return 0;
+}
@@ -0,0 +1,607 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A bot that's a small neural net: a few fully connected layers with 8-bit
+// weights, from the snek's surroundings to a score for each direction.
+//
+// What the net sees is an 11x11 window of the board around the head (what's
+// blocked, where the snacks are, where the mushrooms are), which way the
+// snek is heading, and which way the nearest snack is. That's the same
+// whatever size the board is.
+//
+// Everything is in 8-bit integers. The inputs and the activations between
+// layers go from 0 to 127, the weights from -128 to 127, and each layer adds
+// its products up in 32 bits, adds a bias, cuts off anything below zero and
+// scales the rest back down to 0-127 for the next layer. The last layer's
+// sums are the scores. On x86 chips with AVX2, 32 weights get multiplied at a
+// time, and everywhere else it's plain loops. The answers are exactly the
+// same either way, since it's all integers.
+//
+// The weights live in a flat file that gets mmapped straight in, laid out
+// the way the code wants them (every row padded to a multiple of 32 bytes so
+// the vector loads don't have to care), in the machine's byte order:
+//
+//   the header: "SNEKPOL1", the number of layers, the size of each layer
+//     and each layer's scale
+//   then for each layer:
+//     a 32-bit bias for every output, padded to 32 bytes
+//     the weights, one padded row of inputs for every output
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2 1
+#endif
+
+#include "snek.h"
+
+#define POLICY_MAGIC "SNEKPOL1"
+#define ON 127
+
+#define PAD(n) (((n) + 31) & ~(size_t) 31)
+
+struct policy_header {
+  char magic[8];
+  uint32_t layers;
+  uint32_t sizes[POLICY_MAX_LAYERS + 1];
+  int32_t scales[POLICY_MAX_LAYERS];
+};
+
+struct layer {
+  uint32_t inputs;
+  uint32_t outputs;
+  uint32_t stride;
+  int32_t scale;
+  int32_t *bias;
+  int8_t *weights;
+};
+
+struct policy {
+  uint8_t *base;
+  size_t size;
+  bool mapped;
+  bool avx2;
+  uint32_t layers;
+  struct layer layer[POLICY_MAX_LAYERS];
+
+  // room for a batch's observations, activations and scores, grown as
+  // needed
+  uint8_t *obs;
+  uint8_t *acts[2];
+  int32_t *sums;
+  int32_t *scores;
+  size_t room;
+};
+
+// How many bytes a net with these layer sizes takes up
+static size_t policy_bytes(uint32_t layers, const uint32_t *sizes)
+{
+  size_t bytes = PAD(sizeof(struct policy_header));
+  for (uint32_t l = 0; l < layers; l++)
+    bytes += PAD(sizes[l + 1] * sizeof(int32_t)) + sizes[l + 1] * PAD(sizes[l]);
+
+  return bytes;
+}
+
+// Point the layers at their parts of the buffer
+static void policy_layout(struct policy *policy)
+{
+  const struct policy_header *header = (const struct policy_header *) policy->base;
+  uint8_t *p = policy->base + PAD(sizeof(struct policy_header));
+
+  policy->layers = header->layers;
+  for (uint32_t l = 0; l < header->layers; l++) {
+    struct layer *layer = &policy->layer[l];
+    layer->inputs = header->sizes[l];
+    layer->outputs = header->sizes[l + 1];
+    layer->stride = PAD(layer->inputs);
+    layer->scale = header->scales[l];
+    layer->bias = (int32_t *) p;
+    p += PAD(layer->outputs * sizeof(int32_t));
+    layer->weights = (int8_t *) p;
+    p += (size_t) layer->outputs * layer->stride;
+  }
+}
+
+static struct policy *policy_alloc(void)
+{
+  struct policy *policy = calloc(1, sizeof(struct policy));
+  if (!policy)
+    die("calloc");
+
+#ifdef HAVE_AVX2
+  policy->avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+  return policy;
+}
+
+// A new net with hidden layers of the given sizes and small random weights
+struct policy *policy_new(uint32_t hidden, const uint32_t *hidden_sizes, uint64_t seed)
+{
+  if (hidden + 1 > POLICY_MAX_LAYERS)
+    die("policy_new");
+
+  struct policy_header header = { .magic = POLICY_MAGIC, .layers = hidden + 1 };
+  header.sizes[0] = POLICY_INPUTS;
+  for (uint32_t l = 0; l < hidden; l++)
+    header.sizes[l + 1] = hidden_sizes[l];
+  header.sizes[hidden + 1] = 4;
+
+  // scale each layer's sums so a typical one comes out in the middle of
+  // the 0-127 range, given weights up to +/-16 and inputs up to 127
+  for (uint32_t l = 0; l < header.layers; l++)
+    header.scales[l] = 65536 / (8 * sqrt(header.sizes[l]));
+
+  struct policy *policy = policy_alloc();
+  policy->size = policy_bytes(header.layers, header.sizes);
+  policy->base = aligned_alloc(32, policy->size);
+  if (!policy->base)
+    die("aligned_alloc");
+  memset(policy->base, 0, policy->size);
+  memcpy(policy->base, &header, sizeof(header));
+  policy_layout(policy);
+
+  for (uint32_t l = 0; l < policy->layers; l++) {
+    struct layer *layer = &policy->layer[l];
+    for (uint32_t o = 0; o < layer->outputs; o++) {
+      for (uint32_t i = 0; i < layer->inputs; i++)
+        layer->weights[(size_t) o * layer->stride + i] = (int8_t) (splitmix64(&seed) % 33) - 16;
+    }
+  }
+
+  return policy;
+}
+
+// Map a net in from a file. Returns NULL, with errno set, if it can't.
+struct policy *policy_load(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  void *base = MAP_FAILED;
+  if ((size_t) st.st_size >= sizeof(struct policy_header))
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // make sure it's a net we can run before believing any of it
+  const struct policy_header *header = base;
+  bool ok = memcmp(header->magic, POLICY_MAGIC, 8) == 0
+              && header->layers >= 1 && header->layers <= POLICY_MAX_LAYERS
+              && header->sizes[0] == POLICY_INPUTS && header->sizes[header->layers] == 4;
+  for (uint32_t l = 1; ok && l < header->layers; l++)
+    ok = header->sizes[l] >= 1 && header->sizes[l] <= 4096;
+  if (!ok || policy_bytes(header->layers, header->sizes) != (size_t) st.st_size) {
+    munmap(base, st.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  struct policy *policy = policy_alloc();
+  policy->base = base;
+  policy->size = st.st_size;
+  policy->mapped = true;
+  policy_layout(policy);
+
+  return policy;
+}
+
+// Write a net out to a file policy_load() can read
+bool policy_save(const struct policy *policy, const char *path)
+{
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+
+  bool ok = fwrite(policy->base, 1, policy->size, f) == policy->size;
+
+  return fclose(f) == 0 && ok;
+}
+
+void policy_free(struct policy *policy)
+{
+  if (policy->mapped)
+    munmap(policy->base, policy->size);
+  else
+    free(policy->base);
+  free(policy->obs);
+  free(policy->acts[0]);
+  free(policy->acts[1]);
+  free(policy->sums);
+  free(policy->scores);
+  free(policy);
+}
+
+// Copy src's weights over dst's, which has to be the same shape
+void policy_copy(struct policy *dst, const struct policy *src)
+{
+  memcpy(dst->base, src->base, src->size);
+}
+
+// A new net just like src, that can be changed without touching it
+struct policy *policy_clone(const struct policy *src)
+{
+  struct policy *policy = policy_alloc();
+  policy->avx2 = src->avx2;
+  policy->size = src->size;
+  policy->base = aligned_alloc(32, src->size);
+  if (!policy->base)
+    die("aligned_alloc");
+  memcpy(policy->base, src->base, src->size);
+  policy_layout(policy);
+
+  return policy;
+}
+
+// Nudge a random few of the weights and biases (about rate of them) a
+// little way up or down, for a trainer trying out variations on a net.
+// Only for nets that aren't mapped in from a file.
+void policy_mutate(struct policy *policy, uint64_t *rng, double rate)
+{
+  uint64_t threshold = rate * (double) UINT64_MAX;
+
+  for (uint32_t l = 0; l < policy->layers; l++) {
+    struct layer *layer = &policy->layer[l];
+    for (uint32_t o = 0; o < layer->outputs; o++) {
+      int8_t *w = layer->weights + (size_t) o * layer->stride;
+      for (uint32_t i = 0; i < layer->inputs; i++) {
+        if (splitmix64(rng) >= threshold)
+          continue;
+        int v = w[i] + (int) (splitmix64(rng) % 9) - 4;
+        w[i] = v < -127 ? -127 : v > 127 ? 127 : v;
+      }
+
+      // a bias step is about what one strong input adds
+      if (splitmix64(rng) < threshold)
+        layer->bias[o] += ((int32_t) (splitmix64(rng) % 33) - 16) * ON;
+    }
+  }
+}
+
+bool policy_use_avx2(struct policy *policy, bool avx2)
+{
+#ifdef HAVE_AVX2
+  policy->avx2 = avx2 && __builtin_cpu_supports("avx2");
+#else
+  (void) avx2;
+#endif
+
+  return policy->avx2;
+}
+
+static bool view_test(const uint64_t *plane, size_t i)
+{
+  return plane[i / 64] >> (i % 64) & 1;
+}
+
+// The shorter way along a row or column of size cells to go d cells, on a
+// board that wraps (the same as cell_distance() in nearby.c works out)
+static int wrap_offset(int d, int size)
+{
+  if (abs(d) > size - abs(d))
+    return d > 0 ? d - size : d + size;
+
+  return d;
+}
+
+// What the net sees of a game: POLICY_INPUTS values, padded with zeros to
+// a multiple of 32
+void policy_observe(const struct snekbot_view *view, uint8_t *obs)
+{
+  uint32_t head = view->cells[view->head];
+  int hr = head / view->stride, hc = head % view->stride;
+  int rows = view->rows - 2, cols = view->cols - 2;
+
+  memset(obs, 0, POLICY_OBS_SIZE);
+
+  // the window around the head: blocked, snacks, mushrooms
+  size_t k = 0;
+  for (int dr = -POLICY_WINDOW / 2; dr <= POLICY_WINDOW / 2; dr++) {
+    for (int dc = -POLICY_WINDOW / 2; dc <= POLICY_WINDOW / 2; dc++, k++) {
+      int r = hr + dr - 1, c = hc + dc - 1;
+      if (view->wrap) {
+        r = (r % rows + rows) % rows;
+        c = (c % cols + cols) % cols;
+      }
+      else if (r < 0 || r >= rows || c < 0 || c >= cols) {
+        obs[k] = ON;
+        continue;
+      }
+
+      size_t i = (size_t) (r + 1) * view->stride + c + 1;
+      obs[k] = view_test(view->walls, i) || view_test(view->body, i) ? ON : 0;
+      obs[POLICY_WINDOW * POLICY_WINDOW + k] = view_test(view->snacks, i) ? ON : 0;
+      obs[2 * POLICY_WINDOW * POLICY_WINDOW + k] = view_test(view->mushrooms, i) ? ON : 0;
+    }
+  }
+
+  // which way we're going
+  uint8_t *rest = obs + 3 * POLICY_WINDOW * POLICY_WINDOW;
+  rest[view->dir & 3] = ON;
+
+  // and which way the nearest snack is (going across the edge, if that's
+  // shorter on a board that wraps)
+  uint32_t best = UINT32_MAX;
+  int sr = 0, sc = 0;
+  for (uint32_t j = 0; j < view->words; j++) {
+    uint64_t w = view->snacks[j];
+    while (w) {
+      uint32_t i = j * 64 + __builtin_ctzll(w);
+      int dr = (int) (i / view->stride) - hr, dc = (int) (i % view->stride) - hc;
+      if (view->wrap) {
+        dr = wrap_offset(dr, rows);
+        dc = wrap_offset(dc, cols);
+      }
+      uint32_t d = abs(dr) + abs(dc);
+      if (d < best) {
+        best = d;
+        sr = dr;
+        sc = dc;
+      }
+      w &= w - 1;
+    }
+  }
+  rest[4 + NORTH] = sr < 0 ? ON : 0;
+  rest[4 + SOUTH] = sr > 0 ? ON : 0;
+  rest[4 + EAST] = sc > 0 ? ON : 0;
+  rest[4 + WEST] = sc < 0 ? ON : 0;
+}
+
+// One layer's sums for a batch of inputs, the plain way
+static void layer_sums(const struct layer *layer, const uint8_t *in, size_t count, int32_t *out)
+{
+  for (uint32_t o = 0; o < layer->outputs; o++) {
+    const int8_t *w = layer->weights + (size_t) o * layer->stride;
+    for (size_t s = 0; s < count; s++) {
+      const uint8_t *x = in + s * layer->stride;
+      int32_t sum = layer->bias[o];
+      for (uint32_t i = 0; i < layer->stride; i++)
+        sum += x[i] * w[i];
+      out[s * layer->outputs + o] = sum;
+    }
+  }
+}
+
+#ifdef HAVE_AVX2
+// And 32 at a time. maddubs multiplies unsigned bytes by signed ones and
+// adds neighbouring pairs into 16 bits, which can't overflow since the
+// activations are no more than 127.
+__attribute__((target("avx2")))
+static void layer_sums_avx2(const struct layer *layer, const uint8_t *in, size_t count, int32_t *out)
+{
+  __m256i ones = _mm256_set1_epi16(1);
+
+  for (uint32_t o = 0; o < layer->outputs; o++) {
+    const int8_t *w = layer->weights + (size_t) o * layer->stride;
+    for (size_t s = 0; s < count; s++) {
+      const uint8_t *x = in + s * layer->stride;
+      __m256i acc = _mm256_setzero_si256();
+      for (uint32_t i = 0; i < layer->stride; i += 32) {
+        __m256i xs = _mm256_loadu_si256((const __m256i *) (x + i));
+        __m256i ws = _mm256_loadu_si256((const __m256i *) (w + i));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(xs, ws), ones));
+      }
+
+      __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+      sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+      sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+      out[s * layer->outputs + o] = layer->bias[o] + _mm_cvtsi128_si32(sum);
+    }
+  }
+}
+#endif
+
+// Make sure there's room for a batch of count
+static void policy_room(struct policy *policy, size_t count)
+{
+  if (count <= policy->room)
+    return;
+
+  size_t widest = 0;
+  for (uint32_t l = 0; l < policy->layers; l++) {
+    widest = policy->layer[l].stride > widest ? policy->layer[l].stride : widest;
+    widest = policy->layer[l].outputs > widest ? policy->layer[l].outputs : widest;
+  }
+
+  free(policy->obs);
+  free(policy->acts[0]);
+  free(policy->acts[1]);
+  free(policy->sums);
+  free(policy->scores);
+  policy->obs = aligned_alloc(32, count * POLICY_OBS_SIZE);
+  policy->acts[0] = aligned_alloc(32, count * widest);
+  policy->acts[1] = aligned_alloc(32, count * widest);
+  policy->sums = malloc(count * widest * sizeof(int32_t));
+  policy->scores = malloc(count * 4 * sizeof(int32_t));
+  if (!policy->obs || !policy->acts[0] || !policy->acts[1] || !policy->sums || !policy->scores)
+    die("malloc");
+  policy->room = count;
+}
+
+// Run the net on a batch of observations (each padded to a multiple of 32)
+// and put its four scores for each in scores
+void policy_run(struct policy *policy, const uint8_t *obs, size_t count, int32_t *scores)
+{
+  policy_room(policy, count);
+
+  const uint8_t *in = obs;
+  for (uint32_t l = 0; l < policy->layers; l++) {
+    const struct layer *layer = &policy->layer[l];
+    bool last = l + 1 == policy->layers;
+    int32_t *sums = last ? scores : policy->sums;
+
+#ifdef HAVE_AVX2
+    if (policy->avx2)
+      layer_sums_avx2(layer, in, count, sums);
+    else
+#endif
+      layer_sums(layer, in, count, sums);
+
+    if (last)
+      break;
+
+    // cut off below zero and scale down into the next layer's inputs
+    uint8_t *next = policy->acts[l % 2];
+    size_t stride = PAD(layer->outputs);
+    for (size_t s = 0; s < count; s++) {
+      uint8_t *x = next + s * stride;
+      for (uint32_t o = 0; o < layer->outputs; o++) {
+        int64_t a = sums[s * layer->outputs + o];
+        a = a <= 0 ? 0 : (a * layer->scale) >> 16;
+        x[o] = a > ON ? ON : a;
+      }
+      memset(x + layer->outputs, 0, stride - layer->outputs);
+    }
+    in = next;
+  }
+}
+
+// Decide for a batch of games, the same as a bot plugin would: whichever
+// way scores highest, apart from straight back
+void policy_decide(struct policy *policy, const struct snekbot_view *views, size_t count, uint32_t *dirs)
+{
+  size_t stride = POLICY_OBS_SIZE;
+  policy_room(policy, count);
+
+  uint8_t *obs = policy->obs;
+  int32_t *scores = policy->scores;
+  for (size_t s = 0; s < count; s++)
+    policy_observe(&views[s], obs + s * stride);
+  policy_run(policy, obs, count, scores);
+
+  for (size_t s = 0; s < count; s++) {
+    uint32_t best = views[s].dir;
+    for (uint32_t d = 0; d < 4; d++) {
+      if (d != (views[s].dir ^ 1) && scores[s * 4 + d] > scores[s * 4 + best])
+        best = d;
+    }
+    dirs[s] = best;
+  }
+}
+
+// Time the net on batches of observations from real games, with and
+// without AVX2, check both ways give the same scores, and check a net
+// saved and mapped back in gives the same scores as the one in memory
+int bench_policy(void)
+{
+  uint32_t hidden[] = { 64, 32 };
+  struct policy *policy = policy_new(2, hidden, 1);
+
+  char path[] = "/tmp/snek-policy-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1 || !policy_save(policy, path))
+    die(path);
+  close(fd);
+  struct policy *mapped = policy_load(path);
+  unlink(path);
+  if (!mapped)
+    die(path);
+
+  // some observations from games a little way in
+  size_t count = 256, stride = POLICY_OBS_SIZE;
+  struct batch *batch = batch_new(count, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  for (uint32_t g = 0; g < count; g++)
+    batch_reset(batch, g, g + 1);
+  uint32_t *dirs = malloc(count * sizeof(uint32_t));
+  if (!dirs)
+    die("malloc");
+  for (int t = 0; t < 5; t++) {
+    size_t n = batch_views(batch);
+    for (size_t s = 0; s < n; s++)
+      dirs[s] = batch->views[s].dir;
+    batch_step(batch, n, dirs);
+  }
+  size_t n = batch_views(batch);
+  uint8_t *obs = aligned_alloc(32, n * stride);
+  if (!obs)
+    die("aligned_alloc");
+  for (size_t s = 0; s < n; s++)
+    policy_observe(&batch->views[s], obs + s * stride);
+
+  int32_t *scores[3];
+  for (int k = 0; k < 3; k++) {
+    scores[k] = malloc(n * 4 * sizeof(int32_t));
+    if (!scores[k])
+      die("malloc");
+  }
+
+  printf("%u-%u-%u-4 net, %zu bytes of weights\n", POLICY_INPUTS, hidden[0], hidden[1], policy->size);
+  size_t batches[] = { 1, 16, 256 };
+  for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+    size_t size = batches[b] < n ? batches[b] : n;
+    double per[2] = { 0 };
+
+    for (int avx2 = 0; avx2 < 2; avx2++) {
+      if (policy_use_avx2(policy, avx2) != avx2)
+        continue;
+
+      size_t runs = 200000 / size, done = 0;
+      double start = now_secs();
+      for (size_t r = 0; r < runs; r++) {
+        size_t first = (r * size) % (n - size + 1);
+        policy_run(policy, obs + first * stride, size, scores[avx2]);
+        done += size;
+      }
+      per[avx2] = (now_secs() - start) * 1e6 / done;
+    }
+
+    printf("  batches of %3zu: %6.2f us per decision plain, ", size, per[0]);
+    if (per[1] > 0)
+      printf("%6.2f us with AVX2\n", per[1]);
+    else
+      printf("no AVX2 here\n");
+  }
+
+  // the plain loops are the reference
+  size_t mismatches = 0;
+  policy_use_avx2(policy, false);
+  policy_run(policy, obs, n, scores[0]);
+  policy_use_avx2(policy, true);
+  policy_run(policy, obs, n, scores[1]);
+  policy_use_avx2(mapped, false);
+  policy_run(mapped, obs, n, scores[2]);
+  for (size_t j = 0; j < n * 4; j++)
+    mismatches += scores[0][j] != scores[1][j] || scores[0][j] != scores[2][j];
+  printf("  %zu scores different between plain, AVX2 and mapped\n", mismatches);
+
+  for (int k = 0; k < 3; k++)
+    free(scores[k]);
+  free(obs);
+  free(dirs);
+  batch_free(batch);
+  policy_free(mapped);
+  policy_free(policy);
+
+  return mismatches > 0;
+}
@@ -0,0 +1,788 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// The game the slow, obvious way, to check the fast one against.
+//
+// This is how snek was first written: the snek is a linked list of points,
+// the board is a plain array of items, and everything is found by walking
+// one or the other. Collisions walk the whole snek, items go down on the
+// nth free cell found by walking the board, and obstacles are checked by
+// flooding the whole board every time instead of looking around them
+// first. It plays by exactly the same rules as the real game and draws the
+// same random numbers in the same order, so from the same seed and the same
+// keys the two should never disagree.
+//
+// snek --diff-test N plays N games both ways side by side, with made up
+// keys, and compares a hash of each after every tick. The hash is over
+// rows and columns rather than cell numbers, since the real board has
+// padded rows. When they disagree, the keys get cut back to the fewest
+// that still make them disagree and the game is printed out so it can be
+// played again.
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "snek.h"
+
+#define REF_TICKS 3000
+
+// a key that leaves the snek going the way it was
+#define NO_TURN 4
+
+struct pt {
+  uint32_t row;
+  uint32_t col;
+  struct pt *next;
+  struct pt *prev;
+};
+
+struct ref_game {
+  uint32_t rows;
+  uint32_t cols;
+  bool wrap;
+  int *items;
+  struct pt *head;
+  struct pt *tail;
+  uint32_t dir;
+  uint32_t score;
+  useconds_t speed;
+  useconds_t saved_speed;
+  uint64_t played;
+  bool poisoned;
+  uint64_t poisoned_at;
+  uint32_t last_wall_attempt;
+  uint64_t rng;
+};
+
+// A game to play both ways: the board, the seed and a key for every tick
+struct diff_case {
+  uint32_t rows;
+  uint32_t cols;
+  bool wrap;
+  uint64_t seed;
+  uint8_t keys[REF_TICKS];
+  uint32_t len;
+};
+
+static uint32_t ref_rand(struct ref_game *ref)
+{
+  return splitmix64(&ref->rng) >> 32;
+}
+
+static bool ref_interior(struct ref_game *ref, uint32_t row, uint32_t col)
+{
+  return row > 0 && row < ref->rows - 1 && col > 0 && col < ref->cols - 1;
+}
+
+static bool ref_on_snek(struct ref_game *ref, uint32_t row, uint32_t col)
+{
+  for (struct pt *seg = ref->head; seg; seg = seg->prev) {
+    if (seg->row == row && seg->col == col)
+      return true;
+  }
+
+  return false;
+}
+
+static struct pt *ref_segment(uint32_t row, uint32_t col)
+{
+  struct pt *seg = calloc(1, sizeof(struct pt));
+  if (!seg)
+    die("calloc");
+  seg->row = row;
+  seg->col = col;
+
+  return seg;
+}
+
+// add a segment at the head end
+static void ref_push_head(struct ref_game *ref, uint32_t row, uint32_t col)
+{
+  struct pt *seg = ref_segment(row, col);
+  seg->prev = ref->head;
+  if (ref->head)
+    ref->head->next = seg;
+  else
+    ref->tail = seg;
+  ref->head = seg;
+}
+
+static void ref_free(struct ref_game *ref)
+{
+  struct pt *p = ref->head;
+  while (p) {
+    struct pt *seg = p;
+    p = p->prev;
+    free(seg);
+  }
+
+  free(ref->items);
+}
+
+static void ref_add_item(struct ref_game *ref, int item)
+{
+  bool *taken = malloc((size_t) ref->rows * ref->cols * sizeof(bool));
+  if (!taken)
+    die("malloc");
+  for (size_t i = 0; i < (size_t) ref->rows * ref->cols; i++)
+    taken[i] = ref->items[i] != EMPTY;
+  for (struct pt *seg = ref->head; seg; seg = seg->prev)
+    taken[seg->row * ref->cols + seg->col] = true;
+
+  size_t count = 0;
+  for (uint32_t r = 1; r < ref->rows - 1; r++) {
+    for (uint32_t c = 1; c < ref->cols - 1; c++)
+      count += !taken[r * ref->cols + c];
+  }
+
+  size_t n = count ? ref_rand(ref) % count : 0;
+  for (uint32_t r = 1; r < ref->rows - 1 && count; r++) {
+    for (uint32_t c = 1; c < ref->cols - 1; c++) {
+      if (!taken[r * ref->cols + c] && n-- == 0) {
+        ref->items[r * ref->cols + c] = item;
+        count = 0;
+        break;
+      }
+    }
+  }
+
+  free(taken);
+}
+
+static void ref_add_items(struct ref_game *ref, int item, int count)
+{
+  while (count-- > 0)
+    ref_add_item(ref, item);
+}
+
+// Can every cell in cells (count of them) be reached from the first one
+// without going through a wall or off the board?
+static bool ref_connected(struct ref_game *ref, const uint32_t *cells, int count)
+{
+  size_t size = (size_t) ref->rows * ref->cols;
+  bool *seen = calloc(size, sizeof(bool));
+  uint32_t *queue = malloc(size * sizeof(uint32_t));
+  if (!seen || !queue)
+    die("calloc");
+
+  size_t head = 0, tail = 0;
+  seen[cells[0]] = true;
+  queue[tail++] = cells[0];
+  while (head < tail) {
+    uint32_t row = queue[head] / ref->cols, col = queue[head] % ref->cols;
+    head++;
+
+    int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+    for (int d = 0; d < 4; d++) {
+      uint32_t nr = row + dr[d], nc = col + dc[d];
+      if (ref->wrap) {
+        nr = nr == 0 ? ref->rows - 2 : nr == ref->rows - 1 ? 1 : nr;
+        nc = nc == 0 ? ref->cols - 2 : nc == ref->cols - 1 ? 1 : nc;
+      }
+      uint32_t i = nr * ref->cols + nc;
+      if (ref_interior(ref, nr, nc) && ref->items[i] != WALL && !seen[i]) {
+        seen[i] = true;
+        queue[tail++] = i;
+      }
+    }
+  }
+
+  bool connected = true;
+  for (int j = 1; j < count; j++)
+    connected &= seen[cells[j]];
+
+  free(seen);
+  free(queue);
+
+  return connected;
+}
+
+static bool ref_in_front(struct ref_game *ref, uint32_t row, uint32_t col)
+{
+  int dr = (int) row - (int) ref->head->row, dc = (int) col - (int) ref->head->col;
+
+  if (abs(dr) <= 1 && abs(dc) <= 1)
+    return true;
+
+  switch (ref->dir) {
+    case NORTH:
+      return dc == 0 && dr < 0 && dr >= -6;
+    case SOUTH:
+      return dc == 0 && dr > 0 && dr <= 6;
+    case EAST:
+      return dr == 0 && dc > 0 && dc <= 6;
+    default:
+      return dr == 0 && dc < 0 && dc >= -6;
+  }
+}
+
+// The same shapes, from the same random numbers, as maze.c
+static int ref_shape(struct ref_game *ref, int *drs, int *dcs)
+{
+  int len = 0;
+  int a = ref_rand(ref) % 5 + 3, b = ref_rand(ref) % 4 + 2;
+  switch (ref_rand(ref) % 4) {
+    case 0:
+      for (int j = 0; j < a; j++, len++) {
+        drs[len] = 0;
+        dcs[len] = j;
+      }
+      break;
+    case 1:
+      for (int j = 0; j < a; j++, len++) {
+        drs[len] = j;
+        dcs[len] = 0;
+      }
+      for (int j = 1; j < b; j++, len++) {
+        drs[len] = a - 1;
+        dcs[len] = j;
+      }
+      break;
+    case 2:
+      for (int j = 0; j < a; j++, len++) {
+        drs[len] = 0;
+        dcs[len] = j;
+      }
+      for (int j = 1; j < b; j++, len++) {
+        drs[len] = j;
+        dcs[len] = a / 2;
+      }
+      break;
+    case 3:
+      for (int r = 0; r < b / 2 + 1; r++) {
+        for (int c = 0; c < b; c++, len++) {
+          drs[len] = r;
+          dcs[len] = c;
+        }
+      }
+      break;
+  }
+
+  if (ref_rand(ref) % 2) {
+    for (int j = 0; j < len; j++) {
+      int t = drs[j];
+      drs[j] = dcs[j];
+      dcs[j] = t;
+    }
+  }
+
+  return len;
+}
+
+static bool ref_try_obstacle(struct ref_game *ref)
+{
+  int drs[16], dcs[16];
+  int len = ref_shape(ref, drs, dcs);
+
+  uint32_t row = ref_rand(ref) % (ref->rows - 2) + 1;
+  uint32_t col = ref_rand(ref) % (ref->cols - 2) + 1;
+
+  uint32_t cells[16];
+  for (int j = 0; j < len; j++) {
+    uint32_t r = row + drs[j], c = col + dcs[j];
+    if (!ref_interior(ref, r, c) || ref->items[r * ref->cols + c] != EMPTY
+          || ref_on_snek(ref, r, c) || ref_in_front(ref, r, c))
+      return false;
+    cells[j] = r * ref->cols + c;
+  }
+
+  // put it down, and take it up again if it cuts the open cells around it
+  // off from each other
+  for (int j = 0; j < len; j++)
+    ref->items[cells[j]] = WALL;
+
+  uint32_t around[4 * 16];
+  int count = 0;
+  for (int j = 0; j < len; j++) {
+    uint32_t r = cells[j] / ref->cols, c = cells[j] % ref->cols;
+    int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+    for (int d = 0; d < 4; d++) {
+      uint32_t nr = r + dr[d], nc = c + dc[d];
+      if (ref->wrap) {
+        nr = nr == 0 ? ref->rows - 2 : nr == ref->rows - 1 ? 1 : nr;
+        nc = nc == 0 ? ref->cols - 2 : nc == ref->cols - 1 ? 1 : nc;
+      }
+      if (ref_interior(ref, nr, nc) && ref->items[nr * ref->cols + nc] != WALL)
+        around[count++] = nr * ref->cols + nc;
+    }
+  }
+
+  if (count >= 2 && !ref_connected(ref, around, count)) {
+    for (int j = 0; j < len; j++)
+      ref->items[cells[j]] = EMPTY;
+
+    return false;
+  }
+
+  return true;
+}
+
+static void ref_place_obstacle(struct ref_game *ref, int tries)
+{
+  for (int j = 0; j < tries; j++) {
+    if (ref_try_obstacle(ref))
+      return;
+  }
+}
+
+static void ref_init(struct ref_game *ref, const struct diff_case *dc)
+{
+  *ref = (struct ref_game) { .rows = dc->rows, .cols = dc->cols, .wrap = dc->wrap,
+                               .dir = EAST, .speed = 100000, .rng = dc->seed };
+  ref->items = calloc((size_t) dc->rows * dc->cols, sizeof(int));
+  if (!ref->items)
+    die("calloc");
+
+  uint32_t init_row = dc->rows / 2, init_col = dc->cols / 2 + 2;
+  for (int j = INIT_SKEN_LEN; j >= 0; j--)
+    ref_push_head(ref, init_row, init_col - j);
+
+  ref_add_items(ref, SNEK_SNACK, 20);
+  size_t count = (size_t) (dc->rows - 2) * (dc->cols - 2) / 500;
+  for (size_t j = 0; j < count; j++)
+    ref_place_obstacle(ref, 10);
+}
+
+// One tick. Returns true if the game is over.
+static bool ref_update(struct ref_game *ref)
+{
+  int dr = 0, dc = 0;
+  switch (ref->dir) {
+    case NORTH:
+      dr = -1;
+      break;
+    case SOUTH:
+      dr = 1;
+      break;
+    case EAST:
+      dc = 1;
+      break;
+    case WEST:
+      dc = -1;
+      break;
+  }
+
+  ref->played += ref->speed;
+  if (ref->poisoned && ref->played - ref->poisoned_at >= POISON_DURATION * 1000000ull) {
+    ref->poisoned = false;
+    ref->speed = ref->saved_speed;
+    ref->saved_speed = 0;
+  }
+
+  // the tail comes off first, so the snek can follow it around
+  struct pt *t = ref->tail;
+  ref->tail = t->next;
+  ref->tail->prev = NULL;
+  free(t);
+
+  uint32_t row = ref->head->row + dr, col = ref->head->col + dc;
+  if (ref->wrap) {
+    row = row == 0 ? ref->rows - 2 : row == ref->rows - 1 ? 1 : row;
+    col = col == 0 ? ref->cols - 2 : col == ref->cols - 1 ? 1 : col;
+  }
+  if (!ref_interior(ref, row, col))
+    return true;
+
+  // checked before the head goes on, so the head doesn't find itself
+  bool hit_self = ref_on_snek(ref, row, col);
+  ref_push_head(ref, row, col);
+
+  size_t i = row * ref->cols + col;
+  if (ref->items[i] == SNEK_SNACK) {
+    ref->score += 10;
+    if (ref->speed > MIN_SPEED)
+      ref->speed -= 1000;
+    ref->items[i] = EMPTY;
+
+    // grow the snek by three segments
+    for (int j = 0; j < 3; j++) {
+      struct pt *seg = ref_segment(ref->tail->row, ref->tail->col);
+      seg->next = ref->tail;
+      ref->tail->prev = seg;
+      ref->tail = seg;
+    }
+  }
+  else if (ref->items[i] == MUSHROOM) {
+    ref->score += 75;
+    if (ref->saved_speed == 0)
+      ref->saved_speed = ref->speed;
+    ref->speed /= 2;
+    ref->items[i] = EMPTY;
+    ref->poisoned = true;
+    ref->poisoned_at = ref->played;
+  }
+  else if (ref->items[i] == WALL) {
+    return true;
+  }
+
+  if (hit_self)
+    return true;
+
+  if (ref->score >= 500 && ref->score - ref->last_wall_attempt >= 100) {
+    ref_place_obstacle(ref, 3);
+    ref->last_wall_attempt = ref->score;
+  }
+
+  return false;
+}
+
+static uint64_t mix(uint64_t h, uint64_t v)
+{
+  h ^= v;
+
+  return splitmix64(&h);
+}
+
+// Growing the snek piles segments up on the tail in the reference, where
+// the real game keeps a count of how much it has left to grow. Either way
+// the cells it covers are the same, so the hash goes over those, head to
+// tail with repeats skipped, and then how long it'll be when it's done.
+static uint64_t ref_hash(struct ref_game *ref, bool over)
+{
+  uint64_t h = mix(ref->score, (uint64_t) ref->speed << 32 | ref->saved_speed);
+  h = mix(h, ref->rng);
+  h = mix(h, (uint64_t) ref->poisoned << 8 | (uint64_t) over << 4 | ref->dir);
+
+  uint32_t total = 0;
+  for (struct pt *seg = ref->head; seg; seg = seg->prev) {
+    total++;
+    if (seg == ref->head || seg->row != seg->next->row || seg->col != seg->next->col)
+      h = mix(h, (uint64_t) seg->row << 32 | seg->col);
+  }
+  h = mix(h, total);
+
+  for (uint32_t r = 1; r < ref->rows - 1; r++) {
+    for (uint32_t c = 1; c < ref->cols - 1; c++) {
+      int item = ref->items[r * ref->cols + c];
+      if (item != EMPTY)
+        h = mix(h, ((uint64_t) r << 32 | c) << 3 | item);
+    }
+  }
+
+  return h;
+}
+
+static uint64_t game_hash(struct game_state *gs, struct snek *snek, bool over)
+{
+  uint64_t h = mix(gs->score, (uint64_t) gs->speed << 32 | gs->saved_speed);
+  h = mix(h, gs->rng);
+  h = mix(h, (uint64_t) gs->poisoned << 8 | (uint64_t) over << 4 | snek->dir);
+
+  for (uint32_t k = 0; k < snek->len; k++) {
+    uint32_t i = snek_cell(snek, k);
+    if (k == 0 || i != snek_cell(snek, k - 1))
+      h = mix(h, (uint64_t) (i / gs->stride) << 32 | i % gs->stride);
+  }
+  h = mix(h, snek->len + snek->grow);
+
+  for (uint32_t r = 1; r < gs->rows - 1; r++) {
+    for (uint32_t c = 1; c < gs->cols - 1; c++) {
+      int item = item_at(gs, r * gs->stride + c);
+      if (item != EMPTY)
+        h = mix(h, ((uint64_t) r << 32 | c) << 3 | item);
+    }
+  }
+
+  return h;
+}
+
+// How many cells can be got to from cell start, counting it, through the
+// ones that aren't blocked, stopping once there's want of them
+static uint32_t ref_room(struct ref_game *ref, const bool *blocked, uint32_t start, uint32_t want)
+{
+  size_t size = (size_t) ref->rows * ref->cols;
+  bool *seen = calloc(size, sizeof(bool));
+  uint32_t *queue = malloc(size * sizeof(uint32_t));
+  if (!seen || !queue)
+    die("calloc");
+
+  size_t head = 0, tail = 0;
+  seen[start] = true;
+  queue[tail++] = start;
+  while (head < tail && tail < want) {
+    uint32_t r = queue[head] / ref->cols, c = queue[head] % ref->cols;
+    head++;
+
+    int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+    for (int d = 0; d < 4; d++) {
+      uint32_t nr = r + dr[d], nc = c + dc[d];
+      if (ref->wrap) {
+        nr = nr == 0 ? ref->rows - 2 : nr == ref->rows - 1 ? 1 : nr;
+        nc = nc == 0 ? ref->cols - 2 : nc == ref->cols - 1 ? 1 : nc;
+      }
+      uint32_t i = nr * ref->cols + nc;
+      if (ref_interior(ref, nr, nc) && !blocked[i] && !seen[i]) {
+        seen[i] = true;
+        queue[tail++] = i;
+      }
+    }
+  }
+
+  free(seen);
+  free(queue);
+
+  return tail;
+}
+
+// Make up a key for the next tick from the reference game: usually head
+// for the nearest snack without running into anything or into a pocket
+// too small for the snek, now and then just carry on, and once in a while
+// turn at random whatever's there.
+static uint8_t make_key(struct ref_game *ref, uint64_t *rng)
+{
+  uint64_t r = splitmix64(rng);
+  if (r % 1024 == 1)
+    return (r >> 8) % 4;
+
+  bool *blocked = malloc((size_t) ref->rows * ref->cols * sizeof(bool));
+  if (!blocked)
+    die("malloc");
+
+  uint32_t best_r = 0, best_c = 0, best = UINT32_MAX;
+  for (uint32_t row = 0; row < ref->rows; row++) {
+    for (uint32_t col = 0; col < ref->cols; col++) {
+      int item = ref->items[row * ref->cols + col];
+      blocked[row * ref->cols + col] = item == WALL;
+      if (item != SNEK_SNACK)
+        continue;
+      uint32_t d = abs((int) row - (int) ref->head->row) + abs((int) col - (int) ref->head->col);
+      if (d < best) {
+        best = d;
+        best_r = row;
+        best_c = col;
+      }
+    }
+  }
+
+  uint32_t len = 0;
+  for (struct pt *seg = ref->head; seg; seg = seg->prev, len++)
+    blocked[seg->row * ref->cols + seg->col] = true;
+
+  int dr[] = { -1, 1, 0, 0 }, dc[] = { 0, 0, 1, -1 };
+  uint8_t key = NO_TURN;
+  uint32_t key_dist = UINT32_MAX;
+  for (uint8_t d = 0; d < 4; d++) {
+    uint32_t row = ref->head->row + dr[d], col = ref->head->col + dc[d];
+    if (ref->wrap) {
+      row = row == 0 ? ref->rows - 2 : row == ref->rows - 1 ? 1 : row;
+      col = col == 0 ? ref->cols - 2 : col == ref->cols - 1 ? 1 : col;
+    }
+    if (!ref_interior(ref, row, col) || blocked[row * ref->cols + col])
+      continue;
+
+    // carrying on needs no key, and a quarter of the time it'll do
+    if (d == ref->dir && r % 4 == 0) {
+      key = d;
+      break;
+    }
+
+    uint32_t dist = abs((int) row - (int) best_r) + abs((int) col - (int) best_c);
+    if (ref_room(ref, blocked, row * ref->cols + col, len) < len)
+      dist += ref->rows * ref->cols;
+    if (dist < key_dist) {
+      key = d;
+      key_dist = dist;
+    }
+  }
+
+  free(blocked);
+
+  return key == ref->dir ? NO_TURN : key;
+}
+
+// Play a game both ways in lockstep. If make_keys is set, the keys are
+// made up as we go and written into dc, otherwise dc's are played (and
+// after they run out, no more turns). Returns the first tick the two
+// disagree after, or -1 if they never do.
+static int play_case(struct diff_case *dc, bool make_keys, struct arena *arena, uint64_t key_seed)
+{
+  arena_reset(arena);
+  struct game_state gs = { .arena = arena, .wrap = dc->wrap, .speed = 100000, .rng = dc->seed };
+  board_init(&gs, dc->rows, dc->cols);
+  struct snek *snek = snek_init(&gs);
+  add_snacks(&gs, snek, 20);
+  generate_obstacles(&gs, snek);
+
+  struct ref_game ref;
+  ref_init(&ref, dc);
+
+  int diverged = -1;
+  if (game_hash(&gs, snek, false) != ref_hash(&ref, false))
+    diverged = 0;
+
+  uint32_t ticks = make_keys ? REF_TICKS : dc->len;
+  for (uint32_t t = 0; t < ticks && diverged < 0; t++) {
+    if (make_keys)
+      dc->keys[dc->len++] = make_key(&ref, &key_seed);
+    if (dc->keys[t] < 4)
+      snek->dir = ref.dir = dc->keys[t];
+
+    bool over = gs.step(snek, &gs);
+    bool ref_over = ref_update(&ref);
+    if (!over && (t + 1) % 100 == 0) {
+      add_snacks(&gs, snek, 5);
+      ref_add_items(&ref, SNEK_SNACK, 5);
+    }
+    if (!over && gs.score > 200 && (t + 1) % 150 == 0) {
+      add_mushrooms(&gs, snek, 2);
+      ref_add_items(&ref, MUSHROOM, 2);
+    }
+
+    if (game_hash(&gs, snek, over) != ref_hash(&ref, ref_over))
+      diverged = t + 1;
+    if (over || ref_over)
+      break;
+  }
+
+  ref_free(&ref);
+
+  return diverged;
+}
+
+// Cut a failing game's keys back as far as they'll go: nothing after the
+// tick it went wrong on, then every turn that can be dropped without it
+// coming right
+static void minimise(struct diff_case *dc, struct arena *arena)
+{
+  int tick = play_case(dc, false, arena, 0);
+  if (tick >= 0)
+    dc->len = tick;
+
+  for (uint32_t j = dc->len; j-- > 0; ) {
+    if (dc->keys[j] == NO_TURN)
+      continue;
+
+    uint8_t key = dc->keys[j];
+    dc->keys[j] = NO_TURN;
+    if (play_case(dc, false, arena, 0) < 0)
+      dc->keys[j] = key;
+  }
+
+  // dropping turns can make it go wrong sooner
+  tick = play_case(dc, false, arena, 0);
+  if (tick >= 0)
+    dc->len = tick;
+}
+
+struct diff_test {
+  uint32_t games;
+  uint64_t seed;
+  atomic_uint next;
+  atomic_ulong ticks;
+
+  // the lowest numbered game that failed, so the same one gets reported
+  // however many threads there are
+  pthread_mutex_t lock;
+  uint32_t failed;
+  struct diff_case failure;
+};
+
+static void diff_case_for(struct diff_case *dc, uint64_t seed, uint32_t g)
+{
+  // mostly the sizes with a step function of their own, and some without
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 40, 120 }, { 33, 107 } };
+  *dc = (struct diff_case) { .rows = sizes[g % 3][0], .cols = sizes[g % 3][1],
+                               .wrap = g / 3 % 2, .seed = seed + g };
+}
+
+static void *diff_work(void *arg)
+{
+  struct diff_test *test = arg;
+  struct arena arena;
+  arena_init(&arena, game_arena_size(40, 128));
+  struct diff_case *dc = malloc(sizeof(struct diff_case));
+  if (!dc)
+    die("malloc");
+
+  uint32_t g;
+  while ((g = atomic_fetch_add(&test->next, 1)) < test->games) {
+    diff_case_for(dc, test->seed, g);
+    int tick = play_case(dc, true, &arena, test->seed ^ ((uint64_t) g << 32));
+    atomic_fetch_add(&test->ticks, dc->len);
+    if (tick < 0)
+      continue;
+
+    pthread_mutex_lock(&test->lock);
+    if (g < test->failed) {
+      test->failed = g;
+      test->failure = *dc;
+    }
+    pthread_mutex_unlock(&test->lock);
+  }
+
+  free(dc);
+  arena_destroy(&arena);
+
+  return NULL;
+}
+
+// Play games both ways on threads and report the first one that goes
+// wrong, cut down as far as it'll go
+int diff_test(uint32_t games, uint64_t seed, uint32_t threads)
+{
+  struct diff_test *test = calloc(1, sizeof(struct diff_test));
+  if (!test)
+    die("calloc");
+  test->games = games;
+  test->seed = seed;
+  test->failed = UINT32_MAX;
+  pthread_mutex_init(&test->lock, NULL);
+
+  if (threads == 0)
+    threads = 1;
+  double start = now_secs();
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  if (!ids)
+    die("malloc");
+  for (uint32_t k = 0; k < threads; k++) {
+    if (pthread_create(&ids[k], NULL, diff_work, test) != 0)
+      die("pthread_create");
+  }
+  for (uint32_t k = 0; k < threads; k++)
+    pthread_join(ids[k], NULL);
+  free(ids);
+  double elapsed = now_secs() - start;
+
+  printf("%u games, %lu ticks in %.1fs (%.0f ticks/s)\n", games,
+          (unsigned long) test->ticks, elapsed, test->ticks / elapsed);
+
+  int status = 0;
+  if (test->failed != UINT32_MAX) {
+    struct diff_case *dc = &test->failure;
+    struct arena arena;
+    arena_init(&arena, game_arena_size(dc->rows, dc->cols));
+    minimise(dc, &arena);
+    int tick = play_case(dc, false, &arena, 0);
+    arena_destroy(&arena);
+
+    printf("game %u disagrees with the reference after tick %d\n", test->failed, tick);
+    printf("  %ux%u%s, seed %llu, keys: ", dc->rows, dc->cols, dc->wrap ? " wrapped" : "",
+            (unsigned long long) dc->seed);
+    for (uint32_t j = 0; j < dc->len; j++)
+      putchar("NSEW."[dc->keys[j]]);
+    putchar('\n');
+    status = 1;
+  }
+  else {
+    printf("no differences from the reference\n");
+  }
+
+  pthread_mutex_destroy(&test->lock);
+  free(test);
+
+  return status;
+}
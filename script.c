@@ -0,0 +1,193 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Playing from a script instead of a terminal, so the whole game can be run
+// from a pipe or a file (for timing it end to end, say) and comes out the
+// same every time.
+//
+// A script is lines of a time in milliseconds from the start and the keys
+// to press then, like
+//
+//     0 space
+//     850 up
+//     1200 left left
+//     # comments and blank lines are fine
+//
+// where a key is up, down, left or right (sent as the arrow key escape
+// sequences), space, esc, or anything else to be typed as it is. Once the
+// script runs out it keeps pressing q, which ends the game at the next
+// chance it gets. The script can come from anywhere that can be opened,
+// so - for stdin or /dev/fd/N for an fd that's already open.
+//
+// Normally the keys come at those times by the clock. With --no-delay the
+// game doesn't sleep between ticks at all and keeps its own clock instead,
+// moving it on by however long it would have slept, so a run takes only as
+// long as the work in it and the keys land on the same ticks every time.
+// (Everything in the game itself that goes by time, like poison wearing off
+// and snacks being topped up, goes by the game's own time anyway.)
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snek.h"
+
+struct script_key {
+  uint64_t usecs;
+  char bytes[KEY_SEQ_MAX];
+  size_t len;
+};
+
+static struct script {
+  bool on;
+  bool no_delay;
+  struct script_key *keys;
+  size_t count;
+  size_t next;
+  double start;
+  uint64_t usecs;
+} script;
+
+static bool script_add(const char *name, uint64_t usecs)
+{
+  static const struct { const char *name; const char *bytes; } names[] = {
+    { "up", "\x1b[A" }, { "down", "\x1b[B" }, { "right", "\x1b[C" }, { "left", "\x1b[D" },
+    { "space", " " }, { "esc", "\x1b" }
+  };
+
+  struct script_key key = { .usecs = usecs };
+  const char *bytes = name;
+  for (size_t j = 0; j < sizeof(names) / sizeof(names[0]); j++) {
+    if (strcmp(name, names[j].name) == 0)
+      bytes = names[j].bytes;
+  }
+
+  key.len = strlen(bytes);
+  if (key.len > KEY_SEQ_MAX)
+    return false;
+  memcpy(key.bytes, bytes, key.len);
+
+  if ((script.count & (script.count - 1)) == 0) {
+    size_t room = script.count ? script.count * 2 : 64;
+    struct script_key *keys = realloc(script.keys, room * sizeof(struct script_key));
+    if (!keys)
+      die("realloc");
+    script.keys = keys;
+  }
+  script.keys[script.count++] = key;
+
+  return true;
+}
+
+static void script_report(void)
+{
+  double elapsed = now_secs() - script.start;
+  size_t frames = frames_drawn(), bytes = term_bytes();
+
+  fprintf(stderr, "%zu frames, %zu bytes (%.0f a frame) in %.2fs, %.0f frames/s\n",
+          frames, bytes, frames ? (double) bytes / frames : 0.0, elapsed,
+          elapsed > 0 ? frames / elapsed : 0.0);
+}
+
+// Read the script in path and play from it from now on. Returns false (with
+// errno set, if it was the file's fault) if it couldn't be read.
+bool script_open(const char *path, bool no_delay)
+{
+  FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!fp)
+    return false;
+
+  char line[256];
+  unsigned lineno = 0;
+  uint64_t last = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    lineno++;
+
+    char *save, *tok = strtok_r(line, " \t\r\n", &save);
+    if (!tok || tok[0] == '#')
+      continue;
+
+    char *end;
+    uint64_t ms = strtoull(tok, &end, 10);
+    if (*end != '\0' || ms < last) {
+      fprintf(stderr, "%s:%u: expected a time no earlier than the one before\n", path, lineno);
+      ok = false;
+      break;
+    }
+    last = ms;
+
+    while (ok && (tok = strtok_r(NULL, " \t\r\n", &save))) {
+      if (!script_add(tok, ms * 1000)) {
+        fprintf(stderr, "%s:%u: %s is too long for a key\n", path, lineno, tok);
+        ok = false;
+      }
+    }
+  }
+
+  if (fp != stdin)
+    fclose(fp);
+  if (!ok) {
+    errno = 0;
+    return false;
+  }
+
+  script.on = true;
+  script.no_delay = no_delay;
+  script.start = now_secs();
+  atexit(script_report);
+
+  return true;
+}
+
+bool scripted(void)
+{
+  return script.on;
+}
+
+// How long since the script started, in usecs
+static uint64_t script_clock(void)
+{
+  return script.no_delay ? script.usecs : (uint64_t) ((now_secs() - script.start) * 1e6);
+}
+
+// Put the bytes of any keys that are due into buf (which has room for room
+// bytes), and return how many there were
+size_t script_keys(char *buf, size_t room)
+{
+  size_t len = 0;
+  uint64_t now = script_clock();
+
+  while (script.next < script.count && script.keys[script.next].usecs <= now
+           && len + script.keys[script.next].len <= room) {
+    memcpy(&buf[len], script.keys[script.next].bytes, script.keys[script.next].len);
+    len += script.keys[script.next].len;
+    script.next++;
+  }
+
+  if (script.next == script.count && len < room && room > 0)
+    buf[len++] = 'q';
+
+  return len;
+}
+
+// Wait between ticks (or just pretend to)
+void game_sleep(useconds_t usecs)
+{
+  if (script.on && script.no_delay)
+    script.usecs += usecs;
+  else
+    usleep(usecs);
+}
@@ -9,139 +9,755 @@
 // with this software. If not, 
 // see <http://creativecommons.org/publicdomain/zero/1.0/>.
 
+// for usleep() and clock_gettime() when building in strict C mode on glibc
+#define _DEFAULT_SOURCE
+
 #include <ctype.h>
 #include <errno.h>
-#include <stdbool.h>
-#include <stdint.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
-#include <time.h>
-#include <unistd.h>
 
-#define INIT_SKEN_LEN 8
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define EMPTY 0
-#define SNEK_HEAD 1
-#define SNEK_BODY 2
-#define MUSHROOM 3
-#define SNEK_SNACK 4
-#define WALL 5
+#include "snek.h"
 
-#define NORTH 0
-#define SOUTH 1
-#define EAST 2
-#define WEST 3
+char mushroom[] = { 0xe2, 0x99, 0xa3 };
 
-#define LEFT 0
-#define RIGHT 1
+// prototypes
+void clear_screen(void);
+void exit_raw_mode(void);
+void hide_cursor(void);
 
-#define MIN_WIN_HEIGHT 30
-#define MIN_WIN_WIDTH 100
+void arena_init(struct arena *arena, size_t size)
+{
+  arena->base = malloc(size);
+  if (!arena->base)
+    die("malloc");
+  arena->size = size;
+  arena->used = 0;
+}
 
-#define GREEN 28
-#define PURPLE 99
-#define BLUE 33
-#define WHITE 15
+void *arena_alloc(struct arena *arena, size_t size)
+{
+  // keep everything 16-byte aligned so any struct can live in the arena
+  size = (size + 15) & ~(size_t) 15;
+  if (arena->used + size > arena->size) {
+    errno = ENOMEM;
+    die("arena_alloc");
+  }
 
-#define ACCELERATION 500
+  void *p = &arena->base[arena->used];
+  arena->used += size;
+  memset(p, 0, size);
 
-#define POISON_DURATION 5
+  return p;
+}
 
-char mushroom[] = { 0xe2, 0x99, 0xa3 };
+void arena_reset(struct arena *arena)
+{
+  arena->used = 0;
+}
 
-// data structures for storing the snek and game state
+void arena_destroy(struct arena *arena)
+{
+  free(arena->base);
+  arena->base = NULL;
+  arena->size = arena->used = 0;
+}
 
-struct message {
-  uint32_t row;
-  char *msg;
-  int colour;
-};
+// Enough room for the snek struct and its ring, the bitplanes and buckets,
+// and the screen buffers, plus a little slack for things like the game over
+// messages and alignment.
+size_t game_arena_size(uint32_t rows, uint32_t cols)
+{
+  size_t stride = 1;
+  while (stride < cols)
+    stride *= 2;
+  size_t cells = rows * stride;
+  size_t words = (cells + 63) / 64;
+
+  return sizeof(struct snek) + 2 * (cells + INIT_SKEN_LEN + 1) * sizeof(uint32_t)
+            + 8 * words * sizeof(uint64_t)
+            + 2 * (rows / BUCKET_SIZE + 1) * (cols / BUCKET_SIZE + 1)
+            + cells * (1 + 16) + 4096;
+}
 
-struct game_state {
-  uint32_t score;
-  uint32_t acceleration;
-  int *items;
-  useconds_t speed;
-  useconds_t saved_speed;
-  bool paused;
-  time_t snacks_refreshed;
-  time_t mushrooms_refreshed;
-  bool poisoned;
-  time_t poisoned_time;
-  uint32_t last_wall_attempt;
-};
+size_t plane_count(const uint64_t *plane, size_t words)
+{
+  size_t count = 0;
+  for (size_t j = 0; j < words; j++)
+    count += __builtin_popcountll(plane[j]);
+
+  return count;
+}
+
+// The index of the nth (counting from 0) set bit in the plane, or
+// words * 64 if there aren't that many
+size_t plane_select(const uint64_t *plane, size_t words, size_t n)
+{
+  for (size_t j = 0; j < words; j++) {
+    size_t c = __builtin_popcountll(plane[j]);
+    if (n < c) {
+      uint64_t w = plane[j];
+      while (n--)
+        w &= w - 1;
+
+      return j * 64 + __builtin_ctzll(w);
+    }
+    n -= c;
+  }
+
+  return words * 64;
+}
+
+// Cells an item can be dropped on: inside the border and not already
+// occupied by the snek, a wall or another item.
+void spawn_mask(struct game_state *gs, uint64_t *mask)
+{
+  for (size_t j = 0; j < gs->words; j++)
+    mask[j] = gs->interior[j]
+                & ~(gs->walls[j] | gs->body[j] | gs->snacks[j] | gs->mushrooms[j]);
+}
+
+// Spread reach across the edges of a wrap-around board. Returns true if
+// that reached anything new.
+bool flood_wrap(struct game_state *gs, const uint64_t *open, uint64_t *reach)
+{
+  bool changed = false;
+
+  for (size_t r = 1; r < gs->rows - 1; r++) {
+    size_t west = r * gs->stride + 1, east = r * gs->stride + gs->cols - 2;
+    if (plane_test(reach, west) != plane_test(reach, east)
+          && plane_test(open, west) && plane_test(open, east)) {
+      plane_set(reach, west);
+      plane_set(reach, east);
+      changed = true;
+    }
+  }
+
+  for (size_t c = 1; c < gs->cols - 1; c++) {
+    size_t north = gs->stride + c, south = (gs->rows - 2) * gs->stride + c;
+    if (plane_test(reach, north) != plane_test(reach, south)
+          && plane_test(open, north) && plane_test(open, south)) {
+      plane_set(reach, north);
+      plane_set(reach, south);
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+// Spread the bits of w along the runs of set bits in open, in both
+// directions, in six doubling steps instead of up to 63 single ones
+static inline uint64_t fill_word(uint64_t w, uint64_t open)
+{
+  uint64_t up = w, down = w, p = open, q = open;
+  for (int n = 1; n < 64; n *= 2) {
+    up |= p & (up << n);
+    p &= p << n;
+    down |= q & (down >> n);
+    q &= q >> n;
+  }
+
+  return up | down;
+}
+
+// Fill reach with every cell that can be got to from cell start through the
+// cells set in open, and return how many there are. Rather than a BFS over
+// cells, each pass spreads the whole reachable set one step in all four
+// directions at once with word-wide shifts (and all the way along the open
+// stretches of each word), and we sweep forwards and backwards in place so
+// a pass usually covers many steps. The loops are
+// plain enough that the compiler vectorises them (AVX2 included, when it's
+// enabled). With a power-of-two stride the vertical shifts are whole words,
+// which is cheaper still. On a wrap-around board, the cells along each edge
+// are also joined to the ones on the opposite edge.
+size_t flood_plane(struct game_state *gs, const uint64_t *open, size_t start, uint64_t *reach)
+{
+  size_t words = gs->words;
+  memset(reach, 0, words * sizeof(uint64_t));
+  plane_set(reach, start);
+
+  bool changed = true;
+  bool forwards = true;
+  while (changed) {
+    changed = false;
+    for (size_t k = 0; k < words; k++) {
+      size_t j = forwards ? k : words - 1 - k;
+      uint64_t w = reach[j]
+                    | plane_shl_word(reach, j, 1)
+                    | plane_shr_word(reach, words, j, 1)
+                    | plane_shl_word(reach, j, gs->stride)
+                    | plane_shr_word(reach, words, j, gs->stride);
+      w = reach[j] | (w & open[j]);
+      w = fill_word(w, open[j]);
+      if (w != reach[j]) {
+        reach[j] = w;
+        changed = true;
+      }
+    }
+    forwards = !forwards;
+
+    if (gs->wrap)
+      changed |= flood_wrap(gs, open, reach);
+  }
+
+  return plane_count(reach, words);
+}
+
+// Every cell the snek could get to from cell start without crossing a wall,
+// its own body or the border
+size_t flood_fill(struct game_state *gs, size_t start, uint64_t *reach)
+{
+  uint64_t *open = gs->scratch;
+  for (size_t j = 0; j < gs->words; j++)
+    open[j] = gs->interior[j] & ~(gs->walls[j] | gs->body[j]);
+
+  return flood_plane(gs, open, start, reach);
+}
+
+// Each game has its own random number generator, so games (and copies of
+// them being played out by bots on other threads) don't disturb each other
+// and a game can be replayed from its seed.
+uint32_t game_rand(struct game_state *gs)
+{
+  return splitmix64(&gs->rng) >> 32;
+}
+
+uint64_t *item_plane(struct game_state *gs, int item)
+{
+  switch (item) {
+    case WALL:
+      return gs->walls;
+    case SNEK_SNACK:
+      return gs->snacks;
+    case MUSHROOM:
+      return gs->mushrooms;
+    default:
+      return NULL;
+  }
+}
+
+int item_at(struct game_state *gs, size_t i)
+{
+  if (plane_test(gs->walls, i))
+    return WALL;
+  if (plane_test(gs->snacks, i))
+    return SNEK_SNACK;
+  if (plane_test(gs->mushrooms, i))
+    return MUSHROOM;
+
+  return EMPTY;
+}
+
+// All changes to the items on the board go through here so the bucket
+// counts and the distance field (if there is one) stay in sync
+void set_item(struct game_state *gs, size_t i, int item)
+{
+  int old = item_at(gs, i);
+  uint64_t *plane = item_plane(gs, old);
+  if (plane)
+    plane_clear(plane, i);
+  uint8_t *buckets = item_buckets(gs, old);
+  if (buckets)
+    buckets[bucket_of(gs, i)]--;
+  if (old != EMPTY)
+    gs->hash ^= zobrist(old, i);
+
+  plane = item_plane(gs, item);
+  if (plane)
+    plane_set(plane, i);
+  buckets = item_buckets(gs, item);
+  if (buckets)
+    buckets[bucket_of(gs, i)]++;
+  if (item != EMPTY)
+    gs->hash ^= zobrist(item, i);
+
+  if (gs->field) {
+    if (old == SNEK_SNACK && item != SNEK_SNACK)
+      field_remove_source(gs->field, i);
+    if (item == SNEK_SNACK)
+      field_add_source(gs->field, i);
+    else if (item == WALL)
+      field_block(gs->field, i);
+  }
+}
+
+// The step function does everything that happens to the snek in one tick:
+// move it, eat whatever it lands on, grow it, and decide whether the game is
+// over. It's written once, as step_core(), and stamped out for the board
+// sizes we expect to see most. Since the size is a compile-time constant in
+// those copies, row * stride + col becomes a shift and an or, and the
+// bounds check is a couple of compares against constants. Every other size
+// gets step_generic(), which reads the same things out of the game state.
+//
+// Each size also gets a wrap-around version, where leaving the board puts
+// the snek back on the opposite edge. Since wrap is a constant too, the
+// bounded versions don't pay anything for it.
+//
+// And each gets a make version for searching bots, which takes a struct undo
+// to note down what it changed so unmake_move() can put it all back. That's
+// far cheaper than copying the game to try a move out. The make versions
+// leave out the random obstacles, which a search has no business predicting.
+// With undo a constant NULL in the ordinary versions, all of the noting down
+// compiles away there.
+
+void try_to_add_barrier(struct snek *, struct game_state *);
+
+static inline __attribute__((always_inline))
+bool step_core(struct snek *snek, struct game_state *gs, uint32_t rows, uint32_t cols, uint32_t stride, bool wrap,
+                  struct undo *undo)
+{
+  if (undo) {
+    undo->hash = gs->hash;
+    undo->score = gs->score;
+    undo->speed = gs->speed;
+    undo->saved_speed = gs->saved_speed;
+    undo->played = gs->played;
+    undo->poisoned = gs->poisoned;
+    undo->poisoned_at = gs->poisoned_at;
+    undo->grow = snek->grow;
+    undo->tail = tail_cell(snek);
+    undo->moved_tail = snek->grow == 0;
+    undo->vacated = false;
+    undo->moved_head = false;
+    undo->took_cell = false;
+    undo->item = EMPTY;
+  }
+
+  int dr = 0, dc = 0;
+  switch (snek->dir) {
+    case NORTH:
+      dr = -1;
+      break;
+    case SOUTH:
+      dr = 1;
+      break;
+    case EAST:
+      dc = 1;
+      break;
+    case WEST:
+      dc = -1;
+      break;
+  }
+
+  gs->played += gs->speed;
+  if (gs->poisoned && gs->played - gs->poisoned_at >= POISON_DURATION * 1000000ull) {
+    gs->poisoned = false;
+    gs->speed = gs->saved_speed;
+    gs->saved_speed = 0;
+  }
+
+  // The tail moves up behind the head, unless the snek is still growing,
+  // in which case it stays put for this tick.
+  uint32_t tail = tail_cell(snek);
+  gs->hash ^= zobrist(SNEK_HEAD, head_cell(snek)) ^ zobrist(ZOBRIST_TAIL, tail);
+  if (snek->grow > 0) {
+    snek->grow--;
+  }
+  else {
+    snek->len--;
+
+    // Segments piled up on a level's starting cell all share it, so the
+    // cell is only vacated once the last one of them has moved on
+    if (tail_cell(snek) != tail) {
+      plane_clear(gs->body, tail);
+      gs->hash ^= zobrist(SNEK_BODY, tail);
+      if (gs->field)
+        field_unblock(gs->field, tail);
+      if (undo)
+        undo->vacated = true;
+    }
+  }
+
+  uint32_t row = head_cell(snek) / stride + dr;
+  uint32_t col = head_cell(snek) % stride + dc;
+  if (wrap) {
+    // The playable area is rows 1 to rows - 2 and the same for columns, so
+    // landing on the border means we're due on the far side. Done with
+    // arithmetic on the comparisons so there's nothing to mispredict.
+    row += (row == 0) * (rows - 2);
+    row -= (row == rows - 1) * (rows - 2);
+    col += (col == 0) * (cols - 2);
+    col -= (col == cols - 1) * (cols - 2);
+  }
+
+  // Running into the border ends the game. Row and column are unsigned, so
+  // wandering off the top or left edge wraps around to a huge number and
+  // this catches all four edges with two compares.
+  if (!wrap && (row - 1 >= rows - 2 || col - 1 >= cols - 2))
+    return true;
+
+  uint32_t i = row * stride + col;
+  snek->head = (snek->head + 1) & snek->mask;
+  snek->cells[snek->head] = i;
+  snek->len++;
+  gs->hash ^= zobrist(SNEK_HEAD, i) ^ zobrist(ZOBRIST_TAIL, tail_cell(snek));
+  if (undo) {
+    undo->moved_head = true;
+    undo->item = item_at(gs, i);
+  }
 
-struct pt {
-  uint32_t row;
-  uint32_t col;
-  struct pt *next;
-  struct pt *prev;
+  if (plane_test(gs->snacks, i)) {
+    gs->score += 10;
+    if (gs->speed > MIN_SPEED)
+      gs->speed -= 1000;
+    set_item(gs, i, EMPTY);
+    snek->grow += 3;
+  }
+  else if (plane_test(gs->mushrooms, i)) {
+    gs->score += 75;
+    if (gs->saved_speed == 0) {
+      gs->saved_speed = gs->speed;
+    }
+    gs->speed /= 2;
+    set_item(gs, i, EMPTY);
+    gs->poisoned = true;
+    gs->poisoned_at = gs->played;
+  }
+  else if (plane_test(gs->walls, i)) {
+    return true;
+  }
+
+  // check if the snek has hit any part of its body
+  if (plane_test(gs->body, i))
+    return true;
+  plane_set(gs->body, i);
+  gs->hash ^= zobrist(SNEK_BODY, i);
+  if (gs->field)
+    field_block(gs->field, i);
+  if (undo)
+    undo->took_cell = true;
+
+  // should we try to add a barrier?
+  if (!undo && gs->score >= 500 && gs->score - gs->last_wall_attempt >= 100) {
+    try_to_add_barrier(snek, gs);
+    gs->last_wall_attempt = gs->score;
+  }
+
+  return false;
+}
+
+bool step_generic(struct snek *snek, struct game_state *gs)
+{
+  return step_core(snek, gs, gs->rows, gs->cols, gs->stride, false, NULL);
+}
+
+bool step_generic_wrap(struct snek *snek, struct game_state *gs)
+{
+  return step_core(snek, gs, gs->rows, gs->cols, gs->stride, true, NULL);
+}
+
+bool make_generic(struct snek *snek, struct game_state *gs, struct undo *undo)
+{
+  return step_core(snek, gs, gs->rows, gs->cols, gs->stride, false, undo);
+}
+
+bool make_generic_wrap(struct snek *snek, struct game_state *gs, struct undo *undo)
+{
+  return step_core(snek, gs, gs->rows, gs->cols, gs->stride, true, undo);
+}
+
+#define DEFINE_STEP(ROWS, COLS, SHIFT) \
+  bool step_##ROWS##x##COLS(struct snek *snek, struct game_state *gs) \
+  { \
+    return step_core(snek, gs, ROWS, COLS, 1 << SHIFT, false, NULL); \
+  } \
+  bool step_##ROWS##x##COLS##_wrap(struct snek *snek, struct game_state *gs) \
+  { \
+    return step_core(snek, gs, ROWS, COLS, 1 << SHIFT, true, NULL); \
+  } \
+  bool make_##ROWS##x##COLS(struct snek *snek, struct game_state *gs, struct undo *undo) \
+  { \
+    return step_core(snek, gs, ROWS, COLS, 1 << SHIFT, false, undo); \
+  } \
+  bool make_##ROWS##x##COLS##_wrap(struct snek *snek, struct game_state *gs, struct undo *undo) \
+  { \
+    return step_core(snek, gs, ROWS, COLS, 1 << SHIFT, true, undo); \
+  }
+
+DEFINE_STEP(30, 100, 7)
+DEFINE_STEP(40, 120, 7)
+DEFINE_STEP(50, 160, 8)
+DEFINE_STEP(60, 240, 8)
+DEFINE_STEP(1000, 1000, 10)
+
+struct step_spec {
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t shift;
+  bool (*step)(struct snek *, struct game_state *);
+  bool (*step_wrap)(struct snek *, struct game_state *);
+  bool (*make)(struct snek *, struct game_state *, struct undo *);
+  bool (*make_wrap)(struct snek *, struct game_state *, struct undo *);
 };
 
-struct snek {
-  struct pt *head;
-  struct pt *tail;
-  uint32_t dir;
+#define STEP_SPEC(ROWS, COLS, SHIFT) \
+  { ROWS, COLS, SHIFT, step_##ROWS##x##COLS, step_##ROWS##x##COLS##_wrap, \
+    make_##ROWS##x##COLS, make_##ROWS##x##COLS##_wrap }
+
+struct step_spec step_specs[] = {
+  STEP_SPEC(30, 100, 7),
+  STEP_SPEC(40, 120, 7),
+  STEP_SPEC(50, 160, 8),
+  STEP_SPEC(60, 240, 8),
+  STEP_SPEC(1000, 1000, 10),
 };
 
-// prototypes
-void clear_screen(void);
-void exit_raw_mode(void);
-void hide_cursor(void);
-char get_key(void);
-void render(struct snek *, struct game_state *, struct message *, size_t, uint32_t);
+struct step_spec *find_step_spec(uint32_t rows, uint32_t cols)
+{
+  for (size_t j = 0; j < sizeof(step_specs) / sizeof(step_specs[0]); j++) {
+    if (step_specs[j].rows == rows && step_specs[j].cols == cols)
+      return &step_specs[j];
+  }
+
+  return NULL;
+}
+
+// How many cells a row of a rows x cols board takes up in memory
+uint32_t board_stride(uint32_t rows, uint32_t cols)
+{
+  struct step_spec *spec = find_step_spec(rows, cols);
+
+  return spec ? (uint32_t) 1 << spec->shift : cols;
+}
 
-struct snek *snek_init(void)
+// Set up an empty rows x cols board, choosing the step function (and so the
+// stride) to suit its size and whether gs->wrap is set.
+void board_init(struct game_state *gs, uint32_t rows, uint32_t cols)
 {
-  struct snek *snek = malloc(sizeof(struct snek));
+  struct step_spec *spec = find_step_spec(rows, cols);
+
+  gs->rows = rows;
+  gs->cols = cols;
+  gs->stride = board_stride(rows, cols);
+  if (spec) {
+    gs->step = gs->wrap ? spec->step_wrap : spec->step;
+    gs->make = gs->wrap ? spec->make_wrap : spec->make;
+  }
+  else {
+    gs->step = gs->wrap ? step_generic_wrap : step_generic;
+    gs->make = gs->wrap ? make_generic_wrap : make_generic;
+  }
+
+  gs->cells = (size_t) rows * gs->stride;
+  gs->words = (gs->cells + 63) / 64;
+
+  gs->walls = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->body = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->snacks = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->mushrooms = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->interior = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->scratch = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+  gs->reach = arena_alloc(gs->arena, gs->words * sizeof(uint64_t));
+
+  gs->bucket_rows = (rows - 2 + BUCKET_SIZE - 1) / BUCKET_SIZE;
+  gs->bucket_cols = (cols - 2 + BUCKET_SIZE - 1) / BUCKET_SIZE;
+  gs->snack_buckets = arena_alloc(gs->arena, (size_t) gs->bucket_rows * gs->bucket_cols);
+  gs->mushroom_buckets = arena_alloc(gs->arena, (size_t) gs->bucket_rows * gs->bucket_cols);
+  gs->screen = NULL;
+  gs->frame = NULL;
+
+  for (size_t r = 1; r < rows - 1; r++) {
+    for (size_t c = 1; c < cols - 1; c++)
+      plane_set(gs->interior, r * gs->stride + c);
+  }
+}
+
+// Take back the move gs->make() made and noted down in undo. Moves have to
+// be taken back in the opposite order they were made in.
+void unmake_move(struct game_state *gs, struct snek *snek, const struct undo *undo)
+{
+  if (undo->moved_head) {
+    uint32_t i = head_cell(snek);
+    if (undo->took_cell) {
+      plane_clear(gs->body, i);
+      if (gs->field)
+        field_unblock(gs->field, i);
+    }
+    if (undo->item == SNEK_SNACK || undo->item == MUSHROOM)
+      set_item(gs, i, undo->item);
+
+    snek->head = (snek->head - 1) & snek->mask;
+    snek->len--;
+  }
+
+  if (undo->moved_tail) {
+    // the old tail's still in the ring just past the end of the snek
+    snek->len++;
+    if (undo->vacated) {
+      plane_set(gs->body, undo->tail);
+      if (gs->field)
+        field_block(gs->field, undo->tail);
+    }
+  }
+
+  snek->grow = undo->grow;
+  gs->hash = undo->hash;
+  gs->score = undo->score;
+  gs->speed = undo->speed;
+  gs->saved_speed = undo->saved_speed;
+  gs->played = undo->played;
+  gs->poisoned = undo->poisoned;
+  gs->poisoned_at = undo->poisoned_at;
+}
+
+struct snek *snek_init(struct game_state *gs)
+{
+  struct arena *arena = gs->arena;
+  struct snek *snek = arena_alloc(arena, sizeof(struct snek));
   snek->dir = EAST;
 
   // Create an initial snek that's roughly in the centre of the screen
   // and five segments long.
-  uint32_t init_row = MIN_WIN_HEIGHT / 2;
-  uint32_t init_col = MIN_WIN_WIDTH / 2 + 2;
-
-  snek->head = malloc(sizeof(struct pt));
-  snek->head->row = init_row;
-  snek->head->col = init_col;
-  snek->head->next = NULL;
+  uint32_t init_row = gs->rows / 2;
+  uint32_t init_col = gs->cols / 2 + 2;
+  int spacing = 1;
+
+  // Levels can say where the snek starts. Since there's no telling what's
+  // behind it there, it starts all coiled up on that one cell.
+  if (gs->start) {
+    init_row = gs->start / gs->stride;
+    init_col = gs->start % gs->stride;
+    snek->dir = gs->start_dir;
+    spacing = 0;
+  }
 
-  struct pt *p = snek->head;
-  for (int j = 0; j < INIT_SKEN_LEN; j++) {
-    struct pt *segment = malloc(sizeof(struct pt));
-    segment->row = init_row;
-    segment->col = p->col - 1;
-    p->prev = segment;
-    segment->next = p;
-    segment->prev = NULL;
-    p = segment;
+  // the ring needs a power of two size for the mask to work
+  uint32_t size = 1;
+  while (size < gs->cells + INIT_SKEN_LEN + 1)
+    size *= 2;
+  snek->cells = arena_alloc(arena, size * sizeof(uint32_t));
+  snek->mask = size - 1;
+
+  for (int j = INIT_SKEN_LEN; j >= 0; j--) {
+    snek->head = snek->len++;
+    snek->cells[snek->head] = init_row * gs->stride + init_col - j * spacing;
+    plane_set(gs->body, snek->cells[snek->head]);
   }
 
-  snek->tail = p;
+  gs->hash = board_hash(gs, snek);
 
   return snek;
 }
 
-void add_item(struct game_state *gs, struct snek *snek, int item)
+// Work out the hash of the board and snek from scratch. After this, the
+// step function and set_item() keep gs->hash up to date as things change.
+uint64_t board_hash(struct game_state *gs, const struct snek *snek)
 {
-  // we'll only try so many times to find a place for the time
-  for (int j = 0; j < 100; j++) {
-    int row = rand() % (MIN_WIN_HEIGHT - 2) + 1;
-    int col = rand() % (MIN_WIN_WIDTH - 2) + 1;
+  const uint64_t *planes[] = { gs->walls, gs->snacks, gs->mushrooms, gs->body };
+  int kinds[] = { WALL, SNEK_SNACK, MUSHROOM, SNEK_BODY };
+  uint64_t hash = zobrist(SNEK_HEAD, head_cell(snek)) ^ zobrist(ZOBRIST_TAIL, tail_cell(snek));
+
+  for (int p = 0; p < 4; p++) {
+    for (size_t j = 0; j < gs->words; j++) {
+      uint64_t w = planes[p][j];
+      while (w) {
+        hash ^= zobrist(kinds[p], j * 64 + __builtin_ctzll(w));
+        w &= w - 1;
+      }
+    }
+  }
 
-    if (row == snek->head->row && col == snek->head->col)
-      continue;
+  return hash;
+}
 
-    int i = row * MIN_WIN_WIDTH + col;
-    if (gs->items[i] != EMPTY)
-      continue;
+// The hash of the whole state a search cares about: the board, where the
+// snek is, which way it's heading and how much it still has to grow. The
+// order of the segments in between the head and tail isn't in it, so two
+// sneks covering the same cells in a different order can collide, but the
+// head and tail pin down most of that.
+uint64_t state_hash(const struct game_state *gs, const struct snek *snek)
+{
+  return gs->hash ^ zobrist(ZOBRIST_DIR, snek->dir) ^ zobrist(ZOBRIST_GROW, snek->grow);
+}
 
-    gs->items[i] = item;
+// A hash of the whole game after a tick (the board and snek, plus the
+// score, speed, poison, how long it's been played and where the random
+// numbers are up to) rolled together with the one from the tick before.
+// Two runs of a game that agree on every tick have the same hash, and once
+// they disagree about anything they stay different, so comparing the latest
+// hash is enough to tell if they've ever gone different ways, and comparing
+// a log of them says on which tick.
+uint64_t tick_hash(const struct game_state *gs, const struct snek *snek, uint64_t prev)
+{
+  uint64_t x = prev ^ state_hash(gs, snek);
+  x ^= (uint64_t) gs->score << 32 ^ gs->speed;
+  x ^= (uint64_t) snek->len << 40 ^ (uint64_t) gs->poisoned << 63;
+  x ^= gs->rng * 0x9e3779b97f4a7c15 ^ gs->played * 0xbf58476d1ce4e5b9;
+
+  return splitmix64(&x);
+}
+
+// Copy a game onto another board of the same size (set up with board_init()
+// and snek_init()), so it can be played on from there without touching the
+// original. That's the bitplanes, the bucket counts and the live part of the
+// snek's ring, which is a few KB for a normal sized board.
+void game_copy(struct game_state *dst, struct snek *dsnek, const struct game_state *src, const struct snek *ssnek)
+{
+  size_t plane_size = src->words * sizeof(uint64_t);
+  memcpy(dst->walls, src->walls, plane_size);
+  memcpy(dst->body, src->body, plane_size);
+  memcpy(dst->snacks, src->snacks, plane_size);
+  memcpy(dst->mushrooms, src->mushrooms, plane_size);
+
+  size_t buckets = (size_t) src->bucket_rows * src->bucket_cols;
+  memcpy(dst->snack_buckets, src->snack_buckets, buckets);
+  memcpy(dst->mushroom_buckets, src->mushroom_buckets, buckets);
+
+  // everything else that isn't a pointer to the board's own memory
+  struct game_state board = *dst;
+  *dst = *src;
+  dst->arena = board.arena;
+  dst->walls = board.walls;
+  dst->body = board.body;
+  dst->snacks = board.snacks;
+  dst->mushrooms = board.mushrooms;
+  dst->interior = board.interior;
+  dst->scratch = board.scratch;
+  dst->reach = board.reach;
+  dst->snack_buckets = board.snack_buckets;
+  dst->mushroom_buckets = board.mushroom_buckets;
+  dst->screen = board.screen;
+  dst->frame = board.frame;
+  dst->field = NULL;
+
+  snek_copy(dsnek, ssnek);
+}
+
+// Copy the live part of one snek's ring into another's, from the tail up
+void snek_copy(struct snek *dsnek, const struct snek *ssnek)
+{
+  for (uint32_t k = 0; k < ssnek->len; k++)
+    dsnek->cells[k] = snek_cell(ssnek, ssnek->len - 1 - k);
+  dsnek->head = ssnek->len - 1;
+  dsnek->len = ssnek->len;
+  dsnek->grow = ssnek->grow;
+  dsnek->dir = ssnek->dir;
+}
+
+void add_item(struct game_state *gs, struct snek *snek, int item)
+{
+  (void) snek;
+
+  // pick uniformly from the free cells instead of guessing until we
+  // hit one
+  uint64_t *free_cells = gs->scratch;
+  spawn_mask(gs, free_cells);
+
+  size_t count = plane_count(free_cells, gs->words);
+  if (count == 0)
     return;
-  }
+
+  set_item(gs, plane_select(free_cells, gs->words, game_rand(gs) % count), item);
 }
 
 void add_snacks(struct game_state *gs, struct snek *snek, int count)
@@ -160,18 +776,6 @@ void add_mushrooms(struct game_state *gs, struct snek *snek, int count)
   }
 }
 
-void snek_destroy(struct snek *snek)
-{
-  struct pt *p = snek->head;
-  while (p) {
-    struct pt *seg = p;
-    p = p->prev;
-    free(seg);
-  }
-
-  free(snek);
-}
-
 // Configure the terminal for raw input/output, turn off key echoing, etc.
 
 // I learned how to do the raw terminal i/o stuff from the neat
@@ -180,26 +784,27 @@ void snek_destroy(struct snek *snek)
 
 struct termios orig_termios;
 
-void title_screen(void)
+void title_screen(struct arena *arena, uint32_t rows, uint32_t cols)
 {
-  struct message *messages = malloc(4 * sizeof(struct message));
+  struct message messages[4];
   messages[0].msg = "~~ SNEK! 1.0.0 ~~";
-  messages[0].row = MIN_WIN_HEIGHT / 3;
+  messages[0].row = rows / 3;
   messages[0].colour = WHITE;
   messages[1].msg = "Eat snek snacks! Grow!";
-  messages[1].row = (MIN_WIN_HEIGHT / 3) + 2;
+  messages[1].row = (rows / 3) + 2;
   messages[1].colour = WHITE;
   messages[2].msg = "Avoid an ouroboros situation!";
-  messages[2].row = (MIN_WIN_HEIGHT / 3) + 3;
+  messages[2].row = (rows / 3) + 3;
   messages[2].colour = WHITE;
   messages[3].msg = "press space to begin...";
-  messages[3].row = (MIN_WIN_HEIGHT / 3) + 5;
+  messages[3].row = (rows / 3) + 5;
   messages[3].colour = WHITE;
   
-  struct game_state gs = { .score = 0, .items = NULL };
+  struct game_state gs = { .arena = arena, .score = 0 };
+  arena_reset(arena);
+  board_init(&gs, rows, cols);
 
   render(NULL, &gs, messages, 4, 0);
-  free(messages);
   
   while (true) {
     char c = get_key();
@@ -209,6 +814,9 @@ void title_screen(void)
     else if (c == ' ') {
      break;
     }
+
+    // nothing's moving, so there's no hurry
+    game_sleep(10000);
   }
 }
 
@@ -219,23 +827,55 @@ void die(const char *s)
   exit(1);
 }
 
+// Everything drawn goes out through here, to the terminal or wherever
+// term_output() said, and gets counted
+static int term_fd = STDOUT_FILENO;
+static size_t term_written;
+
+void term_output(int fd)
+{
+  term_fd = fd;
+}
+
+// Or into a pretend terminal instead, if there's one to capture it (see vt.c)
+static struct vt *term_vt;
+
+void term_capture(struct vt *vt)
+{
+  term_vt = vt;
+}
+
+void term_write(const char *buf, size_t len)
+{
+  if (term_vt)
+    vt_feed(term_vt, buf, len);
+  else
+    write(term_fd, buf, len);
+  term_written += len;
+}
+
+size_t term_bytes(void)
+{
+  return term_written;
+}
+
 void clear_screen(void)
 {
   // clear the screen
-  write(STDOUT_FILENO, "\x1b[2J", 4);
+  term_write("\x1b[2J", 4);
 
   // move cursor to to top left
-  write(STDOUT_FILENO, "\x1b[H", 3);
+  term_write("\x1b[H", 3);
 }
 
 void hide_cursor(void)
 {
-  write(STDOUT_FILENO, "\x1b[?25l", 6);
+  term_write("\x1b[?25l", 6);
 }
 
 void show_cursor(void)
 {
-  write(STDOUT_FILENO, "\x1b[?25h", 6);
+  term_write("\x1b[?25h", 6);
 }
 
 void exit_raw_mode(void) 
@@ -245,7 +885,7 @@ void exit_raw_mode(void)
   show_cursor();
 
   // just in case, switch back to default fg colour
-  write(STDOUT_FILENO, "\x1b[39m", 5);
+  term_write("\x1b[39m", 5);
 }
 
 void enter_raw_mode(void)
@@ -276,7 +916,7 @@ void enter_raw_mode(void)
     die("tcsetattr");
 }
 
-bool valid_window_size()
+bool valid_window_size(uint32_t min_rows, uint32_t min_cols)
 {
   struct winsize ws;
   if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
@@ -287,7 +927,7 @@ bool valid_window_size()
   int cols = ws.ws_col;
   int rows = ws.ws_row;
   
-  if (cols < MIN_WIN_WIDTH || rows < MIN_WIN_HEIGHT)
+  if (cols < (int) min_cols || rows < (int) min_rows)
     return false;
   
   return true;
@@ -295,26 +935,94 @@ bool valid_window_size()
 
 // terminal i/o stuff
 
-char get_key(void)
+// Work out the key at the start of buf (len bytes of input), turning the
+// arrow keys into wasd. Returns how many bytes it took up, or 0 if buf ends
+// partway through an escape sequence. Escape sequences we don't know
+// (function keys, ctrl-arrows and so on) are swallowed whole and come out as
+// '\0', so none of their bytes get taken for keys. A sequence that runs to
+// KEY_SEQ_MAX bytes without ending, or is broken off by a byte that can't be
+// in one, is junk and gets dropped up to that point.
+size_t decode_key(const char *buf, size_t len, char *key)
 {
-  char c = '\0';
-  if (read(STDIN_FILENO, &c, 1) == -1 && errno != EAGAIN) 
+  *key = buf[0];
+  if (buf[0] != '\x1b')
+    return 1;
+  if (len < 2)
+    return 0;
+
+  // ESC O A and so on, from terminals in application cursor mode
+  if (buf[1] == 'O') {
+    if (len < 3)
+      return 0;
+    *key = buf[2] >= 'A' && buf[2] <= 'D' ? "wsda"[buf[2] - 'A'] : '\0';
+    return 3;
+  }
+
+  // anything else that isn't a CSI sequence is just escape
+  if (buf[1] != '[')
+    return 1;
+
+  // CSI: parameter and intermediate bytes, then a final byte
+  size_t j = 2;
+  while (j < len && j < KEY_SEQ_MAX && buf[j] >= 0x20 && buf[j] <= 0x3f)
+    j++;
+  if (j == len && len < KEY_SEQ_MAX)
+    return 0;
+
+  *key = '\0';
+  if (j == KEY_SEQ_MAX || buf[j] < 0x40 || buf[j] > 0x7e)
+    return j;
+
+  // only plain arrows; ones with modifiers (ESC [ 1 ; 5 A) are ignored
+  if (j == 2 && buf[j] >= 'A' && buf[j] <= 'D')
+    *key = "wsda"[buf[j] - 'A'];
+
+  return j + 1;
+}
+
+// Keys come in faster than we take them out sometimes (or several at once,
+// for escape sequences), so whatever's been read but not used yet waits
+// here for the next call.
+static char pending[64];
+static size_t num_pending;
+
+static void read_pending(void)
+{
+  if (scripted()) {
+    num_pending += script_keys(&pending[num_pending], sizeof(pending) - num_pending);
+    return;
+  }
+
+  ssize_t n = read(STDIN_FILENO, &pending[num_pending], sizeof(pending) - num_pending);
+  if (n == -1 && errno != EAGAIN)
     die("read");
-  
-  if (c == '\x1b') {
-    char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-    if (seq[0] == '[') {
-      switch (seq[1]) {
-        case 'A': return 'w';
-        case 'B': return 's';
-        case 'C': return 'd';
-        case 'D': return 'a';
-      }
-    }
+  if (n > 0)
+    num_pending += n;
+}
+
+char get_key(void)
+{
+  if (num_pending == 0)
+    read_pending();
+  if (num_pending == 0)
+    return '\0';
+
+  char c;
+  size_t used = decode_key(pending, num_pending, &c);
+  if (used == 0) {
+    // the rest of the sequence may not have been read yet
+    read_pending();
+    used = decode_key(pending, num_pending, &c);
+  }
+  if (used == 0) {
+    // a lone escape
+    c = '\x1b';
+    used = 1;
   }
 
+  num_pending -= used;
+  memmove(pending, &pending[used], num_pending);
+
   return c;
 }
 
@@ -353,37 +1061,204 @@ char snek_head(uint32_t dir)
   }
 }
 
-void render(struct snek *snek, struct game_state *gs, struct message *messages, size_t msg_count, uint32_t high_score)
+void style_colour(struct cell_style *style, int colour, const char *glyph, size_t glyph_len)
 {
-  int snek_colour = GREEN;
+  style->fg = colour;
+  style->pre_len = sprintf(style->pre, "\x1b[38;5;%dm", colour);
+  memcpy(style->glyph, glyph, glyph_len);
+  style->glyph_len = glyph_len;
+  style->post_len = 0;
+}
+
+// styles is indexed by cell type (EMPTY, SNEK_HEAD, etc.)
+void styles_init(struct cell_style styles[], int snek_colour, char head)
+{
+  memset(styles, 0, (WALL + 1) * sizeof(struct cell_style));
+
+  styles[EMPTY].fg = -1;
+  styles[EMPTY].glyph[0] = ' ';
+  styles[EMPTY].glyph_len = 1;
+
+  style_colour(&styles[SNEK_HEAD], snek_colour, &head, 1);
+  style_colour(&styles[SNEK_BODY], snek_colour, "#", 1);
+  style_colour(&styles[SNEK_SNACK], BLUE, "o", 1);
+  style_colour(&styles[MUSHROOM], PURPLE, "\xe2\x99\xa3", 3);
+
+  styles[WALL].fg = -1;
+  memcpy(styles[WALL].pre, "\x1b[47m", 5);
+  styles[WALL].pre_len = 5;
+  styles[WALL].glyph[0] = ' ';
+  styles[WALL].glyph_len = 1;
+  memcpy(styles[WALL].post, "\x1b[m", 3);
+  styles[WALL].post_len = 3;
+}
+
+// How many cells starting from cells[0] are the same type as cells[0]. With
+// SSE2 we compare 16 cells against the first one at a time, which makes
+// finding the end of the long stretches of empty board nearly free.
+size_t run_length(const uint8_t *cells, size_t n)
+{
+  size_t i = 1;
+
+#ifdef __SSE2__
+  __m128i first = _mm_set1_epi8(cells[0]);
+  while (i + 16 <= n) {
+    __m128i v = _mm_loadu_si128((const __m128i *) &cells[i]);
+    unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, first)) & 0xffff;
+    if (diff)
+      return i + __builtin_ctz(diff);
+    i += 16;
+  }
+#endif
+
+  while (i < n && cells[i] == cells[0])
+    i++;
+
+  return i;
+}
+
+// Encode n cells into out, returning the number of bytes written. Rather
+// than deciding what to draw one cell at a time, we find each run of cells
+// of the same type and copy its glyphs in bulk, only emitting a colour
+// change when the colour actually changes. fg tracks the foreground colour
+// the terminal is currently using (-1 for the default).
+size_t encode_cells(const uint8_t *cells, size_t n, const struct cell_style styles[], char *out, int *fg)
+{
+  size_t pos = 0;
+
+  for (size_t c = 0; c < n; ) {
+    size_t len = run_length(&cells[c], n - c);
+    const struct cell_style *style = &styles[cells[c]];
+
+    if (style->fg == -1 || style->fg != *fg) {
+      memcpy(&out[pos], style->pre, style->pre_len);
+      pos += style->pre_len;
+      if (style->fg != -1)
+        *fg = style->fg;
+    }
+
+    if (style->glyph_len == 1) {
+      memset(&out[pos], style->glyph[0], len);
+      pos += len;
+    }
+    else {
+      for (size_t j = 0; j < len; j++) {
+        memcpy(&out[pos], style->glyph, style->glyph_len);
+        pos += style->glyph_len;
+      }
+    }
 
-  // build table of items on screen
-  int *table = calloc(sizeof(int), MIN_WIN_HEIGHT * MIN_WIN_WIDTH);
-  if (gs->items) {
-    for (int j = 0; j < MIN_WIN_HEIGHT * MIN_WIN_WIDTH; j++) {
-      if (gs->items[j] != EMPTY)
-        table[j] = gs->items[j];
+    if (style->post_len) {
+      memcpy(&out[pos], style->post, style->post_len);
+      pos += style->post_len;
+      *fg = -1;
     }
 
-    if (gs->poisoned)
-      snek_colour = PURPLE;
+    c += len;
   }
 
-  
-  if (snek) {
-    struct pt *p = snek->head;
-    int i = i = p->row * MIN_WIN_WIDTH + p->col;
-    table[i] = SNEK_HEAD;
-    p = p->prev;
-    while (p) {
-      int i = p->row * MIN_WIN_WIDTH + p->col;
-      table[i] = SNEK_BODY;
-      p = p->prev;
+  return pos;
+}
+
+// The original cell-at-a-time encoder. render() doesn't use it any more
+// but it's kept around as the baseline for --bench-render.
+size_t encode_cells_scalar(const uint8_t *cells, size_t n, int snek_colour, char head, char *out)
+{
+  size_t pos = 0;
+
+  for (size_t c = 0; c < n; c++) {
+    switch (cells[c]) {
+      case EMPTY:
+        out[pos++] = ' ';
+        break;
+      case SNEK_BODY:
+        fg_colour(out, &pos, snek_colour);
+        out[pos++] = '#';
+        break;
+      case SNEK_HEAD:
+        fg_colour(out, &pos, snek_colour);
+        out[pos++] = head;
+        break;
+      case SNEK_SNACK:
+        fg_colour(out, &pos, BLUE);
+        out[pos++] = 'o';
+        break;
+      case WALL:
+        invert(out, &pos);
+        out[pos++] = ' ';
+        uninvert(out, &pos);
+        break;
+      case MUSHROOM:
+        fg_colour(out, &pos, PURPLE);
+        memcpy(&out[pos], "\xe2\x99\xa3", 3);
+        pos += 3;
+        break;
+    }
+  }
+
+  return pos;
+}
+
+void render(struct snek *snek, struct game_state *gs, struct message *messages, size_t msg_count, uint32_t high_score)
+{
+  int snek_colour = GREEN;
+
+  // the screen table and frame buffer only get allocated the first time
+  // they're needed, since games run without a terminal don't use them
+  if (!gs->screen) {
+    gs->screen = arena_alloc(gs->arena, gs->cells);
+    gs->frame = arena_alloc(gs->arena, gs->cells * 16);
+  }
+
+  // build table of items on screen, with the snek on top
+  uint8_t *table = gs->screen;
+  memset(table, EMPTY, gs->cells);
+  const uint64_t *planes[] = { gs->walls, gs->snacks, gs->mushrooms, gs->body };
+  uint8_t kinds[] = { WALL, SNEK_SNACK, MUSHROOM, SNEK_BODY };
+  for (int p = 0; p < 4; p++) {
+    for (size_t j = 0; j < gs->words; j++) {
+      uint64_t w = planes[p][j];
+      while (w) {
+        table[j * 64 + __builtin_ctzll(w)] = kinds[p];
+        w &= w - 1;
+      }
     }
   }
 
+  if (gs->poisoned)
+    snek_colour = PURPLE;
+  
+  if (snek)
+    table[head_cell(snek)] = SNEK_HEAD;
+
+  struct screen screen = { .table = table, .stride = gs->stride,
+                            .rows = gs->rows, .cols = gs->cols,
+                            .snek_colour = snek_colour,
+                            .head = snek ? snek_head(snek->dir) : ' ',
+                            .score = gs->score };
+  draw_screen(&screen, messages, msg_count, high_score, gs->frame);
+}
+
+// Draw the table of cells, along with the border, score bar and any
+// messages. buffer needs room for 16 bytes per cell in the worst case, where
+// every cell needs a colour change and a 3 byte glyph.
+static size_t frames;
+
+size_t frames_drawn(void)
+{
+  return frames;
+}
+
+void draw_screen(const struct screen *screen, struct message *messages, size_t msg_count, uint32_t high_score, char *buffer)
+{
+  const uint8_t *table = screen->table;
+  uint32_t rows = screen->rows, cols = screen->cols;
+
+  struct cell_style styles[WALL + 1];
+  styles_init(styles, screen->snek_colour, screen->head);
+
   clear_screen();
-  char buffer[MIN_WIN_HEIGHT * MIN_WIN_WIDTH * 2];
+
   size_t pos = 0;
 
   // draw top bar with score
@@ -395,7 +1270,7 @@ void render(struct snek *snek, struct game_state *gs, struct message *messages,
   uninvert(buffer, &pos);
 
   char score[25];
-  sprintf(score, " Score: %d ", gs->score);
+  sprintf(score, " Score: %d ", screen->score);
   size_t score_len = strlen(score);
   memcpy(&buffer[pos], score, score_len);
   pos += score_len;
@@ -405,7 +1280,7 @@ void render(struct snek *snek, struct game_state *gs, struct message *messages,
   sprintf(score, " High score: %d ", high_score);
   size_t high_score_len = strlen(score);
 
-  int padding = (MIN_WIN_WIDTH - high_score_len - 5) - (score_len + 5);
+  int padding = (cols - high_score_len - 5) - (score_len + 5);
   memset(&buffer[pos], ' ', padding);
   pos += padding;
 
@@ -424,7 +1299,7 @@ void render(struct snek *snek, struct game_state *gs, struct message *messages,
   buffer[pos++] = '\r';
   buffer[pos++] = '\n';
   
-  for (size_t r = 1; r < MIN_WIN_HEIGHT - 1; r++) {
+  for (size_t r = 1; r < rows - 1; r++) {
     invert(buffer, &pos);
     buffer[pos++] = ' ';
     uninvert(buffer, &pos);
@@ -437,45 +1312,28 @@ void render(struct snek *snek, struct game_state *gs, struct message *messages,
       if (messages[j].row == r) {
         message = &messages[j];
         msg_len = strlen(message->msg);
-        msg_col = (MIN_WIN_WIDTH - 2 - msg_len) / 2;
+        msg_col = (cols - 2 - msg_len) / 2;
       }
     }
 
-    for (size_t c = 1; c < MIN_WIN_WIDTH - 1; c++) {
-      if (message && c >= msg_col && c < msg_col + msg_len) {
+    // the uninvert above leaves the terminal on the default colour
+    int fg = -1;
+    size_t row = r * screen->stride;
+    if (message) {
+      pos += encode_cells(&table[row + 1], msg_col - 1, styles, &buffer[pos], &fg);
+
+      if (fg != message->colour) {
         fg_colour(buffer, &pos, message->colour);
-        buffer[pos++] = message->msg[c - msg_col];
-        continue;
-      }
-      
-      int i = r * MIN_WIN_WIDTH + c;
-      switch (table[i]) {
-        case EMPTY:
-          buffer[pos++] = ' ';
-          break;
-        case SNEK_BODY:
-          fg_colour(buffer, &pos, snek_colour);
-          buffer[pos++] = '#';
-          break;
-        case SNEK_HEAD:
-          fg_colour(buffer, &pos, snek_colour);
-          buffer[pos++] = snek_head(snek->dir);
-          break;
-        case SNEK_SNACK:
-          fg_colour(buffer, &pos, BLUE);
-          buffer[pos++] = 'o';
-          break;
-        case WALL:
-          invert(buffer, &pos);
-          buffer[pos++] = ' ';
-          uninvert(buffer, &pos);
-          break;
-        case MUSHROOM:
-          fg_colour(buffer, &pos, PURPLE);
-          memcpy(&buffer[pos], "\xe2\x99\xa3", 3);
-          pos += 3;
-          break;
+        fg = message->colour;
       }
+      memcpy(&buffer[pos], message->msg, msg_len);
+      pos += msg_len;
+
+      size_t c = msg_col + msg_len;
+      pos += encode_cells(&table[row + c], cols - 1 - c, styles, &buffer[pos], &fg);
+    }
+    else {
+      pos += encode_cells(&table[row + 1], cols - 2, styles, &buffer[pos], &fg);
     }
 
     invert(buffer, &pos);
@@ -487,197 +1345,509 @@ void render(struct snek *snek, struct game_state *gs, struct message *messages,
   }
 
   invert(buffer, &pos);
-  memset(&buffer[pos], ' ', MIN_WIN_WIDTH);
-  pos += MIN_WIN_WIDTH;
+  memset(&buffer[pos], ' ', cols);
+  pos += cols;
   uninvert(buffer, &pos);
   buffer[pos++] = '\r';
   buffer[pos++] = '\n';
   
-  write(STDOUT_FILENO, buffer, pos);
+  term_write(buffer, pos);
+  frames++;
+}
 
-  free(table);
+double now_secs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-void try_to_add_barrier(struct snek *snek, struct game_state *gs) 
+// Time encode_cells() against encode_cells_scalar() on a few board sizes,
+// most of them far bigger than a terminal so the differences aren't lost
+// in the noise. The boards are mostly empty with a long wiggly snek and a
+// sprinkling of snacks, walls and mushrooms, like a game in progress.
+int bench_render(void)
 {
-  size_t walls[3];
+  size_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 200, 1000 }, { 1000, 4000 } };
+
+  srand(1);
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t rows = sizes[s][0], cols = sizes[s][1], cells = rows * cols;
+    uint8_t *board = calloc(cells, 1);
+    char *out = malloc(cols * 16);
+
+    for (size_t j = 0; j < cells / 100; j++)
+      board[rand() % cells] = SNEK_SNACK;
+    for (size_t j = 0; j < cells / 500; j++)
+      board[rand() % cells] = MUSHROOM;
+    for (size_t j = 0; j < cells / 600; j++) {
+      size_t i = rand() % (cells - 3);
+      board[i] = board[i + 1] = board[i + 2] = WALL;
+    }
 
-  // try up to 3 times to add a barrier
-  for (int j = 0; j < 3; j++) {
-    int row = rand() % (MIN_WIN_HEIGHT - 2) + 1;
-    int col = rand() % (MIN_WIN_WIDTH - 2) + 1;
-    int i = row * MIN_WIN_WIDTH + col;
+    size_t i = cells / 2;
+    for (size_t j = 0; j < cells / 20; j++) {
+      int step = rand() % 4;
+      if (step == 0 && i >= cols)
+        i -= cols;
+      else if (step == 1 && i + cols < cells)
+        i += cols;
+      else if (step == 2 && i + 1 < cells)
+        i++;
+      else if (i > 0)
+        i--;
+      board[i] = SNEK_BODY;
+    }
+    board[i] = SNEK_HEAD;
 
-    int shape = rand() % 2;
-    switch (shape) {
-      case 0:
-        walls[0] = i - 1;
-        walls[1] = i;
-        walls[2] = i + 1;
-        break;
-      case 1:
-        walls[0] = i - MIN_WIN_WIDTH;
-        walls[1] = i;
-        walls[2] = i + MIN_WIN_WIDTH;
-        break;
+    struct cell_style styles[WALL + 1];
+    styles_init(styles, GREEN, '>');
+
+    size_t frames = 20000000 / cells + 1;
+    size_t scalar_bytes = 0, run_bytes = 0;
+
+    double start = now_secs();
+    for (size_t f = 0; f < frames; f++) {
+      for (size_t r = 0; r < rows; r++)
+        scalar_bytes += encode_cells_scalar(&board[r * cols], cols, GREEN, '>', out);
     }
-    
-    bool valid = true;
-    struct pt *seg = snek->head;
-    while (seg) {
-      int i = seg->row * MIN_WIN_WIDTH + seg->col;
-      for (int k = 0; k < 3; k++) {
-        if (walls[k] == i) {
-          valid = false;
-          goto draw_wall;
-        }
+    double scalar_time = now_secs() - start;
+
+    start = now_secs();
+    for (size_t f = 0; f < frames; f++) {
+      for (size_t r = 0; r < rows; r++) {
+        int fg = -1;
+        run_bytes += encode_cells(&board[r * cols], cols, styles, out, &fg);
       }
-      seg = seg->prev;
     }
-draw_wall:
-    if (valid) {
-      for (int k = 0; k < 3; k++) {
-        gs->items[walls[k]] = WALL;
-      }
+    double run_time = now_secs() - start;
 
-      return;
-    }
+    printf("%5zux%-5zu scalar: %10.1f us/frame %9zu bytes/frame   "
+           "runs: %10.1f us/frame %9zu bytes/frame   %5.1fx\n",
+           rows, cols, scalar_time * 1e6 / frames, scalar_bytes / frames,
+           run_time * 1e6 / frames, run_bytes / frames, scalar_time / run_time);
+
+    free(board);
+    free(out);
   }
+
+  return 0;
 }
 
-bool update(struct snek *snek, struct game_state *gs)
+// Explore random eight move lines from the same spot, the way a search
+// would, once by copying the game for each line and once with make and
+// unmake
+int bench_undo(void)
 {
-  int dr = 0, dc = 0;
-  switch (snek->dir) {
-    case NORTH:
-      dr = -1;
-      break;
-    case SOUTH:
-      dr = 1;
-      break;
-    case EAST:
-      dc = 1;
-      break;
-    case WEST:
-      dc = -1;
-      break;
-  }
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 1000, 1000 } };
+  size_t lines = 20000, depth = 8;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    uint32_t rows = sizes[s][0], cols = sizes[s][1];
+    struct arena arena, copy_arena;
+    arena_init(&arena, game_arena_size(rows, cols));
+    arena_init(&copy_arena, game_arena_size(rows, cols));
+
+    struct game_state gs = { .arena = &arena, .speed = 100000, .rng = 1 };
+    board_init(&gs, rows, cols);
+    struct snek *snek = snek_init(&gs);
+    add_snacks(&gs, snek, rows * cols / 150);
+
+    struct game_state copy = { .arena = &copy_arena };
+    board_init(&copy, rows, cols);
+    struct snek *copy_snek = snek_init(&copy);
+
+    double elapsed[2];
+    size_t nodes[2] = { 0 };
+    for (int undoing = 0; undoing < 2; undoing++) {
+      uint64_t rng = 1;
+      game_copy(&copy, copy_snek, &gs, snek);
+
+      double start = now_secs();
+      for (size_t l = 0; l < lines; l++) {
+        struct undo undo[8];
+        size_t made = 0;
+        if (!undoing)
+          game_copy(&copy, copy_snek, &gs, snek);
+
+        for (size_t d = 0; d < depth; d++) {
+          copy_snek->dir = splitmix64(&rng) % 4;
+          bool dead = undoing ? copy.make(copy_snek, &copy, &undo[made++])
+                                : copy.step(copy_snek, &copy);
+          nodes[undoing]++;
+          if (dead)
+            break;
+        }
 
-  if (gs->poisoned && time(NULL) - gs->poisoned_time >= POISON_DURATION) {
-    gs->poisoned = false;
-    gs->speed = gs->saved_speed;
-    gs->saved_speed = 0;
+        while (made > 0)
+          unmake_move(&copy, copy_snek, &undo[--made]);
+      }
+      elapsed[undoing] = now_secs() - start;
+    }
+
+    printf("%5ux%-5u %10.0f nodes/s copying, %10.0f nodes/s with make/unmake\n", rows, cols,
+            nodes[0] / elapsed[0], nodes[1] / elapsed[1]);
+
+    arena_destroy(&arena);
+    arena_destroy(&copy_arena);
   }
 
-  struct pt *n = malloc(sizeof(struct pt));
-  n->row = snek->head->row + dr;
-  n->col = snek->head->col + dc;
-  n->next = NULL;
-  n->prev = snek->head;
-  snek->head->next = n;
-  snek->head = n;
+  return 0;
+}
 
-  struct pt *t = snek->tail;
-  snek->tail = snek->tail->next;
-  snek->tail->prev = NULL;
-  free(t);
+void try_to_add_barrier(struct snek *snek, struct game_state *gs) 
+{
+  place_obstacle(gs, snek, 3);
+}
 
-  size_t i = snek->head->row * MIN_WIN_WIDTH + snek->head->col;
-  if (gs->items[i] == SNEK_SNACK) {
-    gs->score += 10;
-    gs->speed -= 1000;
-    gs->items[i] = EMPTY;
-
-    // grow the snek by three segments
-    for (int j = 0; j < 3; j++) {
-      struct pt *new_seg = malloc(sizeof(struct pt));
-      new_seg->row = snek->tail->row;
-      new_seg->col = snek->tail->col;
-      new_seg->prev = NULL;
-      new_seg->next = snek->tail;
-      snek->tail->prev = new_seg;
-      snek->tail = new_seg;
-    }    
-  }
-  else if (gs->items[i] == MUSHROOM) {
-    gs->score += 75;
-    if (gs->saved_speed == 0) {
-      gs->saved_speed = gs->speed;
+void usage(void)
+{
+  printf("usage: snek [-w] [-s ROWSxCOLS] [-l PACK [-n LEVEL]] [--seed N]\n");
+  printf("       snek --survival [-s ROWSxCOLS]\n");
+  printf("       snek --bench-render | --bench-obstacles | --bench-survival\n");
+  printf("       snek --bench-nearest | --bench-field | --bench-mcts | --bench-undo\n");
+  printf("       snek --bench-versus | --bench-bot BOT.so | --bench-policy | --bench-record\n");
+  printf("       snek --bench-hash | --bench-latency [--seed N]\n");
+  printf("       snek --pack PACK FILE...\n");
+  printf("       snek --train FILE [--generations N] [--threads N] [--seed N]\n");
+  printf("       snek --tournament BOT,BOT,... [--suite N] [--threads N] [--seed N]\n");
+  printf("       snek --diff-test N [--threads N] [--seed N]\n");
+  printf("       snek --fuzz keys|game [FILE...]\n");
+  printf("       snek --check-render\n");
+  printf("       snek --script FILE [--no-delay] [--frames FILE] [--seed N] [--bot ...]\n");
+  printf("  -s ROWSxCOLS    play on a bigger board (at least %dx%d)\n",
+          MIN_WIN_HEIGHT, MIN_WIN_WIDTH);
+  printf("  -w              wrap around the edges of the board\n");
+  printf("  -l PACK         play a level from a level pack\n");
+  printf("  -n LEVEL        which level of the pack to play (default 0)\n");
+  printf("  --bot mcts      let a bot play\n");
+  printf("  --bot BOT.so[:ARGS]  let a bot built as a plugin play (see snekbot.h)\n");
+  printf("  --bot policy:FILE    let a neural net with the weights in FILE play\n");
+  printf("  --threads N     how many threads the bot thinks on (default: one per CPU)\n");
+  printf("  --think MS      how long the bot thinks each move (default 20)\n");
+  printf("  --survival      play in an endless world that scrolls with the snek\n");
+  printf("  --seed N        seed the random numbers, to play the same games again\n");
+  printf("  --record DIR    record every tick played into a training dataset in DIR\n");
+  printf("  --hash-log FILE write the state hash after every tick to FILE, to compare runs\n");
+  printf("  --pack PACK     compile the text levels in FILE... into PACK\n");
+  printf("  --train FILE    evolve a neural net bot and save it in FILE, for --bot policy:FILE\n");
+  printf("  --generations N how many generations to train for (default 50)\n");
+  printf("  --tournament BOT,...  play bots (BOT.so, policy:FILE or alphabeta:DEPTH) against\n");
+  printf("                  each other on a suite of seeds and rate them\n");
+  printf("  --suite N       how many seeds the tournament uses, from --seed up (default 100)\n");
+  printf("  --diff-test N   play N games against the reference model and report the first\n");
+  printf("                  difference, cut down to as few keys as still show it\n");
+  printf("  --script FILE   play the keys in FILE (times and keys, see script.c) instead of\n");
+  printf("                  the terminal's, and report how fast the frames went at the end\n");
+  printf("  --no-delay      with --script, don't sleep between ticks but keep time as if we had\n");
+  printf("  --frames FILE   draw into FILE instead of the terminal (eg. /dev/null)\n");
+  printf("  --fuzz TARGET   run the inputs in FILE... through a fuzz target, or random\n");
+  printf("                  ones for a few seconds if there aren't any (see fuzz.c)\n");
+  printf("  --check-render  check what's drawn against the game on a pretend terminal, count\n");
+  printf("                  what a frame costs and exit\n");
+  printf("  --bench-render     time the cell encoders and exit\n");
+  printf("  --bench-obstacles  time placing obstacles and exit\n");
+  printf("  --bench-survival   run a snek a long way through the world and exit\n");
+  printf("  --bench-nearest    time nearest snack queries and exit\n");
+  printf("  --bench-field      time keeping the snack distance field up to date and exit\n");
+  printf("  --bench-mcts       play some games with the bot on more and more threads and exit\n");
+  printf("  --bench-undo       time trying out moves with make/unmake against copying and exit\n");
+  printf("  --bench-versus     play head to head bots against each other and exit\n");
+  printf("  --bench-bot BOT.so time a plugin bot on batches of games and exit\n");
+  printf("  --bench-policy     time the neural net bot and exit\n");
+  printf("  --bench-record     time recording a training dataset and exit\n");
+  printf("  --bench-hash       check games play the same from the same seed and exit\n");
+  printf("  --bench-latency    time from pressing a key to seeing the snek turn, playing on\n");
+  printf("                     a pseudo terminal, and exit\n");
+}
+
+// fuzz.c has its own main() when it's built for libFuzzer
+#ifndef FUZZ_TARGET
+int main(int argc, char *argv[])
+{
+  uint32_t rows = MIN_WIN_HEIGHT, cols = MIN_WIN_WIDTH;
+  bool wrap = false;
+  const char *pack_path = NULL;
+  uint32_t level = 0;
+  bool survival_mode = false;
+  uint64_t seed = 0;
+  bool have_seed = false;
+  bool bot = false;
+  const char *bot_spec = NULL;
+  const char *policy_path = NULL;
+  const char *record_path = NULL;
+  const char *hash_log_path = NULL;
+  const char *train_path = NULL;
+  uint32_t generations = 50;
+  const char *tourney_bots = NULL;
+  uint32_t suite = 100;
+  uint32_t diff_games = 0;
+  const char *script_path = NULL;
+  const char *frames_path = NULL;
+  bool no_delay = false;
+  uint32_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t think_ms = 20;
+
+  struct option long_opts[] = {
+    { "bench-render", no_argument, NULL, 'B' },
+    { "pack", required_argument, NULL, 'P' },
+    { "bench-obstacles", no_argument, NULL, 'O' },
+    { "survival", no_argument, NULL, 'S' },
+    { "seed", required_argument, NULL, 'R' },
+    { "bench-survival", no_argument, NULL, 'W' },
+    { "bench-nearest", no_argument, NULL, 'N' },
+    { "bench-field", no_argument, NULL, 'F' },
+    { "bench-mcts", no_argument, NULL, 'M' },
+    { "bench-undo", no_argument, NULL, 'U' },
+    { "bench-versus", no_argument, NULL, 'V' },
+    { "bench-bot", required_argument, NULL, 'X' },
+    { "bench-policy", no_argument, NULL, 'Y' },
+    { "record", required_argument, NULL, 'D' },
+    { "hash-log", required_argument, NULL, 'J' },
+    { "bench-hash", no_argument, NULL, 'K' },
+    { "bench-record", no_argument, NULL, 'Z' },
+    { "train", required_argument, NULL, 'L' },
+    { "generations", required_argument, NULL, 'G' },
+    { "tournament", required_argument, NULL, 'H' },
+    { "suite", required_argument, NULL, 'I' },
+    { "diff-test", required_argument, NULL, 'E' },
+    { "fuzz", required_argument, NULL, 'Q' },
+    { "script", required_argument, NULL, 'k' },
+    { "frames", required_argument, NULL, 'f' },
+    { "no-delay", no_argument, NULL, 'd' },
+    { "check-render", no_argument, NULL, 'C' },
+    { "bench-latency", no_argument, NULL, 'A' },
+    { "bot", required_argument, NULL, 'b' },
+    { "threads", required_argument, NULL, 't' },
+    { "think", required_argument, NULL, 'T' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "s:wl:n:", long_opts, NULL)) != -1) {
+    switch (opt) {
+      case 's':
+        if (sscanf(optarg, "%ux%u", &rows, &cols) != 2
+              || rows < MIN_WIN_HEIGHT || cols < MIN_WIN_WIDTH) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'w':
+        wrap = true;
+        break;
+      case 'l':
+        pack_path = optarg;
+        break;
+      case 'n':
+        level = strtoul(optarg, NULL, 10);
+        break;
+      case 'B':
+        return bench_render();
+      case 'O':
+        return bench_obstacles();
+      case 'P':
+        return level_pack_build(optarg, &argv[optind], argc - optind);
+      case 'S':
+        survival_mode = true;
+        break;
+      case 'R':
+        seed = strtoull(optarg, NULL, 10);
+        have_seed = true;
+        break;
+      case 'M':
+        return bench_mcts();
+      case 'U':
+        return bench_undo();
+      case 'V':
+        return bench_versus();
+      case 'X':
+        return bench_plugin(optarg);
+      case 'Y':
+        return bench_policy();
+      case 'D':
+        record_path = optarg;
+        break;
+      case 'J':
+        hash_log_path = optarg;
+        break;
+      case 'K':
+        return bench_hash();
+      case 'Z':
+        return bench_record();
+      case 'L':
+        train_path = optarg;
+        break;
+      case 'G':
+        generations = strtoul(optarg, NULL, 10);
+        break;
+      case 'H':
+        tourney_bots = optarg;
+        break;
+      case 'I':
+        suite = strtoul(optarg, NULL, 10);
+        break;
+      case 'E':
+        diff_games = strtoul(optarg, NULL, 10);
+        break;
+      case 'Q':
+        return fuzz_run(optarg, &argv[optind], argc - optind);
+      case 'k':
+        script_path = optarg;
+        break;
+      case 'f':
+        frames_path = optarg;
+        break;
+      case 'd':
+        no_delay = true;
+        break;
+      case 'C':
+        return check_render();
+      case 'b':
+        // anything but the built in bot is a plugin to load
+        if (strcmp(optarg, "mcts") == 0)
+          bot = true;
+        else if (strncmp(optarg, "policy:", 7) == 0)
+          policy_path = optarg + 7;
+        else
+          bot_spec = optarg;
+        break;
+      case 't':
+        threads = strtoul(optarg, NULL, 10);
+        break;
+      case 'T':
+        think_ms = strtoul(optarg, NULL, 10);
+        break;
+      case 'F':
+        return bench_field();
+      case 'N':
+        return bench_nearest();
+      case 'W':
+        return bench_survival(have_seed ? seed : 1);
+      case 'A':
+        return bench_latency(have_seed ? seed : 1);
+      default:
+        usage();
+        return 1;
     }
-    gs->speed /= 2;
-    gs->items[i] = EMPTY;
-    gs->poisoned = true;
-    gs->poisoned_time = time(NULL);
-  }
-  else if (gs->items[i] == WALL) {
-    return true;
   }
 
-  // check if the snek has hit any part of its body
-  struct pt *seg = snek->head->prev;
-  while (seg) {
-    if (seg->row == snek->head->row && seg->col == snek->head->col) {
-      return true;
-    }
+  if (train_path)
+    return train(train_path, generations, threads, have_seed ? seed : 1);
+  if (tourney_bots)
+    return tournament(tourney_bots, suite, have_seed ? seed : 1, threads);
+  if (diff_games)
+    return diff_test(diff_games, have_seed ? seed : 1, threads);
+
+  // load the bot before the terminal goes raw, so any complaints about it
+  // can be read
+  struct plugin *plugin = NULL;
+  if (bot_spec && !(plugin = plugin_load(bot_spec)))
+    return 1;
 
-    seg = seg->prev;
+  struct policy *policy = NULL;
+  if (policy_path && !(policy = policy_load(policy_path))) {
+    perror(policy_path);
+    return 1;
   }
 
-  // should we try to add a barrier?
-  if (gs->score >= 500 && gs->score - gs->last_wall_attempt >= 100) {
-    try_to_add_barrier(snek, gs);
-    gs->last_wall_attempt = gs->score;
+  struct recorder *recorder = NULL;
+  if (record_path && !(recorder = recorder_open(record_path))) {
+    perror(record_path);
+    return 1;
   }
 
-  return false;
-}
+  FILE *hash_log = NULL;
+  if (hash_log_path && !(hash_log = fopen(hash_log_path, "w"))) {
+    perror(hash_log_path);
+    return 1;
+  }
 
-bool in_bounds(struct snek *snek) 
-{
-  if (snek->head->row == 0 || snek->head->col == 0)
-    return false;
+  struct level_pack pack = { 0 };
+  if (pack_path) {
+    if (!level_pack_open(&pack, pack_path)) {
+      perror(pack_path);
+      return 1;
+    }
 
-  if (snek->head->row >= MIN_WIN_HEIGHT - 1 || snek->head->col >= MIN_WIN_WIDTH - 1)
-    return false;
+    if (level >= pack.count) {
+      printf("%s only has %u levels\n", pack_path, pack.count);
+      return 1;
+    }
 
-  return true;
-}
+    level_size(&pack, level, &rows, &cols);
+  }
 
-int main(void)
-{
-  if (!valid_window_size())
+  if (frames_path) {
+    int fd = open(frames_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+      perror(frames_path);
+      return 1;
+    }
+    term_output(fd);
+  }
+
+  // a script stands in for the terminal, so there's none to check or set up
+  if (script_path && !script_open(script_path, no_delay)) {
+    if (errno)
+      perror(script_path);
+    return 1;
+  }
+
+  if (!script_path && !valid_window_size(rows, cols))
   {
-    printf("Please open snek in a terminal that's at least %dx%d\n",
-          MIN_WIN_HEIGHT, MIN_WIN_WIDTH);
+    printf("Please open snek in a terminal that's at least %ux%u\n",
+          rows, cols);
     
     return 1;
   }
 
-  srand(time(NULL));
-  enter_raw_mode();
+  uint64_t rng = have_seed ? seed : (uint64_t) time(NULL);
+  if (!script_path)
+    enter_raw_mode();
   hide_cursor();
   
   uint32_t high_score = 0;
   struct snek *snek = NULL;
 
-  title_screen();
+  struct arena arena;
+  arena_init(&arena, game_arena_size(rows, cols));
+
+  title_screen(&arena, rows, cols);
+
+  if (survival_mode) {
+    arena_destroy(&arena);
+    while (survival(rows, cols, rng, &high_score))
+      ;
+    clear_screen();
+    return 0;
+  }
 
 	bool playing = true;
 	do {
-    struct game_state gs = { .score = 0, .items = NULL, .speed = 100000,
-                                .paused = false, .poisoned = false,
-                                .last_wall_attempt = 0, .saved_speed = 0 };
-		free(snek);
-  	snek = snek_init();
-		free(gs.items);
-		gs.items = calloc(sizeof(int), MIN_WIN_HEIGHT * MIN_WIN_WIDTH);
-		add_snacks(&gs, snek, 20);
+    struct game_state gs = { .arena = &arena, .wrap = wrap, .score = 0,
+                                .speed = 100000, .paused = false,
+                                .poisoned = false, .last_wall_attempt = 0,
+                                .saved_speed = 0, .rng = splitmix64(&rng) };
+		arena_reset(&arena);
+		board_init(&gs, rows, cols);
+    if (pack_path)
+      level_load(&pack, level, &gs);
+  	snek = snek_init(&gs);
 
 		bool game_over = false;
-		gs.snacks_refreshed = time(NULL);
-		gs.mushrooms_refreshed = time(NULL);
 
-    try_to_add_barrier(snek, &gs);
+    // designed levels come with their own layout, otherwise we start with
+    // some snacks and a few obstacles
+    if (!pack_path) {
+		  add_snacks(&gs, snek, 20);
+      generate_obstacles(&gs, snek);
+    }
+
+    struct mcts *mcts = bot ? mcts_new(&gs, threads, think_ms / 1000.0) : NULL;
+    uint32_t ticks = 0;
+    uint64_t hash = 0;
 
 		// main game loop	
 		while (true) {
@@ -694,10 +1864,38 @@ int main(void)
 				gs.paused = !gs.paused;
 		
 			if (!gs.paused) {
-				game_over = update(snek, &gs);
+        if (mcts)
+          snek->dir = mcts_choose(mcts, &gs, snek);
+        if (plugin) {
+          struct snekbot_view view;
+          uint32_t dir = snek->dir;
+          game_view(&gs, snek, ticks, &view);
+          plugin_decide(plugin, &view, 1, &dir);
+          if (dir < 4)
+            snek->dir = dir;
+        }
+        if (policy) {
+          struct snekbot_view view;
+          game_view(&gs, snek, ticks, &view);
+          policy_decide(policy, &view, 1, &snek->dir);
+        }
+        ticks++;
+
+        uint8_t obs[POLICY_OBS_SIZE];
+        uint32_t score = gs.score;
+        if (recorder) {
+          struct snekbot_view view;
+          game_view(&gs, snek, ticks, &view);
+          policy_observe(&view, obs);
+        }
 
-				if (!in_bounds(snek))
-					game_over = true;
+				game_over = gs.step(snek, &gs);
+        if (recorder)
+          recorder_add(recorder, obs, snek->dir, gs.score - score, game_over);
+        if (hash_log) {
+          hash = tick_hash(&gs, snek, hash);
+          fprintf(hash_log, "%u %016llx\n", ticks, (unsigned long long) hash);
+        }
 
 				if (game_over) {
           bool new_high_score = false;
@@ -707,8 +1905,8 @@ int main(void)
           }
  
           size_t num_msgs = new_high_score ? 3 : 2;
-          struct message *msg = malloc(num_msgs * sizeof(struct message));
-          int i = 0, row = MIN_WIN_HEIGHT / 3;
+          struct message *msg = arena_alloc(&arena, num_msgs * sizeof(struct message));
+          int i = 0, row = rows / 3;
           msg[i].msg = "Oh noes! Game over :(";
           msg[i].colour = PURPLE;
           msg[i].row = row;
@@ -727,39 +1925,52 @@ int main(void)
           msg[i].colour = WHITE;
           msg[i].row = row;
           render(snek, &gs, msg, num_msgs, high_score);
-          free(msg);
 					break;
 				}
 
-				if (time(NULL) - gs.snacks_refreshed >= 10) {
+				if (gs.played - gs.snacks_refreshed >= 10 * 1000000ull) {
 					add_snacks(&gs, snek, 5);
-					gs.snacks_refreshed = time(NULL);
+					gs.snacks_refreshed = gs.played;
 				}
 
-        if(gs.score > 200 && time(NULL) - gs.mushrooms_refreshed >= 15) {
+        if(gs.score > 200 && gs.played - gs.mushrooms_refreshed >= 15 * 1000000ull) {
           add_mushrooms(&gs, snek, 2);
-          gs.mushrooms_refreshed = time(NULL);
+          gs.mushrooms_refreshed = gs.played;
         }
 
 				render(snek, &gs, NULL, 0, high_score);
 			}
 
-  		usleep(gs.speed);
+  		game_sleep(gs.speed);
   	}
 
+    if (mcts)
+      mcts_free(mcts);
+
 		while (true) {
 			char c = get_key();
 			if (c == 'q') {
 				playing = false;
-        free(gs.items);
-        free(snek);
+        arena_destroy(&arena);
+        if (pack_path)
+          level_pack_close(&pack);
+        if (plugin)
+          plugin_free(plugin);
+        if (policy)
+          policy_free(policy);
         clear_screen();
+        if (recorder && !recorder_close(recorder))
+          perror(record_path);
+        if (hash_log && fclose(hash_log) != 0)
+          perror(hash_log_path);
 				break;
 			}
 			else if (c == ' ') {
 				break;
 			}	
+      game_sleep(10000);
 		}
 	}
 	while (playing);
-}
\ No newline at end of file
+}
+#endif
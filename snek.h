@@ -0,0 +1,609 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along 
+// with this software. If not, 
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef SNEK_H
+#define SNEK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "snekbot.h"
+
+#define INIT_SKEN_LEN 8
+
+#define EMPTY 0
+#define SNEK_HEAD 1
+#define SNEK_BODY 2
+#define MUSHROOM 3
+#define SNEK_SNACK 4
+#define WALL 5
+
+// more kinds of thing for the state hash to tell apart
+#define ZOBRIST_TAIL 6
+#define ZOBRIST_DIR 7
+#define ZOBRIST_GROW 8
+
+#define NORTH 0
+#define SOUTH 1
+#define EAST 2
+#define WEST 3
+
+#define LEFT 0
+#define RIGHT 1
+
+#define MIN_WIN_HEIGHT 30
+#define MIN_WIN_WIDTH 100
+
+#define GREEN 28
+#define PURPLE 99
+#define BLUE 33
+#define WHITE 15
+
+#define ACCELERATION 500
+
+// snacks speed the snek up, but only down to this many usecs a tick (any
+// further and the delay would wrap around and all but stop the game)
+#define MIN_SPEED 20000
+
+// how long poison lasts, in seconds of play (see game_state.played)
+#define POISON_DURATION 5
+
+// the longest escape sequence we'll wait for the end of
+#define KEY_SEQ_MAX 16
+
+// snacks and mushrooms are counted in buckets of BUCKET_SIZE x BUCKET_SIZE
+// cells so we can find the ones near a cell quickly (see nearby.c)
+#define BUCKET_SIZE 8
+
+// data structures for storing the snek and game state
+
+struct message {
+  uint32_t row;
+  char *msg;
+  int colour;
+};
+
+// All of the memory a single game needs comes out of one arena, which is
+// just a big block we bump a pointer through. Starting a new game resets
+// the pointer, so there's nothing to free and nothing to leak between games.
+struct arena {
+  char *base;
+  size_t size;
+  size_t used;
+};
+
+struct snek;
+struct undo;
+struct dist_field;
+
+// The board is rows x cols, border included, but each row takes up stride
+// cells in memory. For the sizes we have a specialised step function for,
+// stride is cols rounded up to a power of two; otherwise it's just cols.
+//
+// The board is kept as a set of bitplanes with one bit per cell (bit i of
+// the plane is cell row * stride + col), and item_at() reads a cell's item
+// back out of them. That way
+// questions like "where can I put a snack?" or "what can the snek reach
+// from here?" are a handful of and/or/shifts over words rather than a walk
+// over every cell or every segment of the snek. The body plane includes the
+// head.
+struct game_state {
+  struct arena *arena;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t stride;
+  size_t cells;
+  size_t words;
+  bool wrap;
+  bool (*step)(struct snek *, struct game_state *);
+  bool (*make)(struct snek *, struct game_state *, struct undo *);
+  uint32_t score;
+  uint32_t acceleration;
+  uint64_t rng;
+  uint64_t hash;
+  uint64_t *walls;
+  uint64_t *body;
+  uint64_t *snacks;
+  uint64_t *mushrooms;
+  uint64_t *interior;
+  uint64_t *scratch;
+  uint64_t *reach;
+  uint32_t bucket_rows;
+  uint32_t bucket_cols;
+  uint8_t *snack_buckets;
+  uint8_t *mushroom_buckets;
+  struct dist_field *field;
+  uint8_t *screen;
+  char *frame;
+  useconds_t speed;
+  useconds_t saved_speed;
+  bool paused;
+  // The game keeps its own time, in usecs: each tick adds the speed it's
+  // played at. Anything that happens after so long goes by this rather than
+  // the clock, so a game plays the same from the same seed and keys however
+  // fast it's actually run.
+  uint64_t played;
+  uint64_t snacks_refreshed;
+  uint64_t mushrooms_refreshed;
+  bool poisoned;
+  uint64_t poisoned_at;
+  uint32_t last_wall_attempt;
+  uint32_t start;
+  uint32_t start_dir;
+};
+
+// The snek is a ring buffer of the cells it covers, with the head at
+// cells[head] and the tail len - 1 cells back from it. It can't get longer
+// than the board (bar the segments piled up on a level's starting cell), so
+// the ring is allocated once at that size. Eating a snack adds to grow, and
+// while grow is above zero the tail stays put instead of following along.
+struct snek {
+  uint32_t *cells;
+  uint32_t mask;
+  uint32_t head;
+  uint32_t len;
+  uint32_t grow;
+  uint32_t dir;
+};
+
+// The cell k segments back from the head
+static inline uint32_t snek_cell(const struct snek *snek, uint32_t k)
+{
+  return snek->cells[(snek->head - k) & snek->mask];
+}
+
+static inline uint32_t head_cell(const struct snek *snek)
+{
+  return snek->cells[snek->head];
+}
+
+static inline uint32_t tail_cell(const struct snek *snek)
+{
+  return snek_cell(snek, snek->len - 1);
+}
+
+// What gs->make() changed in a tick, for unmake_move() to undo
+struct undo {
+  uint64_t hash;
+  uint32_t score;
+  useconds_t speed;
+  useconds_t saved_speed;
+  uint64_t played;
+  bool poisoned;
+  uint64_t poisoned_at;
+  uint32_t grow;
+  uint32_t tail;
+  bool moved_tail;
+  bool vacated;
+  bool moved_head;
+  bool took_cell;
+  int item;
+};
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+  return z ^ (z >> 31);
+}
+
+// The Zobrist key for a kind of thing (an item, the snek's body, head or
+// tail, its direction or how much it has left to grow) at cell i. A state's
+// hash is all of its keys xored together, so adding or removing one thing
+// is a single xor. Rather than tables of random keys, which would be
+// enormous on a big board, the keys are made on the spot by mixing the
+// cell and kind together.
+static inline uint64_t zobrist(int kind, size_t i)
+{
+  uint64_t x = (uint64_t) i << 4 | kind;
+
+  return splitmix64(&x);
+}
+
+// bitplane helpers
+
+static inline bool plane_test(const uint64_t *plane, size_t i)
+{
+  return (plane[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void plane_set(uint64_t *plane, size_t i)
+{
+  plane[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+static inline void plane_clear(uint64_t *plane, size_t i)
+{
+  plane[i / 64] &= ~((uint64_t) 1 << (i % 64));
+}
+
+// Word j of the plane shifted n cells towards higher indices (ie. what
+// lands in cell i is what was in cell i - n)
+static inline uint64_t plane_shl_word(const uint64_t *plane, size_t j, size_t n)
+{
+  size_t q = n / 64, r = n % 64;
+  if (j < q)
+    return 0;
+
+  uint64_t w = plane[j - q] << r;
+  if (r && j > q)
+    w |= plane[j - q - 1] >> (64 - r);
+
+  return w;
+}
+
+// Word j of the plane (words long) shifted n cells towards lower indices
+static inline uint64_t plane_shr_word(const uint64_t *plane, size_t words, size_t j, size_t n)
+{
+  size_t q = n / 64, r = n % 64;
+  if (j + q >= words)
+    return 0;
+
+  uint64_t w = plane[j + q] >> r;
+  if (r && j + q + 1 < words)
+    w |= plane[j + q + 1] << (64 - r);
+
+  return w;
+}
+
+// The part of the game the screen shows: a table of cell types (rows of
+// stride cells, border included) and what to draw the snek with
+struct screen {
+  const uint8_t *table;
+  size_t stride;
+  uint32_t rows;
+  uint32_t cols;
+  int snek_colour;
+  char head;
+  uint32_t score;
+};
+
+// The bytes it takes to draw one kind of cell, encoded once per frame
+// instead of once per cell. fg is the colour pre selects, or -1 if pre
+// doesn't touch the foreground colour.
+struct cell_style {
+  int fg;
+  char pre[16];
+  size_t pre_len;
+  char glyph[4];
+  size_t glyph_len;
+  char post[4];
+  size_t post_len;
+};
+
+struct vt;
+
+// snek.c
+void die(const char *);
+size_t decode_key(const char *, size_t, char *);
+char get_key(void);
+void term_output(int);
+void term_write(const char *, size_t);
+void term_capture(struct vt *);
+size_t term_bytes(void);
+size_t frames_drawn(void);
+char snek_head(uint32_t);
+void draw_screen(const struct screen *, struct message *, size_t, uint32_t, char *);
+void render(struct snek *, struct game_state *, struct message *, size_t, uint32_t);
+void styles_init(struct cell_style[], int, char);
+size_t encode_cells(const uint8_t *, size_t, const struct cell_style[], char *, int *);
+size_t encode_cells_scalar(const uint8_t *, size_t, int, char, char *);
+double now_secs(void);
+
+void arena_init(struct arena *, size_t);
+void *arena_alloc(struct arena *, size_t);
+void arena_reset(struct arena *);
+void arena_destroy(struct arena *);
+size_t game_arena_size(uint32_t, uint32_t);
+
+size_t plane_count(const uint64_t *, size_t);
+size_t plane_select(const uint64_t *, size_t, size_t);
+size_t flood_plane(struct game_state *, const uint64_t *, size_t, uint64_t *);
+size_t flood_fill(struct game_state *, size_t, uint64_t *);
+
+uint32_t board_stride(uint32_t, uint32_t);
+void board_init(struct game_state *, uint32_t, uint32_t);
+uint32_t game_rand(struct game_state *);
+uint64_t *item_plane(struct game_state *, int);
+int item_at(struct game_state *, size_t);
+void set_item(struct game_state *, size_t, int);
+struct snek *snek_init(struct game_state *);
+void unmake_move(struct game_state *, struct snek *, const struct undo *);
+void game_copy(struct game_state *, struct snek *, const struct game_state *, const struct snek *);
+void snek_copy(struct snek *, const struct snek *);
+uint64_t board_hash(struct game_state *, const struct snek *);
+uint64_t state_hash(const struct game_state *, const struct snek *);
+uint64_t tick_hash(const struct game_state *, const struct snek *, uint64_t);
+void add_snacks(struct game_state *, struct snek *, int);
+void add_mushrooms(struct game_state *, struct snek *, int);
+
+// level.c
+struct level_entry;
+
+// A pack of designed levels, mmapped
+struct level_pack {
+  const uint8_t *base;
+  size_t size;
+  uint32_t count;
+  const struct level_entry *index;
+};
+
+bool level_pack_open(struct level_pack *, const char *);
+void level_pack_close(struct level_pack *);
+void level_size(const struct level_pack *, uint32_t, uint32_t *, uint32_t *);
+void level_load(const struct level_pack *, uint32_t, struct game_state *);
+int level_pack_build(const char *, char *[], int);
+
+// maze.c
+void neighbours(struct game_state *, size_t, size_t [4]);
+bool place_obstacle(struct game_state *, struct snek *, int);
+void generate_obstacles(struct game_state *, struct snek *);
+int bench_obstacles(void);
+
+// nearby.c
+
+// the most items nearest_items() will find at once
+#define NEAREST_MAX 32
+
+uint8_t *item_buckets(struct game_state *, int);
+size_t bucket_of(struct game_state *, size_t);
+void index_items(struct game_state *);
+uint32_t cell_distance(struct game_state *, size_t, size_t);
+size_t nearest_items(struct game_state *, int, size_t, size_t *, size_t);
+size_t items_within(struct game_state *, int, size_t, uint32_t, size_t *, size_t);
+int bench_nearest(void);
+
+// field.c
+
+// How far every cell is from the nearest snack. dist is indexed like the
+// board, with UINT32_MAX for cells that are blocked or can't reach a snack.
+struct dist_field {
+  struct game_state *gs;
+  uint32_t *dist;
+  uint32_t *old;
+  uint32_t *queue;
+  uint32_t *stale;
+};
+
+void field_init(struct dist_field *, struct game_state *);
+void field_free(struct dist_field *);
+void field_rebuild(struct dist_field *);
+void field_add_source(struct dist_field *, size_t);
+void field_remove_source(struct dist_field *, size_t);
+void field_block(struct dist_field *, size_t);
+void field_unblock(struct dist_field *, size_t);
+int field_direction(struct dist_field *, size_t);
+int bench_field(void);
+
+// mcts.c
+struct mcts;
+
+struct mcts *mcts_new(const struct game_state *, uint32_t, double);
+void mcts_free(struct mcts *);
+uint32_t mcts_choose(struct mcts *, const struct game_state *, const struct snek *);
+int bench_mcts(void);
+
+// tt.c
+struct tt;
+
+struct tt *tt_new(unsigned);
+void tt_free(struct tt *);
+bool tt_probe(struct tt *, uint64_t, uint32_t *, double *);
+void tt_store(struct tt *, uint64_t, uint32_t, double);
+
+// versus.c
+#define MAX_SNEKS 4
+
+// A few sneks on one board, all moving at once. A snek that crashes stays
+// where it is as something for the others to avoid.
+struct versus {
+  struct game_state gs;
+  uint32_t count;
+  struct snek *sneks[MAX_SNEKS];
+  uint32_t scores[MAX_SNEKS];
+  bool alive[MAX_SNEKS];
+  uint32_t ticks;
+};
+
+// What versus_move() changed in a tick, for versus_unmake() to undo
+struct versus_undo {
+  struct undo sneks[MAX_SNEKS];
+  uint32_t dirs[MAX_SNEKS];
+  bool alive[MAX_SNEKS];
+};
+
+struct versus_bot;
+
+size_t versus_arena_size(uint32_t, uint32_t);
+void versus_init(struct versus *, struct arena *, uint32_t, uint32_t, bool, uint32_t, uint64_t);
+void versus_copy(struct versus *, const struct versus *);
+uint32_t versus_move(struct versus *, const uint32_t *, struct versus_undo *);
+void versus_unmake(struct versus *, const struct versus_undo *);
+void versus_top_up(struct versus *);
+struct versus_bot *versus_bot_new(const struct versus *, uint32_t, double, uint32_t);
+void versus_bot_free(struct versus_bot *);
+uint32_t versus_choose(struct versus_bot *, const struct versus *, uint32_t);
+int bench_versus(void);
+
+// batch.c
+
+// One of the games in a batch
+struct batch_game {
+  struct arena arena;
+  struct game_state gs;
+  struct snek *snek;
+  uint32_t ticks;
+  uint64_t hash;
+  bool done;
+};
+
+struct batch {
+  uint32_t count;
+  uint32_t rows;
+  uint32_t cols;
+  bool wrap;
+  struct batch_game *games;
+  struct snekbot_view *views;
+  uint32_t *live;
+};
+
+struct plugin;
+
+struct batch *batch_new(uint32_t, uint32_t, uint32_t, bool);
+void batch_free(struct batch *);
+void batch_reset(struct batch *, uint32_t, uint64_t);
+void game_view(const struct game_state *, const struct snek *, uint32_t, struct snekbot_view *);
+size_t batch_views(struct batch *);
+size_t batch_step(struct batch *, size_t, const uint32_t *);
+size_t batch_play(struct batch *, struct plugin *, uint32_t);
+void batch_wander(struct batch *, size_t, uint32_t *);
+int bench_hash(void);
+
+// plugin.c
+struct plugin *plugin_load(const char *);
+void plugin_free(struct plugin *);
+const char *plugin_name(const struct plugin *);
+void plugin_decide(struct plugin *, const struct snekbot_view *, size_t, uint32_t *);
+int bench_plugin(const char *);
+
+// policy.c
+#define POLICY_MAX_LAYERS 4
+#define POLICY_WINDOW 11
+
+// the window around the head, three ways, then the heading and which way
+// the nearest snack is
+#define POLICY_INPUTS (3 * POLICY_WINDOW * POLICY_WINDOW + 8)
+
+// and padded out to a multiple of 32
+#define POLICY_OBS_SIZE ((POLICY_INPUTS + 31) & ~31)
+
+struct policy;
+
+struct policy *policy_new(uint32_t, const uint32_t *, uint64_t);
+struct policy *policy_load(const char *);
+bool policy_save(const struct policy *, const char *);
+void policy_free(struct policy *);
+void policy_copy(struct policy *, const struct policy *);
+struct policy *policy_clone(const struct policy *);
+void policy_mutate(struct policy *, uint64_t *, double);
+bool policy_use_avx2(struct policy *, bool);
+void policy_observe(const struct snekbot_view *, uint8_t *);
+void policy_run(struct policy *, const uint8_t *, size_t, int32_t *);
+void policy_decide(struct policy *, const struct snekbot_view *, size_t, uint32_t *);
+int bench_policy(void);
+
+// dataset.c
+struct recorder;
+
+// A recorded dataset, mapped in. Record n of each column is tick n.
+struct dataset {
+  size_t count;
+  size_t obs_size;
+  const uint8_t *obs;
+  const uint8_t *action;
+  const int32_t *reward;
+  const uint8_t *done;
+  const uint8_t *maps[4];
+  size_t sizes[4];
+};
+
+struct recorder *recorder_open(const char *);
+void recorder_add(struct recorder *, const uint8_t *, uint32_t, int32_t, bool);
+bool recorder_close(struct recorder *);
+bool dataset_open(struct dataset *, const char *);
+void dataset_close(struct dataset *);
+void dataset_sample(const struct dataset *, uint64_t *, size_t *, size_t);
+int bench_record(void);
+
+// train.c
+int train(const char *, uint32_t, uint32_t, uint64_t);
+
+// tourney.c
+int tournament(const char *, uint32_t, uint64_t, uint32_t);
+
+// reference.c
+int diff_test(uint32_t, uint64_t, uint32_t);
+
+// fuzz.c
+int fuzz_keys(const uint8_t *, size_t);
+int fuzz_game(const uint8_t *, size_t);
+int fuzz_run(const char *, char **, int);
+
+// vt.c
+
+// A character on the pretend terminal's screen, and its colours (256
+// colour numbers, or -1 for the terminal's own)
+struct vt_cell {
+  char glyph[4];
+  uint8_t len;
+  int16_t fg;
+  int16_t bg;
+};
+
+// What's gone through the terminal: escapes is every escape sequence, and
+// sgr, moves and clears are the ones that set colours, move the cursor
+// and clear some of the screen
+struct vt_stats {
+  size_t bytes;
+  size_t escapes;
+  size_t sgr;
+  size_t moves;
+  size_t clears;
+  size_t glyphs;
+  size_t scrolls;
+  size_t unknown;
+};
+
+struct vt {
+  uint32_t rows;
+  uint32_t cols;
+  struct vt_cell *cells;
+  uint32_t row;
+  uint32_t col;
+  int16_t fg;
+  int16_t bg;
+  bool cursor_visible;
+  int state;
+  char seq[32];
+  size_t seq_len;
+  char utf8[4];
+  uint8_t utf8_len;
+  uint8_t utf8_want;
+  struct vt_stats stats;
+};
+
+struct vt *vt_new(uint32_t, uint32_t);
+void vt_free(struct vt *);
+void vt_clear(struct vt *, size_t, size_t);
+struct vt_cell *vt_cell(struct vt *, uint32_t, uint32_t);
+void vt_feed(struct vt *, const char *, size_t);
+bool vt_same(struct vt *, struct vt *, uint32_t *, uint32_t *);
+int check_render(void);
+
+// script.c
+bool script_open(const char *, bool);
+bool scripted(void);
+size_t script_keys(char *, size_t);
+void game_sleep(useconds_t);
+
+// latency.c
+int bench_latency(uint64_t);
+
+// world.c
+bool survival(uint32_t, uint32_t, uint64_t, uint32_t *);
+int bench_survival(uint64_t);
+
+#endif
@@ -0,0 +1,83 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Everything a bot built as a shared object needs to play snek, and nothing
+// else, so bots don't have to be built against the rest of the source and
+// keep working when it changes.
+//
+// A bot exports one function, snekbot_entry(), returning a struct snekbot
+// that says which version of this header it was built against and has the
+// bot's functions in it. snek loads it with dlopen() and, if the version
+// matches, calls create() once, then decide() once a tick with every game
+// that's being played at once (one for a normal game, lots of them when
+// training or benchmarking), and destroy() at the end.
+//
+// decide() gets a read-only view of each game and writes the direction for
+// each one into dirs. The views and everything they point at belong to snek
+// and are only good until decide() returns.
+//
+// The board is rows x cols including the border, with cell i at row
+// i / stride, column i % stride. Walls, the snek's body, snacks and
+// mushrooms are bitplanes, with cell i being bit i % 64 of word i / 64.
+// The snek is a ring of cell indices: segment k back from the head is
+// cells[(head - k) & mask], for k from 0 to len - 1.
+
+#ifndef SNEKBOT_H
+#define SNEKBOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNEKBOT_ABI_VERSION 1
+
+#define SNEKBOT_NORTH 0
+#define SNEKBOT_SOUTH 1
+#define SNEKBOT_EAST 2
+#define SNEKBOT_WEST 3
+
+struct snekbot_view {
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t stride;
+  uint32_t words;
+  bool wrap;
+
+  const uint64_t *walls;
+  const uint64_t *body;
+  const uint64_t *snacks;
+  const uint64_t *mushrooms;
+
+  const uint32_t *cells;
+  uint32_t mask;
+  uint32_t head;
+  uint32_t len;
+  uint32_t grow;
+  uint32_t dir;
+
+  uint32_t score;
+  uint32_t ticks;
+};
+
+struct snekbot {
+  uint32_t abi_version;
+  const char *name;
+
+  // args is whatever came after a ':' in the bot's name on the command
+  // line, or "" if nothing did
+  void *(*create)(const char *args);
+  void (*destroy)(void *bot);
+  void (*decide)(void *bot, const struct snekbot_view *games, size_t count, uint32_t *dirs);
+};
+
+const struct snekbot *snekbot_entry(void);
+
+#endif
@@ -0,0 +1,395 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A tournament between bots, to see which is better and by how much.
+//
+// There are two events, both played on a suite of seeds. In the score race
+// every bot plays a game on each seed on its own and we see who scores
+// most. In the head to head every pair of bots plays a match on each seed,
+// and then again with the sneks swapped over, so neither gets the better
+// side of the board every time.
+//
+// The entrants are bot plugins (BOT.so[:ARGS]), neural nets (policy:FILE)
+// and the head to head alpha-beta bot searching a fixed number of ticks
+// deep (alphabeta:DEPTH), which only plays head to head since there's
+// nobody for it to search against on its own. None of them look at the
+// clock, so the same seeds give the same results every time, however many
+// threads the games get spread over.
+//
+// Scores come with a 95% confidence interval. Head to head results are
+// turned into Elo ratings by fitting a Bradley-Terry model (the chance of i
+// beating j is g_i / (g_i + g_j)) to all the results at once, so the order
+// the games were played in doesn't matter. Every bot is given one draw
+// against every other to start with, so one that never wins still gets a
+// rating.
+
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define MAX_ENTRANTS 16
+#define RACE_TICKS 2000
+#define MATCH_TICKS 400
+
+enum { PLUGIN, POLICY, ALPHABETA };
+
+// One worker's own copy of an entrant, since bots keep scratch space
+// between calls and can't be shared between threads
+struct entrant {
+  int kind;
+  struct plugin *plugin;
+  struct policy *policy;
+  struct versus_bot *ab;
+  uint32_t depth;
+};
+
+struct job {
+  uint32_t a;
+  uint32_t b;
+  uint64_t seed;
+  bool swapped;
+};
+
+struct result {
+  uint32_t score;
+  uint32_t ticks;
+
+  // for head to head, from a's side: 1 for a win, 0.5 for a draw
+  double points;
+};
+
+struct tourney {
+  uint32_t count;
+  struct job *jobs;
+  struct result *results;
+  size_t num_jobs;
+  _Atomic size_t next;
+};
+
+struct tourney_worker {
+  struct tourney *t;
+  pthread_t thread;
+  struct entrant entrants[MAX_ENTRANTS];
+  struct batch *batch;
+  struct arena arena;
+};
+
+static bool entrant_load(struct entrant *e, const char *spec)
+{
+  *e = (struct entrant) { 0 };
+
+  if (strncmp(spec, "alphabeta:", 10) == 0) {
+    e->kind = ALPHABETA;
+    e->depth = strtoul(spec + 10, NULL, 10);
+    return e->depth > 0;
+  }
+  if (strncmp(spec, "policy:", 7) == 0) {
+    e->kind = POLICY;
+    e->policy = policy_load(spec + 7);
+    if (!e->policy)
+      perror(spec + 7);
+    return e->policy;
+  }
+
+  e->kind = PLUGIN;
+  e->plugin = plugin_load(spec);
+  return e->plugin;
+}
+
+static void entrant_free(struct entrant *e)
+{
+  if (e->plugin)
+    plugin_free(e->plugin);
+  if (e->policy)
+    policy_free(e->policy);
+  if (e->ab)
+    versus_bot_free(e->ab);
+}
+
+static void entrant_decide(struct entrant *e, const struct snekbot_view *views, size_t n, uint32_t *dirs)
+{
+  if (e->kind == POLICY)
+    policy_decide(e->policy, views, n, dirs);
+  else
+    plugin_decide(e->plugin, views, n, dirs);
+}
+
+// Which way entrant e wants snek k to go in a head to head match
+static uint32_t match_decide(struct entrant *e, const struct versus *v, uint32_t k)
+{
+  if (e->kind == ALPHABETA) {
+    if (!e->ab)
+      e->ab = versus_bot_new(v, 1, 0, e->depth);
+    return versus_choose(e->ab, v, k);
+  }
+
+  struct snekbot_view view;
+  uint32_t dir = v->sneks[k]->dir;
+  game_view(&v->gs, v->sneks[k], v->ticks, &view);
+  entrant_decide(e, &view, 1, &dir);
+
+  return dir < 4 ? dir : v->sneks[k]->dir;
+}
+
+static struct result race(struct tourney_worker *w, const struct job *job)
+{
+  struct batch *batch = w->batch;
+  struct entrant *e = &w->entrants[job->a];
+  uint32_t dir;
+
+  batch_reset(batch, 0, job->seed);
+  for (uint32_t t = 0; t < RACE_TICKS && batch_views(batch) > 0; t++) {
+    entrant_decide(e, batch->views, 1, &dir);
+    batch_step(batch, 1, &dir);
+  }
+  batch->games[0].done = true;
+
+  return (struct result) { .score = batch->games[0].gs.score, .ticks = batch->games[0].ticks };
+}
+
+static struct result match(struct tourney_worker *w, const struct job *job)
+{
+  // a plays snek 0 unless they've swapped sides
+  uint32_t players[2] = { job->a, job->b };
+  if (job->swapped) {
+    players[0] = job->b;
+    players[1] = job->a;
+  }
+
+  arena_reset(&w->arena);
+  struct versus v;
+  versus_init(&v, &w->arena, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false, 2, job->seed);
+  while (v.ticks < MATCH_TICKS) {
+    uint32_t dirs[2];
+    for (uint32_t k = 0; k < 2; k++)
+      dirs[k] = match_decide(&w->entrants[players[k]], &v, k);
+    if (versus_move(&v, dirs, NULL) < 2)
+      break;
+    versus_top_up(&v);
+  }
+
+  // whoever's left standing wins, or the longer snek if they both are
+  uint32_t len[2];
+  for (uint32_t k = 0; k < 2; k++)
+    len[k] = v.alive[k] ? v.sneks[k]->len + v.sneks[k]->grow : 0;
+  uint32_t a = job->swapped;
+  double points = len[a] > len[1 - a] ? 1 : len[a] == len[1 - a] ? 0.5 : 0;
+
+  return (struct result) { .score = v.scores[a], .ticks = v.ticks, .points = points };
+}
+
+static void *work(void *arg)
+{
+  struct tourney_worker *w = arg;
+  struct tourney *t = w->t;
+
+  size_t j;
+  while ((j = atomic_fetch_add(&t->next, 1)) < t->num_jobs) {
+    const struct job *job = &t->jobs[j];
+    t->results[j] = job->b == job->a ? race(w, job) : match(w, job);
+  }
+
+  return NULL;
+}
+
+// Run a list of jobs over the workers, filling in t->results
+static void run_jobs(struct tourney *t, struct tourney_worker *workers, uint32_t threads)
+{
+  atomic_store(&t->next, 0);
+
+  for (uint32_t k = 1; k < threads; k++) {
+    if (pthread_create(&workers[k].thread, NULL, work, &workers[k]) != 0)
+      die("pthread_create");
+  }
+  work(&workers[0]);
+  for (uint32_t k = 1; k < threads; k++)
+    pthread_join(workers[k].thread, NULL);
+}
+
+// Fit Bradley-Terry strengths to the head to head results and turn them
+// into Elo ratings averaging 1500
+static void elo_ratings(uint32_t count, double points[][MAX_ENTRANTS], double games[][MAX_ENTRANTS],
+                          double *elo)
+{
+  double gamma[MAX_ENTRANTS];
+  for (uint32_t i = 0; i < count; i++)
+    gamma[i] = 1;
+
+  for (int iter = 0; iter < 1000; iter++) {
+    for (uint32_t i = 0; i < count; i++) {
+      double won = 0, denom = 0;
+      for (uint32_t j = 0; j < count; j++) {
+        if (j == i)
+          continue;
+        // plus the one draw everybody gets with everybody
+        won += points[i][j] + 0.5;
+        denom += (games[i][j] + 1) / (gamma[i] + gamma[j]);
+      }
+      gamma[i] = won / denom;
+    }
+
+    double log_mean = 0;
+    for (uint32_t i = 0; i < count; i++)
+      log_mean += log(gamma[i]) / count;
+    for (uint32_t i = 0; i < count; i++)
+      gamma[i] /= exp(log_mean);
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+    elo[i] = 1500 + 400 * log10(gamma[i]);
+}
+
+// Play a tournament between the bots named in specs (comma separated) on
+// the seeds from first to first + suite - 1
+int tournament(const char *specs, uint32_t suite, uint64_t first, uint32_t threads)
+{
+  if (suite == 0) {
+    fprintf(stderr, "a tournament needs at least one seed (--suite)\n");
+    return 1;
+  }
+
+  struct tourney t = { 0 };
+  char *list = strdup(specs);
+  char *names[MAX_ENTRANTS];
+  if (!list)
+    die("strdup");
+  for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    if (t.count == MAX_ENTRANTS) {
+      fprintf(stderr, "no more than %d bots in a tournament\n", MAX_ENTRANTS);
+      free(list);
+      return 1;
+    }
+    names[t.count++] = name;
+  }
+
+  threads = threads ? threads : 1;
+  struct tourney_worker *workers = calloc(threads, sizeof(struct tourney_worker));
+  if (!workers)
+    die("calloc");
+  bool ok = true;
+  int status = 0;
+  for (uint32_t k = 0; k < threads; k++) {
+    workers[k].t = &t;
+    workers[k].batch = batch_new(1, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+    arena_init(&workers[k].arena, versus_arena_size(MIN_WIN_HEIGHT, MIN_WIN_WIDTH));
+    for (uint32_t i = 0; i < t.count && ok; i++)
+      ok = entrant_load(&workers[k].entrants[i], names[i]);
+  }
+  if (!ok) {
+    fprintf(stderr, "couldn't load all the bots\n");
+    status = 1;
+    goto done;
+  }
+
+  // every job there is: a race on each seed for each bot that can race,
+  // then both sides of a match on each seed for each pair
+  size_t max_jobs = (size_t) suite * (t.count + t.count * t.count);
+  t.jobs = malloc(max_jobs * sizeof(struct job));
+  t.results = malloc(max_jobs * sizeof(struct result));
+  if (!t.jobs || !t.results)
+    die("malloc");
+  for (uint32_t i = 0; i < t.count; i++) {
+    for (uint32_t s = 0; s < suite && workers[0].entrants[i].kind != ALPHABETA; s++)
+      t.jobs[t.num_jobs++] = (struct job) { .a = i, .b = i, .seed = first + s };
+  }
+  size_t races = t.num_jobs;
+  for (uint32_t i = 0; i < t.count; i++) {
+    for (uint32_t j = i + 1; j < t.count; j++) {
+      for (uint32_t s = 0; s < suite; s++) {
+        t.jobs[t.num_jobs++] = (struct job) { .a = i, .b = j, .seed = first + s };
+        t.jobs[t.num_jobs++] = (struct job) { .a = i, .b = j, .seed = first + s, .swapped = true };
+      }
+    }
+  }
+
+  double start = now_secs();
+  run_jobs(&t, workers, threads);
+  double elapsed = now_secs() - start;
+
+  printf("score race, %u seeds from %llu:\n", suite, (unsigned long long) first);
+  printf("  %-32s %10s %16s %10s\n", "bot", "mean score", "95% interval", "mean ticks");
+  for (uint32_t i = 0; i < t.count; i++) {
+    double sum = 0, sq = 0, ticks = 0;
+    uint32_t n = 0;
+    for (size_t j = 0; j < races; j++) {
+      if (t.jobs[j].a != i)
+        continue;
+      sum += t.results[j].score;
+      sq += (double) t.results[j].score * t.results[j].score;
+      ticks += t.results[j].ticks;
+      n++;
+    }
+    if (n == 0) {
+      printf("  %-32s %10s\n", names[i], "-");
+      continue;
+    }
+
+    double mean = sum / n;
+    double sd = n > 1 ? sqrt((sq - n * mean * mean) / (n - 1)) : 0;
+    double half = 1.96 * sd / sqrt(n);
+    printf("  %-32s %10.1f %7.1f - %-6.1f %10.1f\n", names[i], mean, mean - half, mean + half, ticks / n);
+  }
+
+  if (t.count > 1) {
+    static double points[MAX_ENTRANTS][MAX_ENTRANTS], games[MAX_ENTRANTS][MAX_ENTRANTS];
+    uint32_t wins[MAX_ENTRANTS] = { 0 }, losses[MAX_ENTRANTS] = { 0 }, draws[MAX_ENTRANTS] = { 0 };
+    for (size_t j = races; j < t.num_jobs; j++) {
+      uint32_t a = t.jobs[j].a, b = t.jobs[j].b;
+      double p = t.results[j].points;
+      points[a][b] += p;
+      points[b][a] += 1 - p;
+      games[a][b]++;
+      games[b][a]++;
+      wins[a] += p == 1;
+      wins[b] += p == 0;
+      losses[a] += p == 0;
+      losses[b] += p == 1;
+      draws[a] += p == 0.5;
+      draws[b] += p == 0.5;
+    }
+
+    double elo[MAX_ENTRANTS];
+    elo_ratings(t.count, points, games, elo);
+
+    printf("head to head, %u seeds each way:\n", suite);
+    printf("  %-32s %14s %16s %6s\n", "bot", "won-lost-drawn", "score (95%)", "Elo");
+    for (uint32_t i = 0; i < t.count; i++) {
+      double n = wins[i] + losses[i] + draws[i];
+      double p = (wins[i] + 0.5 * draws[i]) / n;
+      double half = 1.96 * sqrt(p * (1 - p) / n);
+      printf("  %-32s %4u-%4u-%4u %5.1f%% +/- %4.1f%% %6.0f\n", names[i], wins[i], losses[i], draws[i],
+              100 * p, 100 * half, elo[i]);
+    }
+  }
+
+  printf("%zu games in %.1fs on %u threads\n", t.num_jobs, elapsed, threads);
+
+done:
+  for (uint32_t k = 0; k < threads; k++) {
+    for (uint32_t i = 0; i < t.count; i++)
+      entrant_free(&workers[k].entrants[i]);
+    batch_free(workers[k].batch);
+    arena_destroy(&workers[k].arena);
+  }
+  free(workers);
+  free(t.jobs);
+  free(t.results);
+  free(list);
+
+  return status;
+}
@@ -0,0 +1,199 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Training the neural net bot by evolution. There's a population of nets,
+// and each generation every one of them plays the same batch of games. The
+// best few go through to the next generation as they are, and the rest of
+// the places go to copies of them with a few weights nudged at random.
+//
+// Everything random comes from the seed: the first nets, which games get
+// played each generation and how the copies get changed. The games for a
+// generation are the same for every net in it and don't depend on which
+// thread plays them or in what order, so the same seed trains the same net
+// however many threads there are.
+//
+// How well a net does is its average score, plus a little for every tick it
+// stayed alive so that early on, when nothing is eating much, the nets that
+// at least don't crash are ahead.
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define POPULATION 64
+#define ELITES 8
+#define GAMES 32
+#define MAX_TICKS 1000
+#define MUTATION_RATE 0.02
+
+struct trainer {
+  struct policy *population[POPULATION];
+  double fitness[POPULATION];
+  uint64_t game_seed;
+  _Atomic uint32_t next;
+};
+
+struct train_worker {
+  struct trainer *trainer;
+  pthread_t thread;
+  struct batch *batch;
+  uint32_t dirs[GAMES];
+  size_t ticks;
+  size_t games;
+};
+
+// Play a net through a generation's games and say how it did
+static double evaluate(struct train_worker *w, struct policy *policy, uint64_t game_seed)
+{
+  struct batch *batch = w->batch;
+  for (uint32_t g = 0; g < GAMES; g++)
+    batch_reset(batch, g, game_seed + g);
+
+  size_t n;
+  for (uint32_t t = 0; t < MAX_TICKS && (n = batch_views(batch)) > 0; t++) {
+    policy_decide(policy, batch->views, n, w->dirs);
+    batch_step(batch, n, w->dirs);
+  }
+
+  double fitness = 0;
+  for (uint32_t g = 0; g < GAMES; g++) {
+    fitness += batch->games[g].gs.score + batch->games[g].ticks / 100.0;
+    w->ticks += batch->games[g].ticks;
+    batch->games[g].done = true;
+  }
+  w->games += GAMES;
+
+  return fitness / GAMES;
+}
+
+static void *work(void *arg)
+{
+  struct train_worker *w = arg;
+  struct trainer *trainer = w->trainer;
+
+  uint32_t j;
+  while ((j = atomic_fetch_add(&trainer->next, 1)) < POPULATION)
+    trainer->fitness[j] = evaluate(w, trainer->population[j], trainer->game_seed);
+
+  return NULL;
+}
+
+// Evolve a net for the given number of generations on the given number of
+// threads, saving the best one so far to path after every generation
+int train(const char *path, uint32_t generations, uint32_t threads, uint64_t seed)
+{
+  uint32_t hidden[] = { 32 };
+  struct trainer trainer;
+  threads = threads ? threads : 1;
+
+  for (uint32_t j = 0; j < POPULATION; j++)
+    trainer.population[j] = policy_new(1, hidden, splitmix64(&seed));
+
+  struct train_worker *workers = calloc(threads, sizeof(struct train_worker));
+  if (!workers)
+    die("calloc");
+  for (uint32_t k = 0; k < threads; k++) {
+    workers[k].trainer = &trainer;
+    workers[k].batch = batch_new(GAMES, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  }
+
+  struct policy *spare[POPULATION];
+  for (uint32_t j = 0; j < POPULATION; j++)
+    spare[j] = policy_clone(trainer.population[j]);
+
+  double best_fitness = 0;
+  double start = now_secs();
+  size_t total_games = 0;
+  for (uint32_t gen = 0; gen < generations; gen++) {
+    double gen_start = now_secs();
+    trainer.game_seed = splitmix64(&seed);
+    atomic_store(&trainer.next, 0);
+
+    for (uint32_t k = 1; k < threads; k++) {
+      if (pthread_create(&workers[k].thread, NULL, work, &workers[k]) != 0)
+        die("pthread_create");
+    }
+    work(&workers[0]);
+    for (uint32_t k = 1; k < threads; k++)
+      pthread_join(workers[k].thread, NULL);
+
+    size_t games = 0, ticks = 0;
+    for (uint32_t k = 0; k < threads; k++) {
+      games += workers[k].games;
+      ticks += workers[k].ticks;
+      workers[k].games = workers[k].ticks = 0;
+    }
+    total_games += games;
+
+    // rank them, keeping ties in order so it comes out the same every time
+    uint32_t order[POPULATION];
+    double mean = 0;
+    for (uint32_t j = 0; j < POPULATION; j++) {
+      uint32_t k = j;
+      while (k > 0 && trainer.fitness[order[k - 1]] < trainer.fitness[j]) {
+        order[k] = order[k - 1];
+        k--;
+      }
+      order[k] = j;
+      mean += trainer.fitness[j] / POPULATION;
+    }
+
+    best_fitness = trainer.fitness[order[0]];
+    if (!policy_save(trainer.population[order[0]], path))
+      die(path);
+
+    double elapsed = now_secs() - gen_start;
+    printf("generation %3u: best %7.1f, mean %7.1f, %6.0f games/s (%6.0f per core), %8.0f ticks/s\n",
+            gen, best_fitness, mean, games / elapsed, games / elapsed / threads, ticks / elapsed);
+    fflush(stdout);
+
+    // the elites go through as they are and the rest of the places go to
+    // changed copies of them
+    for (uint32_t j = 0; j < POPULATION; j++) {
+      policy_copy(spare[j], trainer.population[order[j < ELITES ? j : j % ELITES]]);
+      if (j >= ELITES)
+        policy_mutate(spare[j], &seed, MUTATION_RATE);
+    }
+    for (uint32_t j = 0; j < POPULATION; j++) {
+      struct policy *p = trainer.population[j];
+      trainer.population[j] = spare[j];
+      spare[j] = p;
+    }
+  }
+
+  // the best net of the last generation is first in line now, so play it
+  // through that generation's games again on its own to make sure it comes
+  // out the same
+  if (generations > 0) {
+    double again = evaluate(&workers[0], trainer.population[0], trainer.game_seed);
+    double elapsed = now_secs() - start;
+    printf("saved the best net to %s; %zu games in %.1fs, %.0f games/s per core; "
+            "its fitness played again: %.1f (%s)\n",
+            path, total_games, elapsed, total_games / elapsed / threads, again,
+            again == best_fitness ? "the same" : "DIFFERENT");
+  }
+
+  for (uint32_t j = 0; j < POPULATION; j++) {
+    policy_free(trainer.population[j]);
+    policy_free(spare[j]);
+  }
+  for (uint32_t k = 0; k < threads; k++)
+    batch_free(workers[k].batch);
+  free(workers);
+
+  return 0;
+}
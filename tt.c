@@ -0,0 +1,87 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A transposition table: what search bots have found out about game states
+// they've seen before, keyed by state_hash(), so they don't have to work it
+// all out again next tick or on another thread.
+//
+// It's a fixed-size table with one entry per slot and no locks. Each entry
+// is two words, the data and the key xored with the data, written one after
+// the other. If two threads write the same slot at once, or a read lands
+// halfway through a write, the words won't match up and the read just misses
+// instead of handing back a mix of two entries. (That's the trick chess
+// programs have used for years.) A new entry always replaces whatever was in
+// its slot.
+
+#define _DEFAULT_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "snek.h"
+
+struct tt_entry {
+  _Atomic uint64_t check;
+  _Atomic uint64_t data;
+};
+
+struct tt {
+  struct tt_entry *entries;
+  uint64_t mask;
+};
+
+// A table with 2^bits entries
+struct tt *tt_new(unsigned bits)
+{
+  struct tt *tt = malloc(sizeof(struct tt));
+  if (!tt)
+    die("malloc");
+
+  tt->mask = ((uint64_t) 1 << bits) - 1;
+  tt->entries = calloc(tt->mask + 1, sizeof(struct tt_entry));
+  if (!tt->entries)
+    die("calloc");
+
+  return tt;
+}
+
+void tt_free(struct tt *tt)
+{
+  free(tt->entries);
+  free(tt);
+}
+
+// What's stored for a state: how many times it's been visited and its
+// average reward (between 0 and 1), packed into one word
+bool tt_probe(struct tt *tt, uint64_t key, uint32_t *visits, double *mean)
+{
+  struct tt_entry *e = &tt->entries[key & tt->mask];
+  uint64_t data = atomic_load_explicit(&e->data, memory_order_relaxed);
+  uint64_t check = atomic_load_explicit(&e->check, memory_order_relaxed);
+
+  if ((check ^ data) != key || data == 0)
+    return false;
+
+  *visits = data >> 32;
+  *mean = (uint32_t) data / 4294967295.0;
+
+  return true;
+}
+
+void tt_store(struct tt *tt, uint64_t key, uint32_t visits, double mean)
+{
+  struct tt_entry *e = &tt->entries[key & tt->mask];
+  uint64_t data = (uint64_t) visits << 32 | (uint32_t) (mean * 4294967295.0);
+
+  atomic_store_explicit(&e->data, data, memory_order_relaxed);
+  atomic_store_explicit(&e->check, key ^ data, memory_order_relaxed);
+}
@@ -0,0 +1,671 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Head to head: a few sneks sharing one board, and a bot to play them.
+//
+// Everybody moves at once. All the tails move up first, so a snek can
+// follow right behind another one's tail, then all the heads. A head that
+// lands on a wall, the border (unless the board wraps) or anybody's body
+// crashes, and so do two heads that land on the same cell. A snek that
+// crashes stays on the board for the others to steer around. Snacks are
+// worth the same as in the normal game and make a snek grow the same way.
+// versus_move() can save what it changed, the same as gs->make(), so a
+// search can try moves out and take them back with versus_unmake().
+//
+// The bot searches with alpha-beta, the way chess programs do, but since
+// the moves are all at once it has to pretend they aren't. It plays
+// paranoid: it picks its move first, and then the other sneks get to pick
+// theirs knowing what it did and all ganging up on it. That's pessimistic
+// (nobody is really that clever) but it means a move that looks safe is
+// safe whatever the others do. It searches one tick deeper each time round
+// until its time is up, and throws away the search it was in the middle
+// of when the time runs out. Each of its moves from where it is now gets
+// searched on its own thread, on its own copy of the board.
+//
+// At the bottom of the search a snek is scored on how much room it has
+// (how many cells it can get to), how long it is, and how far it is to the
+// nearest snack, and the bot looks at how it's doing against whichever of
+// the others is doing best.
+
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define VERSUS_SNACKS 20
+#define MAX_DEPTH 64
+
+// how many nodes the search goes between looking at the clock
+#define CLOCK_EVERY 64
+
+#define WIN 1000000
+#define LOSS (-WIN)
+#define INF (2 * WIN)
+
+// Room for the board and MAX_SNEKS rings
+size_t versus_arena_size(uint32_t rows, uint32_t cols)
+{
+  size_t cells = (size_t) rows * board_stride(rows, cols);
+
+  return game_arena_size(rows, cols)
+            + (MAX_SNEKS - 1) * (sizeof(struct snek) + 2 * (cells + INIT_SKEN_LEN + 1) * sizeof(uint32_t) + 64);
+}
+
+// A new match between count sneks, spread out across the board with half
+// of them heading east and half west
+void versus_init(struct versus *v, struct arena *arena, uint32_t rows, uint32_t cols, bool wrap,
+                   uint32_t count, uint64_t rng)
+{
+  *v = (struct versus) { .count = count };
+  v->gs = (struct game_state) { .arena = arena, .wrap = wrap, .speed = 100000, .rng = rng };
+  struct game_state *gs = &v->gs;
+  board_init(gs, rows, cols);
+
+  for (uint32_t k = 0; k < count; k++) {
+    uint32_t row = (k + 1) * rows / (count + 1);
+    uint32_t col = k % 2 ? cols - 1 - cols / 4 : cols / 4;
+    gs->start = row * gs->stride + col;
+    gs->start_dir = k % 2 ? WEST : EAST;
+    v->sneks[k] = snek_init(gs);
+    v->alive[k] = true;
+  }
+  gs->start = 0;
+
+  add_snacks(gs, v->sneks[0], VERSUS_SNACKS);
+}
+
+// Copy a match onto another one with the same size board and number of
+// sneks
+void versus_copy(struct versus *dst, const struct versus *src)
+{
+  game_copy(&dst->gs, dst->sneks[0], &src->gs, src->sneks[0]);
+  for (uint32_t k = 1; k < src->count; k++)
+    snek_copy(dst->sneks[k], src->sneks[k]);
+
+  dst->count = src->count;
+  memcpy(dst->scores, src->scores, sizeof(src->scores));
+  memcpy(dst->alive, src->alive, sizeof(src->alive));
+  dst->ticks = src->ticks;
+}
+
+// The cell one step from cell i in direction dir, or UINT32_MAX if that's
+// off the edge of a board that doesn't wrap
+static uint32_t next_cell(const struct game_state *gs, uint32_t i, uint32_t dir)
+{
+  uint32_t row = i / gs->stride, col = i % gs->stride;
+  switch (dir) {
+    case NORTH:
+      row--;
+      break;
+    case SOUTH:
+      row++;
+      break;
+    case EAST:
+      col++;
+      break;
+    case WEST:
+      col--;
+      break;
+  }
+
+  if (gs->wrap) {
+    row += (row == 0) * (gs->rows - 2);
+    row -= (row == gs->rows - 1) * (gs->rows - 2);
+    col += (col == 0) * (gs->cols - 2);
+    col -= (col == gs->cols - 1) * (gs->cols - 2);
+  }
+  else if (row - 1 >= gs->rows - 2 || col - 1 >= gs->cols - 2) {
+    return UINT32_MAX;
+  }
+
+  return row * gs->stride + col;
+}
+
+// Move every snek that's still going one tick, snek k in direction
+// dirs[k]. If undo isn't NULL, what changed goes in it. Returns how many
+// sneks are still going afterwards.
+uint32_t versus_move(struct versus *v, const uint32_t *dirs, struct versus_undo *undo)
+{
+  struct game_state *gs = &v->gs;
+  uint32_t target[MAX_SNEKS];
+  bool crashed[MAX_SNEKS] = { false };
+
+  if (undo)
+    memcpy(undo->alive, v->alive, sizeof(v->alive));
+
+  // tails first
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (!v->alive[k])
+      continue;
+
+    struct snek *snek = v->sneks[k];
+    uint32_t tail = tail_cell(snek);
+    if (undo) {
+      struct undo *u = &undo->sneks[k];
+      *u = (struct undo) { .score = v->scores[k], .grow = snek->grow, .tail = tail,
+                            .moved_tail = snek->grow == 0, .item = EMPTY };
+      undo->dirs[k] = snek->dir;
+    }
+
+    snek->dir = dirs[k];
+    if (snek->grow > 0) {
+      snek->grow--;
+    }
+    else {
+      snek->len--;
+      if (tail_cell(snek) != tail) {
+        plane_clear(gs->body, tail);
+        if (undo)
+          undo->sneks[k].vacated = true;
+      }
+    }
+  }
+
+  // then see where the heads are going and who that's going to end badly
+  // for
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (v->alive[k])
+      target[k] = next_cell(gs, head_cell(v->sneks[k]), v->sneks[k]->dir);
+  }
+
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (!v->alive[k])
+      continue;
+
+    uint32_t i = target[k];
+    crashed[k] = i == UINT32_MAX || plane_test(gs->walls, i) || plane_test(gs->body, i);
+    for (uint32_t o = 0; o < v->count && !crashed[k]; o++)
+      crashed[k] = o != k && v->alive[o] && target[o] == i;
+  }
+
+  // and move the heads of the ones that make it
+  uint32_t alive = 0;
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (!v->alive[k])
+      continue;
+    if (crashed[k]) {
+      v->alive[k] = false;
+      continue;
+    }
+
+    struct snek *snek = v->sneks[k];
+    uint32_t i = target[k];
+    snek->head = (snek->head + 1) & snek->mask;
+    snek->cells[snek->head] = i;
+    snek->len++;
+    if (undo) {
+      undo->sneks[k].moved_head = true;
+      undo->sneks[k].took_cell = true;
+      undo->sneks[k].item = item_at(gs, i);
+    }
+
+    if (plane_test(gs->snacks, i)) {
+      v->scores[k] += 10;
+      snek->grow += 3;
+      set_item(gs, i, EMPTY);
+    }
+    plane_set(gs->body, i);
+    alive++;
+  }
+
+  v->ticks++;
+
+  return alive;
+}
+
+// Take back a versus_move()
+void versus_unmake(struct versus *v, const struct versus_undo *undo)
+{
+  struct game_state *gs = &v->gs;
+
+  // heads first, since a head can have moved onto the cell another snek's
+  // tail just left
+  for (uint32_t k = 0; k < v->count; k++) {
+    const struct undo *u = &undo->sneks[k];
+    if (!undo->alive[k] || !u->moved_head)
+      continue;
+
+    struct snek *snek = v->sneks[k];
+    uint32_t i = head_cell(snek);
+    plane_clear(gs->body, i);
+    if (u->item == SNEK_SNACK)
+      set_item(gs, i, u->item);
+    snek->head = (snek->head - 1) & snek->mask;
+    snek->len--;
+  }
+
+  for (uint32_t k = 0; k < v->count; k++) {
+    const struct undo *u = &undo->sneks[k];
+    if (!undo->alive[k])
+      continue;
+
+    struct snek *snek = v->sneks[k];
+    if (u->moved_tail) {
+      snek->len++;
+      if (u->vacated)
+        plane_set(gs->body, u->tail);
+    }
+    snek->grow = u->grow;
+    snek->dir = undo->dirs[k];
+    v->scores[k] = u->score;
+  }
+
+  memcpy(v->alive, undo->alive, sizeof(v->alive));
+  v->ticks--;
+}
+
+struct versus_worker {
+  struct versus_bot *bot;
+  pthread_t thread;
+  struct arena arena;
+  struct versus v;
+  uint32_t me;
+  uint32_t depth;
+  uint32_t root_ticks;
+  uint32_t moves[4];
+  uint32_t num_moves;
+  uint32_t best;
+  int value;
+  size_t nodes;
+  bool aborted;
+};
+
+struct versus_bot {
+  uint32_t threads;
+  double budget;
+  uint32_t max_depth;
+  double deadline;
+  struct versus_worker *workers;
+  uint32_t depth;
+  size_t nodes;
+};
+
+// A bot for matches like v, thinking for budget seconds a move, or with a
+// budget of 0, searching max_depth ticks deep every move however long that
+// takes (which always plays the same moves in the same spot). There's a
+// thread for each move it could make, so more than three is no use.
+struct versus_bot *versus_bot_new(const struct versus *v, uint32_t threads, double budget,
+                                    uint32_t max_depth)
+{
+  struct versus_bot *bot = calloc(1, sizeof(struct versus_bot));
+  if (!bot)
+    die("calloc");
+
+  bot->threads = threads == 0 ? 1 : threads > 3 ? 3 : threads;
+  bot->budget = budget;
+  bot->max_depth = max_depth < MAX_DEPTH ? max_depth : MAX_DEPTH;
+  bot->workers = calloc(bot->threads, sizeof(struct versus_worker));
+  if (!bot->workers)
+    die("calloc");
+
+  for (uint32_t j = 0; j < bot->threads; j++) {
+    struct versus_worker *w = &bot->workers[j];
+    w->bot = bot;
+    arena_init(&w->arena, versus_arena_size(v->gs.rows, v->gs.cols));
+    versus_init(&w->v, &w->arena, v->gs.rows, v->gs.cols, v->gs.wrap, v->count, 0);
+  }
+
+  return bot;
+}
+
+void versus_bot_free(struct versus_bot *bot)
+{
+  for (uint32_t j = 0; j < bot->threads; j++)
+    arena_destroy(&bot->workers[j].arena);
+  free(bot->workers);
+  free(bot);
+}
+
+// The ways a snek can go, which is anywhere but straight back
+static uint32_t legal_moves(const struct snek *snek, uint32_t moves[4])
+{
+  uint32_t n = 0;
+  for (uint32_t d = 0; d < 4; d++) {
+    if (d != (snek->dir ^ 1))
+      moves[n++] = d;
+  }
+
+  return n;
+}
+
+// How well snek k is placed: how much room it has, how long it is and how
+// close it is to a snack
+static int placing(struct versus *v, uint32_t k)
+{
+  struct game_state *gs = &v->gs;
+  struct snek *snek = v->sneks[k];
+  uint32_t head = head_cell(snek);
+
+  size_t room = flood_plane(gs, gs->scratch, head, gs->reach);
+  size_t snack;
+  uint32_t dist = nearest_items(gs, SNEK_SNACK, head, &snack, 1)
+                    ? cell_distance(gs, head, snack) : gs->rows + gs->cols;
+
+  return (int) room + 10 * (int) (snek->len + snek->grow) - (int) dist;
+}
+
+static int evaluate(struct versus_worker *w)
+{
+  struct versus *v = &w->v;
+  struct game_state *gs = &v->gs;
+
+  for (size_t j = 0; j < gs->words; j++)
+    gs->scratch[j] = gs->interior[j] & ~(gs->walls[j] | gs->body[j]);
+
+  int best_other = -INF;
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (k != w->me && v->alive[k]) {
+      int p = placing(v, k);
+      best_other = p > best_other ? p : best_other;
+    }
+  }
+
+  return placing(v, w->me) - best_other;
+}
+
+static int search(struct versus_worker *w, uint32_t depth, int alpha, int beta);
+
+// Our snek goes my_dir and the others all reply as badly for us as they
+// can
+static int reply(struct versus_worker *w, uint32_t my_dir, uint32_t depth, int alpha, int beta)
+{
+  struct versus *v = &w->v;
+  uint32_t choices[MAX_SNEKS][4], n[MAX_SNEKS], dirs[MAX_SNEKS], combos = 1;
+
+  for (uint32_t k = 0; k < v->count; k++) {
+    if (k == w->me || !v->alive[k]) {
+      choices[k][0] = k == w->me ? my_dir : v->sneks[k]->dir;
+      n[k] = 1;
+    }
+    else {
+      n[k] = legal_moves(v->sneks[k], choices[k]);
+    }
+    combos *= n[k];
+  }
+
+  for (uint32_t c = 0; c < combos; c++) {
+    uint32_t x = c;
+    for (uint32_t k = 0; k < v->count; k++) {
+      dirs[k] = choices[k][x % n[k]];
+      x /= n[k];
+    }
+
+    struct versus_undo undo;
+    versus_move(v, dirs, &undo);
+    int value = search(w, depth - 1, alpha, beta);
+    versus_unmake(v, &undo);
+    if (w->aborted)
+      return 0;
+
+    if (value < beta)
+      beta = value;
+    if (beta <= alpha)
+      break;
+  }
+
+  return beta;
+}
+
+static int search(struct versus_worker *w, uint32_t depth, int alpha, int beta)
+{
+  struct versus *v = &w->v;
+  int ply = v->ticks - w->root_ticks;
+
+  // the first search always gets finished, so there's a move to make
+  if (++w->nodes % CLOCK_EVERY == 0 && w->depth > 1 && now_secs() > w->bot->deadline) {
+    w->aborted = true;
+    return 0;
+  }
+
+  bool others = false;
+  for (uint32_t k = 0; k < v->count; k++)
+    others |= k != w->me && v->alive[k];
+
+  // crashing later is better than crashing sooner, and taking everybody
+  // else down with us is better than crashing on our own
+  if (!v->alive[w->me])
+    return (others ? LOSS : LOSS / 2) + ply;
+  if (!others)
+    return WIN - ply;
+  if (depth == 0)
+    return evaluate(w);
+
+  uint32_t moves[4], n = legal_moves(v->sneks[w->me], moves);
+  for (uint32_t m = 0; m < n; m++) {
+    int value = reply(w, moves[m], depth, alpha, beta);
+    if (w->aborted)
+      return 0;
+
+    if (value > alpha)
+      alpha = value;
+    if (alpha >= beta)
+      break;
+  }
+
+  return alpha;
+}
+
+// Search this worker's share of the moves from the top
+static void *root_search(void *arg)
+{
+  struct versus_worker *w = arg;
+  int alpha = -INF;
+
+  w->value = -INF;
+  w->best = w->num_moves ? w->moves[0] : 0;
+  for (uint32_t m = 0; m < w->num_moves; m++) {
+    int value = reply(w, w->moves[m], w->depth, alpha, INF);
+    if (w->aborted)
+      break;
+
+    if (value > w->value) {
+      w->value = value;
+      w->best = w->moves[m];
+    }
+    alpha = value > alpha ? value : alpha;
+  }
+
+  return NULL;
+}
+
+// Think about the match for the bot's time budget and return which way
+// snek me should go
+uint32_t versus_choose(struct versus_bot *bot, const struct versus *v, uint32_t me)
+{
+  bot->deadline = bot->budget > 0 ? now_secs() + bot->budget : HUGE_VAL;
+  bot->nodes = 0;
+  bot->depth = 0;
+
+  uint32_t best = v->sneks[me]->dir;
+  if (!v->alive[me])
+    return best;
+
+  for (uint32_t j = 0; j < bot->threads; j++) {
+    struct versus_worker *w = &bot->workers[j];
+    versus_copy(&w->v, v);
+    w->me = me;
+    w->root_ticks = v->ticks;
+    w->nodes = 0;
+  }
+
+  uint32_t order[4], n = legal_moves(v->sneks[me], order);
+  for (uint32_t depth = 1; depth <= bot->max_depth; depth++) {
+    // hand the moves out between the threads, and start them going
+    for (uint32_t j = 0; j < bot->threads; j++) {
+      struct versus_worker *w = &bot->workers[j];
+      w->depth = depth;
+      w->aborted = false;
+      w->num_moves = 0;
+      for (uint32_t m = j; m < n; m += bot->threads)
+        w->moves[w->num_moves++] = order[m];
+      if (j > 0 && pthread_create(&w->thread, NULL, root_search, w) != 0)
+        die("pthread_create");
+    }
+
+    root_search(&bot->workers[0]);
+    for (uint32_t j = 1; j < bot->threads; j++)
+      pthread_join(bot->workers[j].thread, NULL);
+
+    bool aborted = false;
+    int value = -INF;
+    uint32_t found = best;
+    for (uint32_t j = 0; j < bot->threads; j++) {
+      struct versus_worker *w = &bot->workers[j];
+      aborted |= w->aborted;
+      if (w->num_moves && w->value > value) {
+        value = w->value;
+        found = w->best;
+      }
+    }
+    if (aborted)
+      break;
+
+    best = found;
+    bot->depth = depth;
+
+    // look at the best move first next time round
+    for (uint32_t m = 0; m < n; m++) {
+      if (order[m] == best) {
+        order[m] = order[0];
+        order[0] = best;
+      }
+    }
+
+    // no point looking deeper once we know how it ends
+    if (value >= WIN / 2 || value <= LOSS / 4 || now_secs() > bot->deadline)
+      break;
+  }
+
+  for (uint32_t j = 0; j < bot->threads; j++)
+    bot->nodes += bot->workers[j].nodes;
+
+  return best;
+}
+
+// Put the snacks back up to how many a match starts with, for between
+// ticks
+void versus_top_up(struct versus *v)
+{
+  size_t snacks = plane_count(v->gs.snacks, v->gs.words);
+  if (snacks < VERSUS_SNACKS)
+    add_snacks(&v->gs, v->sneks[0], VERSUS_SNACKS - snacks);
+}
+
+// Whether the body plane is exactly the cells the sneks are on
+static bool body_matches(struct versus *v)
+{
+  struct game_state *gs = &v->gs;
+  uint64_t *body = gs->scratch;
+  memset(body, 0, gs->words * sizeof(uint64_t));
+  for (uint32_t k = 0; k < v->count; k++) {
+    for (uint32_t s = 0; s < v->sneks[k]->len; s++)
+      plane_set(body, snek_cell(v->sneks[k], s));
+  }
+
+  return memcmp(body, gs->body, gs->words * sizeof(uint64_t)) == 0;
+}
+
+// Play bots against each other, each getting both sides of the board in
+// turn, and check the board stays straight and unmaking a tick puts it
+// back how it was
+int bench_versus(void)
+{
+  struct {
+    double budget[2];
+    uint32_t threads[2];
+  } pairings[] = {
+    { { 0.005, 0.001 }, { 1, 1 } },
+    { { 0.005, 0.005 }, { 3, 1 } },
+    { { 0.002, 0.002 }, { 1, 1 } },
+  };
+  int games = 4, max_ticks = 400;
+  size_t failures = 0;
+
+  for (size_t p = 0; p < sizeof(pairings) / sizeof(pairings[0]); p++) {
+    int wins[2] = { 0 }, draws = 0;
+    size_t nodes = 0, depths = 0, moves = 0, bad = 0, total_ticks = 0;
+    double thinking = 0;
+
+    for (int g = 0; g < games; g++) {
+      struct arena arena;
+      arena_init(&arena, versus_arena_size(MIN_WIN_HEIGHT, MIN_WIN_WIDTH));
+      struct versus v;
+      versus_init(&v, &arena, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false, 2, g + 1);
+
+      size_t plane_size = v.gs.words * sizeof(uint64_t);
+      uint64_t *saved = malloc(2 * plane_size);
+      if (!saved)
+        die("malloc");
+
+      // bot b plays snek (b + g) % 2
+      struct versus_bot *bots[2];
+      for (int b = 0; b < 2; b++)
+        bots[b] = versus_bot_new(&v, pairings[p].threads[b], pairings[p].budget[b], MAX_DEPTH);
+
+      while (v.ticks < (uint32_t) max_ticks) {
+        uint32_t dirs[2];
+        for (int b = 0; b < 2; b++) {
+          uint32_t k = (b + g) % 2;
+          double start = now_secs();
+          dirs[k] = versus_choose(bots[b], &v, k);
+          thinking += now_secs() - start;
+          nodes += bots[b]->nodes;
+          depths += bots[b]->depth;
+          moves++;
+        }
+
+        memcpy(saved, v.gs.body, plane_size);
+        memcpy(saved + v.gs.words, v.gs.snacks, plane_size);
+        struct versus_undo undo;
+        versus_move(&v, dirs, &undo);
+        versus_unmake(&v, &undo);
+        bad += memcmp(saved, v.gs.body, plane_size) != 0
+                || memcmp(saved + v.gs.words, v.gs.snacks, plane_size) != 0;
+
+        uint32_t alive = versus_move(&v, dirs, NULL);
+        bad += !body_matches(&v);
+        if (alive < 2)
+          break;
+
+        versus_top_up(&v);
+      }
+
+      // whoever's left standing wins, or the longer snek if they both are
+      uint32_t len[2];
+      for (int k = 0; k < 2; k++)
+        len[k] = v.alive[k] ? v.sneks[k]->len + v.sneks[k]->grow : 0;
+      if (len[0] == len[1])
+        draws++;
+      else
+        wins[((len[0] > len[1] ? 0 : 1) + g) % 2]++;
+      total_ticks += v.ticks;
+
+      for (int b = 0; b < 2; b++)
+        versus_bot_free(bots[b]);
+      free(saved);
+      arena_destroy(&arena);
+    }
+
+    printf("%4.1fms x%u vs %4.1fms x%u: %d-%d-%d, %5.1f ticks a game, depth %4.1f, "
+            "%8.0f nodes/s, %zu bad ticks\n",
+            pairings[p].budget[0] * 1000, pairings[p].threads[0],
+            pairings[p].budget[1] * 1000, pairings[p].threads[1], wins[0], wins[1], draws,
+            (double) total_ticks / games, (double) depths / moves, nodes / thinking, bad);
+    failures += bad;
+  }
+
+  return failures > 0;
+}
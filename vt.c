@@ -0,0 +1,523 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A pretend terminal: it takes what we'd write to a real one and keeps a
+// grid of what would be on the screen, so we can check what the renderer
+// draws without looking at it, and count what it costs.
+//
+// It only knows the little bit of VT100/xterm that snek uses: printing
+// (UTF-8 included), carriage return and line feed (scrolling at the
+// bottom), moving the cursor, clearing the screen or a line, showing and
+// hiding the cursor, and the colours (SGR 0, 30-39, 40-49, 38;5;N and
+// 48;5;N). Anything else is counted as unknown and otherwise ignored.
+//
+// snek --check-render plays some games and, every tick, checks that:
+// - drawing the frame over the last one leaves the same screen as drawing
+//   it on a blank terminal, so nothing from the last frame shows through;
+// - every cell on the screen shows what's in that cell of the game;
+// - encode_cells() and encode_cells_scalar() draw every row the same.
+// It also says how many bytes and escape sequences a frame takes.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+enum { VT_GROUND, VT_ESC, VT_CSI };
+
+struct vt *vt_new(uint32_t rows, uint32_t cols)
+{
+  struct vt *vt = calloc(1, sizeof(struct vt));
+  if (!vt)
+    die("calloc");
+
+  vt->rows = rows;
+  vt->cols = cols;
+  vt->cells = malloc((size_t) rows * cols * sizeof(struct vt_cell));
+  if (!vt->cells)
+    die("malloc");
+  vt->fg = vt->bg = -1;
+  vt->cursor_visible = true;
+  vt_clear(vt, 0, (size_t) rows * cols);
+
+  return vt;
+}
+
+void vt_free(struct vt *vt)
+{
+  free(vt->cells);
+  free(vt);
+}
+
+// Blank cells from to to (not including to), in the current background
+// colour like a real terminal does
+void vt_clear(struct vt *vt, size_t from, size_t to)
+{
+  for (size_t i = from; i < to; i++)
+    vt->cells[i] = (struct vt_cell) { .glyph = " ", .len = 1, .fg = -1, .bg = vt->bg };
+}
+
+struct vt_cell *vt_cell(struct vt *vt, uint32_t row, uint32_t col)
+{
+  return &vt->cells[(size_t) row * vt->cols + col];
+}
+
+static void vt_line_feed(struct vt *vt)
+{
+  if (vt->row + 1 < vt->rows) {
+    vt->row++;
+    return;
+  }
+
+  memmove(vt->cells, &vt->cells[vt->cols], (size_t) (vt->rows - 1) * vt->cols * sizeof(struct vt_cell));
+  vt_clear(vt, (size_t) (vt->rows - 1) * vt->cols, (size_t) vt->rows * vt->cols);
+  vt->stats.scrolls++;
+}
+
+static void vt_print(struct vt *vt, const char *glyph, uint8_t len)
+{
+  // the cursor sits just past the last column until there's something to
+  // print, and only then wraps
+  if (vt->col >= vt->cols) {
+    vt->col = 0;
+    vt_line_feed(vt);
+  }
+
+  struct vt_cell *cell = vt_cell(vt, vt->row, vt->col++);
+  memcpy(cell->glyph, glyph, len);
+  cell->len = len;
+  cell->fg = vt->fg;
+  cell->bg = vt->bg;
+  vt->stats.glyphs++;
+}
+
+// the numbers in a CSI sequence's parameters, with missing ones as -1
+static int vt_params(const char *seq, size_t len, int *params, int max)
+{
+  int n = 0;
+  params[0] = -1;
+  for (size_t j = 0; j < len && n < max; j++) {
+    if (seq[j] == ';') {
+      if (++n < max)
+        params[n] = -1;
+    }
+    else if (seq[j] >= '0' && seq[j] <= '9') {
+      params[n] = (params[n] < 0 ? 0 : params[n] * 10) + seq[j] - '0';
+    }
+  }
+
+  return n < max ? n + 1 : max;
+}
+
+static void vt_sgr(struct vt *vt, const int *params, int n)
+{
+  vt->stats.sgr++;
+
+  for (int j = 0; j < n; j++) {
+    int p = params[j] < 0 ? 0 : params[j];
+    if (p == 0) {
+      vt->fg = vt->bg = -1;
+    }
+    else if (p >= 30 && p <= 37) {
+      vt->fg = p - 30;
+    }
+    else if (p >= 40 && p <= 47) {
+      vt->bg = p - 40;
+    }
+    else if (p == 39) {
+      vt->fg = -1;
+    }
+    else if (p == 49) {
+      vt->bg = -1;
+    }
+    else if ((p == 38 || p == 48) && j + 2 < n && params[j + 1] == 5) {
+      if (p == 38)
+        vt->fg = params[j + 2];
+      else
+        vt->bg = params[j + 2];
+      j += 2;
+    }
+    else {
+      vt->stats.unknown++;
+    }
+  }
+}
+
+static void vt_csi(struct vt *vt, char final)
+{
+  int params[16];
+  int n = vt_params(vt->seq, vt->seq_len, params, 16);
+  bool private = vt->seq_len > 0 && vt->seq[0] == '?';
+  int p = params[0] < 1 ? 1 : params[0];
+
+  switch (final) {
+    case 'm':
+      vt_sgr(vt, params, n);
+      return;
+    case 'H':
+    case 'f':
+      vt->row = p - 1;
+      vt->col = (n > 1 && params[1] > 0 ? params[1] : 1) - 1;
+      if (vt->row >= vt->rows)
+        vt->row = vt->rows - 1;
+      if (vt->col >= vt->cols)
+        vt->col = vt->cols - 1;
+      vt->stats.moves++;
+      return;
+    case 'A':
+      vt->row = vt->row >= (uint32_t) p ? vt->row - p : 0;
+      vt->stats.moves++;
+      return;
+    case 'B':
+      vt->row = vt->row + p < vt->rows ? vt->row + p : vt->rows - 1;
+      vt->stats.moves++;
+      return;
+    case 'C':
+      vt->col = vt->col + p < vt->cols ? vt->col + p : vt->cols - 1;
+      vt->stats.moves++;
+      return;
+    case 'D':
+      vt->col = vt->col >= (uint32_t) p ? vt->col - p : 0;
+      vt->stats.moves++;
+      return;
+    case 'J': {
+      size_t at = (size_t) vt->row * vt->cols + (vt->col < vt->cols ? vt->col : vt->cols);
+      size_t all = (size_t) vt->rows * vt->cols;
+      if (params[0] == 2)
+        vt_clear(vt, 0, all);
+      else if (params[0] == 1)
+        vt_clear(vt, 0, at + 1 < all ? at + 1 : all);
+      else
+        vt_clear(vt, at, all);
+      vt->stats.clears++;
+      return;
+    }
+    case 'K': {
+      size_t start = (size_t) vt->row * vt->cols;
+      size_t at = start + (vt->col < vt->cols ? vt->col : vt->cols - 1);
+      if (params[0] == 2)
+        vt_clear(vt, start, start + vt->cols);
+      else if (params[0] == 1)
+        vt_clear(vt, start, at + 1);
+      else
+        vt_clear(vt, at, start + vt->cols);
+      vt->stats.clears++;
+      return;
+    }
+    case 'h':
+    case 'l':
+      if (private && params[0] == 25) {
+        vt->cursor_visible = final == 'h';
+        return;
+      }
+      break;
+  }
+
+  vt->stats.unknown++;
+}
+
+void vt_feed(struct vt *vt, const char *buf, size_t len)
+{
+  vt->stats.bytes += len;
+
+  for (size_t j = 0; j < len; j++) {
+    unsigned char c = buf[j];
+
+    switch (vt->state) {
+      case VT_ESC:
+        if (c == '[') {
+          vt->state = VT_CSI;
+          vt->seq_len = 0;
+        }
+        else {
+          vt->stats.unknown++;
+          vt->state = VT_GROUND;
+        }
+        continue;
+      case VT_CSI:
+        if (c >= 0x40 && c <= 0x7e) {
+          vt_csi(vt, c);
+          vt->state = VT_GROUND;
+        }
+        else if (vt->seq_len < sizeof(vt->seq)) {
+          vt->seq[vt->seq_len++] = c;
+        }
+        continue;
+    }
+
+    // a UTF-8 character spread over several bytes
+    if (vt->utf8_want) {
+      if ((c & 0xc0) == 0x80) {
+        vt->utf8[vt->utf8_len++] = c;
+        if (vt->utf8_len == vt->utf8_want) {
+          vt_print(vt, vt->utf8, vt->utf8_len);
+          vt->utf8_want = 0;
+        }
+        continue;
+      }
+
+      // broken off, so it shows up as a replacement character
+      vt_print(vt, "\xef\xbf\xbd", 3);
+      vt->utf8_want = 0;
+    }
+
+    if (c == 0x1b) {
+      vt->state = VT_ESC;
+      vt->stats.escapes++;
+    }
+    else if (c == '\r') {
+      vt->col = 0;
+    }
+    else if (c == '\n') {
+      vt_line_feed(vt);
+    }
+    else if (c >= 0x20 && c < 0x7f) {
+      vt_print(vt, (const char *) &c, 1);
+    }
+    else if (c >= 0xc0 && c < 0xf8) {
+      vt->utf8[0] = c;
+      vt->utf8_len = 1;
+      vt->utf8_want = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+    }
+    else {
+      vt->stats.unknown++;
+    }
+  }
+}
+
+static bool cells_same(const struct vt_cell *a, const struct vt_cell *b)
+{
+  // the colour a space is drawn in doesn't show
+  bool blank = a->len == 1 && a->glyph[0] == ' ';
+
+  return a->len == b->len && memcmp(a->glyph, b->glyph, a->len) == 0 && a->bg == b->bg
+          && (blank || a->fg == b->fg);
+}
+
+// Do the two screens look the same? If not, *row and *col say where they
+// first differ.
+bool vt_same(struct vt *a, struct vt *b, uint32_t *row, uint32_t *col)
+{
+  for (uint32_t r = 0; r < a->rows && r < b->rows; r++) {
+    for (uint32_t c = 0; c < a->cols && c < b->cols; c++) {
+      if (!cells_same(vt_cell(a, r, c), vt_cell(b, r, c))) {
+        *row = r;
+        *col = c;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// What a cell of the game should look like on the screen
+static struct vt_cell expected_cell(int kind, int snek_colour, char head)
+{
+  struct vt_cell cell = { .glyph = " ", .len = 1, .fg = -1, .bg = -1 };
+
+  switch (kind) {
+    case SNEK_HEAD:
+      cell.glyph[0] = head;
+      cell.fg = snek_colour;
+      break;
+    case SNEK_BODY:
+      cell.glyph[0] = '#';
+      cell.fg = snek_colour;
+      break;
+    case SNEK_SNACK:
+      cell.glyph[0] = 'o';
+      cell.fg = BLUE;
+      break;
+    case MUSHROOM:
+      memcpy(cell.glyph, "\xe2\x99\xa3", 3);
+      cell.len = 3;
+      cell.fg = PURPLE;
+      break;
+    case WALL:
+      cell.bg = 7;
+      break;
+  }
+
+  return cell;
+}
+
+// Check the screen against the game, a row at a time, starting under the
+// score bar. Returns the first row that's wrong, or 0 if none are.
+static uint32_t check_board(struct vt *vt, struct game_state *gs, struct snek *snek)
+{
+  int colour = gs->poisoned ? PURPLE : GREEN;
+  char head = snek_head(snek->dir);
+  struct vt_cell border = expected_cell(WALL, colour, head);
+
+  for (uint32_t r = 1; r < gs->rows; r++) {
+    for (uint32_t c = 0; c < gs->cols; c++) {
+      size_t i = (size_t) r * gs->stride + c;
+      struct vt_cell want = border;
+      if (r < gs->rows - 1 && c > 0 && c < gs->cols - 1)
+        want = expected_cell(i == head_cell(snek) ? SNEK_HEAD
+                               : plane_test(gs->body, i) ? SNEK_BODY : item_at(gs, i),
+                             colour, head);
+      if (!cells_same(vt_cell(vt, r, c), &want))
+        return r;
+    }
+  }
+
+  return 0;
+}
+
+// Draw every row of the screen table both ways and check they come out
+// the same. Returns the first row that doesn't, or 0 if none.
+static uint32_t check_encoders(struct game_state *gs, struct snek *snek, struct vt *a, struct vt *b, char *out)
+{
+  struct cell_style styles[WALL + 1];
+  int colour = gs->poisoned ? PURPLE : GREEN;
+  char head = snek_head(snek->dir);
+  styles_init(styles, colour, head);
+
+  for (uint32_t r = 1; r < gs->rows - 1; r++) {
+    const uint8_t *row = &gs->screen[(size_t) r * gs->stride + 1];
+    int fg = -1;
+
+    vt_feed(a, "\x1b[m\x1b[H\x1b[2J", 10);
+    vt_feed(a, out, encode_cells(row, gs->cols - 2, styles, out, &fg));
+    vt_feed(b, "\x1b[m\x1b[H\x1b[2J", 10);
+    vt_feed(b, out, encode_cells_scalar(row, gs->cols - 2, colour, head, out));
+
+    uint32_t rr, cc;
+    if (!vt_same(a, b, &rr, &cc))
+      return r;
+  }
+
+  return 0;
+}
+
+// how many mushrooms each game in check_render() starts with
+#define CHECK_MUSHROOMS 40
+
+int check_render(void)
+{
+  uint32_t sizes[][2] = { { MIN_WIN_HEIGHT, MIN_WIN_WIDTH }, { 40, 120 }, { 33, 107 } };
+  uint32_t count = 16, max_ticks = 1500;
+  int status = 0;
+
+  printf("                 bytes/frame  escapes  colours  moves  clears  glyphs  scrolls\n");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    uint32_t rows = sizes[s][0], cols = sizes[s][1];
+    struct batch *batch = batch_new(count, rows, cols, s == 2);
+
+    // The wandering sneks never live long enough to score the 200 it takes
+    // for mushrooms to turn up by themselves, so they get some to start
+    // with and more as they go. Wandering into them poisons the snek, so
+    // both of its colours get drawn too.
+    for (uint32_t g = 0; g < count; g++) {
+      batch_reset(batch, g, g + 1);
+      add_mushrooms(&batch->games[g].gs, batch->games[g].snek, CHECK_MUSHROOMS);
+    }
+
+    // a terminal a line taller than the board, since the last line of the
+    // frame ends with a line feed that would scroll a shorter one
+    struct vt *over = vt_new(rows + 1, cols), *fresh = vt_new(rows + 1, cols);
+    struct vt *row_a = vt_new(1, cols), *row_b = vt_new(1, cols);
+    char *out = malloc((size_t) cols * 16);
+    uint32_t *dirs = malloc(count * sizeof(uint32_t));
+    if (!out || !dirs)
+      die("malloc");
+
+    size_t frames = 0, failures = 0, mushroom_frames = 0, poisoned_frames = 0;
+    struct vt_stats before = over->stats, total = { 0 };
+    double parse = 0;
+    for (uint32_t t = 0; t < max_ticks; t++) {
+      size_t n = batch_views(batch);
+      if (n == 0)
+        break;
+
+      batch_wander(batch, n, dirs);
+      batch_step(batch, n, dirs);
+      for (uint32_t g = 0; t % 20 == 19 && g < count; g++) {
+        if (!batch->games[g].done)
+          add_mushrooms(&batch->games[g].gs, batch->games[g].snek, CHECK_MUSHROOMS / 4);
+      }
+
+      // just one game gets drawn, over the frame before it, and on a blank
+      // screen: the first one still going, or every other tick the first
+      // one that's poisoned, if any are
+      struct batch_game *game = &batch->games[batch->live[0]];
+      for (size_t j = 0; t % 2 && j < n; j++) {
+        if (batch->games[batch->live[j]].gs.poisoned) {
+          game = &batch->games[batch->live[j]];
+          break;
+        }
+      }
+      term_capture(over);
+      before = over->stats;
+      double start = now_secs();
+      render(game->snek, &game->gs, NULL, 0, 0);
+      parse += now_secs() - start;
+      total.bytes += over->stats.bytes - before.bytes;
+      total.escapes += over->stats.escapes - before.escapes;
+      total.sgr += over->stats.sgr - before.sgr;
+      total.moves += over->stats.moves - before.moves;
+      total.clears += over->stats.clears - before.clears;
+      total.glyphs += over->stats.glyphs - before.glyphs;
+      total.scrolls += over->stats.scrolls - before.scrolls;
+
+      vt_clear(fresh, 0, (size_t) fresh->rows * fresh->cols);
+      fresh->row = fresh->col = 0;
+      fresh->fg = fresh->bg = -1;
+      term_capture(fresh);
+      render(game->snek, &game->gs, NULL, 0, 0);
+      term_capture(NULL);
+      frames++;
+      mushroom_frames += plane_count(game->gs.mushrooms, game->gs.words) > 0;
+      poisoned_frames += game->gs.poisoned;
+
+      uint32_t r, c, bad_row;
+      if (!vt_same(over, fresh, &r, &c)) {
+        if (!failures++)
+          printf("  tick %u: drawn over the last frame, cell %u,%u differs\n", t, r, c);
+      }
+      else if ((bad_row = check_board(fresh, &game->gs, game->snek))) {
+        if (!failures++)
+          printf("  tick %u: row %u of the screen doesn't match the game\n", t, bad_row);
+      }
+      else if ((bad_row = check_encoders(&game->gs, game->snek, row_a, row_b, out))) {
+        if (!failures++)
+          printf("  tick %u: the encoders draw row %u differently\n", t, bad_row);
+      }
+    }
+
+    printf("%4ux%-4u%s %12.0f %8.1f %8.1f %6.1f %7.1f %7.0f %8.1f   %zu frames, %zu wrong\n",
+            rows, cols, s == 2 ? " wrap" : "     ", (double) total.bytes / frames,
+            (double) total.escapes / frames, (double) total.sgr / frames,
+            (double) total.moves / frames, (double) total.clears / frames,
+            (double) total.glyphs / frames, (double) total.scrolls / frames, frames, failures);
+    printf("           %.1f us a frame to draw and take in (%.0f MB/s), %zu frames with "
+            "mushrooms, %zu with the snek poisoned\n", parse * 1e6 / frames,
+            total.bytes / parse / 1e6, mushroom_frames, poisoned_frames);
+
+    // a run that never drew them hasn't checked the encoders' colours
+    status |= failures > 0 || mushroom_frames == 0 || poisoned_frames == 0;
+
+    free(out);
+    free(dirs);
+    vt_free(over);
+    vt_free(fresh);
+    vt_free(row_a);
+    vt_free(row_b);
+    batch_free(batch);
+  }
+
+  return status;
+}
@@ -0,0 +1,635 @@
+// snek - a Snake clone
+// Written in 2024 by Dana Larose <ywg.dana@gmail.com>
+//
+// To the extent possible under law, the author has dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not,
+// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Survival mode: a world with no edges, where the screen follows the snek.
+//
+// The world is cut into 64x64 chunks. A chunk is generated the first time
+// it's needed from a hash of the world's seed and the chunk's coordinates,
+// so it always comes out the same, and only so many chunks are kept in
+// memory. When we need room, the least recently used chunk the snek isn't
+// lying across gets dropped. If nothing in it has changed since it was
+// generated we can just generate it again when it's next needed; otherwise
+// (the snek ate something there) it's written to a scratch file first. The
+// cache starts with CHUNK_CACHE chunks and grows when every chunk in it is
+// either on screen or has snek in it, which only happens on a big screen or
+// with a very long snek.
+//
+// Chunks get loaded (generated or read back) well before the snek gets near
+// them: each tick we make sure the chunks around the screen are loaded, but
+// we only load one per tick, so a tick never stalls on a pile of them.
+//
+// Each row of a chunk is one uint64, so a chunk's walls, snacks, mushrooms
+// and the bits of snek in it are four little bitplanes.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snek.h"
+
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_CACHE 64
+
+// how far past the edge of the screen we keep chunks loaded
+#define CHUNK_MARGIN CHUNK_SIZE
+
+struct chunk {
+  int32_t cx;
+  int32_t cy;
+  bool used;
+  bool dirty;
+  uint32_t body_cells;
+  uint64_t last_used;
+  uint64_t walls[CHUNK_SIZE];
+  uint64_t snacks[CHUNK_SIZE];
+  uint64_t mushrooms[CHUNK_SIZE];
+  uint64_t body[CHUNK_SIZE];
+};
+
+// what goes in the scratch file for a chunk that's changed
+struct chunk_record {
+  int32_t cx;
+  int32_t cy;
+  uint64_t snacks[CHUNK_SIZE];
+  uint64_t mushrooms[CHUNK_SIZE];
+};
+
+// where in the scratch file a chunk was saved
+struct saved_chunk {
+  int32_t cx;
+  int32_t cy;
+  long offset;
+  bool used;
+};
+
+struct wpos {
+  int32_t x;
+  int32_t y;
+};
+
+struct world {
+  uint64_t seed;
+  struct chunk **chunks;
+  size_t chunk_count;
+  struct chunk *last;
+  uint64_t clock;
+
+  FILE *store;
+  struct saved_chunk *saved;
+  size_t saved_cap;
+  size_t saved_count;
+
+  // the snek, as a ring buffer of positions with the head at
+  // body[(head - k) & (body_cap - 1)] for k = 0 .. len - 1
+  struct wpos *body;
+  size_t body_cap;
+  size_t head;
+  size_t len;
+  uint32_t grow;
+  uint32_t dir;
+
+  uint32_t score;
+  useconds_t speed;
+  useconds_t saved_speed;
+  uint64_t played;
+  bool poisoned;
+  uint64_t poisoned_at;
+
+  // for --bench-survival
+  size_t generated;
+  size_t restored;
+  size_t evicted;
+  size_t saves;
+  size_t stalls;
+};
+
+// floor(v / CHUNK_SIZE), which plain division doesn't give us for negatives
+static int32_t chunk_coord(int32_t v)
+{
+  return (v - (v < 0 ? CHUNK_SIZE - 1 : 0)) / CHUNK_SIZE;
+}
+
+static void chunk_generate(struct world *world, struct chunk *chunk)
+{
+  uint64_t rng = world->seed ^ ((uint64_t) (uint32_t) chunk->cx << 32 | (uint32_t) chunk->cy);
+  splitmix64(&rng);
+
+  memset(chunk->walls, 0, sizeof(chunk->walls));
+  memset(chunk->snacks, 0, sizeof(chunk->snacks));
+  memset(chunk->mushrooms, 0, sizeof(chunk->mushrooms));
+  memset(chunk->body, 0, sizeof(chunk->body));
+  chunk->body_cells = 0;
+  chunk->dirty = false;
+
+  for (int j = 0; j < 6; j++) {
+    uint64_t r = splitmix64(&rng);
+    int row = r % CHUNK_SIZE, col = (r >> 8) % CHUNK_SIZE, len = (r >> 16) % 6 + 3;
+    if (r >> 24 & 1) {
+      for (int k = 0; k < len && col + k < CHUNK_SIZE; k++)
+        chunk->walls[row] |= (uint64_t) 1 << (col + k);
+    }
+    else {
+      for (int k = 0; k < len && row + k < CHUNK_SIZE; k++)
+        chunk->walls[row + k] |= (uint64_t) 1 << col;
+    }
+  }
+
+  for (int j = 0; j < 10; j++) {
+    uint64_t r = splitmix64(&rng);
+    chunk->snacks[r % CHUNK_SIZE] |= (uint64_t) 1 << (r >> 8) % CHUNK_SIZE;
+  }
+
+  uint64_t r = splitmix64(&rng);
+  if (r % 3 == 0)
+    chunk->mushrooms[(r >> 8) % CHUNK_SIZE] |= (uint64_t) 1 << (r >> 16) % CHUNK_SIZE;
+
+  // the snek starts at the origin, heading east, so keep the rows it's on
+  // clear for a good way either side of it
+  if (chunk->cy == 0 || chunk->cy == -1) {
+    for (int row = 0; row < CHUNK_SIZE; row++) {
+      int32_t y = chunk->cy * CHUNK_SIZE + row;
+      if (y >= -4 && y <= 4 && chunk->cx >= -1 && chunk->cx <= 1)
+        chunk->walls[row] = 0;
+    }
+  }
+
+  for (int row = 0; row < CHUNK_SIZE; row++) {
+    chunk->snacks[row] &= ~chunk->walls[row];
+    chunk->mushrooms[row] &= ~(chunk->walls[row] | chunk->snacks[row]);
+  }
+
+  world->generated++;
+}
+
+static struct saved_chunk *find_saved(struct world *world, int32_t cx, int32_t cy)
+{
+  if (world->saved_cap == 0)
+    return NULL;
+
+  uint64_t h = ((uint64_t) (uint32_t) cx << 32 | (uint32_t) cy) * 0x9e3779b97f4a7c15;
+  size_t mask = world->saved_cap - 1;
+  for (size_t i = h >> 32 & mask; ; i = (i + 1) & mask) {
+    struct saved_chunk *s = &world->saved[i];
+    if (!s->used || (s->cx == cx && s->cy == cy))
+      return s;
+  }
+}
+
+static void save_chunk(struct world *world, struct chunk *chunk)
+{
+  if (world->saved_count * 2 >= world->saved_cap) {
+    struct saved_chunk *old = world->saved;
+    size_t old_cap = world->saved_cap;
+
+    world->saved_cap = old_cap ? old_cap * 2 : 256;
+    world->saved = calloc(world->saved_cap, sizeof(struct saved_chunk));
+    if (!world->saved)
+      die("calloc");
+    for (size_t j = 0; j < old_cap; j++) {
+      if (old[j].used)
+        *find_saved(world, old[j].cx, old[j].cy) = old[j];
+    }
+    free(old);
+  }
+
+  struct saved_chunk *s = find_saved(world, chunk->cx, chunk->cy);
+  if (!s->used) {
+    fseek(world->store, 0, SEEK_END);
+    s->used = true;
+    s->cx = chunk->cx;
+    s->cy = chunk->cy;
+    s->offset = ftell(world->store);
+    world->saved_count++;
+  }
+  else {
+    fseek(world->store, s->offset, SEEK_SET);
+  }
+
+  struct chunk_record rec = { .cx = chunk->cx, .cy = chunk->cy };
+  memcpy(rec.snacks, chunk->snacks, sizeof(rec.snacks));
+  memcpy(rec.mushrooms, chunk->mushrooms, sizeof(rec.mushrooms));
+  if (fwrite(&rec, sizeof(rec), 1, world->store) != 1)
+    die("fwrite");
+
+  world->saves++;
+}
+
+// Make the cache twice as big, returning one of the new chunks
+static struct chunk *grow_cache(struct world *world)
+{
+  size_t count = world->chunk_count ? world->chunk_count * 2 : CHUNK_CACHE;
+  struct chunk **chunks = realloc(world->chunks, count * sizeof(struct chunk *));
+  if (!chunks)
+    die("realloc");
+
+  for (size_t j = world->chunk_count; j < count; j++) {
+    chunks[j] = calloc(1, sizeof(struct chunk));
+    if (!chunks[j])
+      die("calloc");
+  }
+
+  struct chunk *slot = chunks[world->chunk_count];
+  world->chunks = chunks;
+  world->chunk_count = count;
+
+  return slot;
+}
+
+static struct chunk *load_chunk(struct world *world, int32_t cx, int32_t cy)
+{
+  struct chunk *slot = NULL;
+  for (size_t j = 0; j < world->chunk_count; j++) {
+    struct chunk *c = world->chunks[j];
+    if (!c->used) {
+      slot = c;
+      break;
+    }
+    if (c->body_cells == 0 && (!slot || c->last_used < slot->last_used))
+      slot = c;
+  }
+
+  // rather than drop a chunk that's on screen this tick (which we'd only
+  // have to load again next tick) or one with snek in it, make more room
+  if (!slot || (slot->used && slot->last_used == world->clock))
+    slot = grow_cache(world);
+
+  if (slot->used) {
+    if (slot->dirty)
+      save_chunk(world, slot);
+    world->evicted++;
+  }
+
+  slot->used = true;
+  slot->cx = cx;
+  slot->cy = cy;
+  slot->last_used = world->clock;
+  chunk_generate(world, slot);
+
+  struct saved_chunk *s = find_saved(world, cx, cy);
+  if (s && s->used) {
+    struct chunk_record rec;
+    fseek(world->store, s->offset, SEEK_SET);
+    if (fread(&rec, sizeof(rec), 1, world->store) != 1)
+      die("fread");
+    memcpy(slot->snacks, rec.snacks, sizeof(rec.snacks));
+    memcpy(slot->mushrooms, rec.mushrooms, sizeof(rec.mushrooms));
+    world->restored++;
+  }
+
+  return slot;
+}
+
+static struct chunk *find_chunk(struct world *world, int32_t cx, int32_t cy)
+{
+  if (world->last && world->last->cx == cx && world->last->cy == cy)
+    return world->last;
+
+  for (size_t j = 0; j < world->chunk_count; j++) {
+    struct chunk *c = world->chunks[j];
+    if (c->used && c->cx == cx && c->cy == cy) {
+      world->last = c;
+      return c;
+    }
+  }
+
+  return NULL;
+}
+
+// The chunk holding (x, y). It should already be loaded; if it isn't we
+// have to load it on the spot, which is what prefetch() is there to avoid.
+static struct chunk *chunk_at(struct world *world, int32_t x, int32_t y)
+{
+  int32_t cx = chunk_coord(x), cy = chunk_coord(y);
+  struct chunk *c = find_chunk(world, cx, cy);
+  if (!c) {
+    world->stalls++;
+    c = world->last = load_chunk(world, cx, cy);
+  }
+
+  return c;
+}
+
+static bool test_cell(const uint64_t *plane, int32_t x, int32_t y)
+{
+  return plane[y & (CHUNK_SIZE - 1)] >> (x & (CHUNK_SIZE - 1)) & 1;
+}
+
+static void set_cell(uint64_t *plane, int32_t x, int32_t y, bool on)
+{
+  uint64_t bit = (uint64_t) 1 << (x & (CHUNK_SIZE - 1));
+  if (on)
+    plane[y & (CHUNK_SIZE - 1)] |= bit;
+  else
+    plane[y & (CHUNK_SIZE - 1)] &= ~bit;
+}
+
+// Keep the chunks under and around a rows x cols screen centred on the
+// head loaded, loading at most one that's missing. With load_all set (when
+// the game starts) we load every one of them.
+static void prefetch(struct world *world, uint32_t rows, uint32_t cols, bool load_all)
+{
+  struct wpos h = world->body[world->head];
+  int32_t cx0 = chunk_coord(h.x - (int32_t) cols / 2 - CHUNK_MARGIN);
+  int32_t cx1 = chunk_coord(h.x + (int32_t) cols / 2 + CHUNK_MARGIN);
+  int32_t cy0 = chunk_coord(h.y - (int32_t) rows / 2 - CHUNK_MARGIN);
+  int32_t cy1 = chunk_coord(h.y + (int32_t) rows / 2 + CHUNK_MARGIN);
+  bool loaded = false;
+
+  world->clock++;
+  for (int32_t cy = cy0; cy <= cy1; cy++) {
+    for (int32_t cx = cx0; cx <= cx1; cx++) {
+      struct chunk *c = find_chunk(world, cx, cy);
+      if (!c && (load_all || !loaded)) {
+        c = load_chunk(world, cx, cy);
+        loaded = true;
+      }
+      if (c)
+        c->last_used = world->clock;
+    }
+  }
+}
+
+static void world_init(struct world *world, uint64_t seed)
+{
+  memset(world, 0, sizeof(*world));
+  world->seed = seed;
+  world->store = tmpfile();
+  if (!world->store)
+    die("tmpfile");
+
+  world->body_cap = 64;
+  world->body = malloc(world->body_cap * sizeof(struct wpos));
+  if (!world->body)
+    die("malloc");
+
+  world->dir = EAST;
+  world->speed = 100000;
+
+  // lay the snek out heading east from the origin
+  for (int j = INIT_SKEN_LEN; j >= 0; j--) {
+    world->head = world->len++;
+    world->body[world->head] = (struct wpos) { -j, 0 };
+    struct chunk *c = chunk_at(world, -j, 0);
+    set_cell(c->body, -j, 0, true);
+    c->body_cells++;
+  }
+  world->stalls = 0;
+}
+
+static void world_destroy(struct world *world)
+{
+  fclose(world->store);
+  for (size_t j = 0; j < world->chunk_count; j++)
+    free(world->chunks[j]);
+  free(world->chunks);
+  free(world->saved);
+  free(world->body);
+}
+
+static void push_head(struct world *world, struct wpos p)
+{
+  if (world->len == world->body_cap) {
+    // unroll the ring into a buffer twice the size
+    struct wpos *body = malloc(2 * world->body_cap * sizeof(struct wpos));
+    if (!body)
+      die("malloc");
+    for (size_t k = 0; k < world->len; k++)
+      body[k] = world->body[(world->head - (world->len - 1) + k) & (world->body_cap - 1)];
+    free(world->body);
+    world->body = body;
+    world->head = world->len - 1;
+    world->body_cap *= 2;
+  }
+
+  world->head = (world->head + 1) & (world->body_cap - 1);
+  world->body[world->head] = p;
+  world->len++;
+}
+
+// Move the snek one cell. Returns true if that was the end of it.
+static bool world_step(struct world *world)
+{
+  world->played += world->speed;
+  if (world->poisoned && world->played - world->poisoned_at >= POISON_DURATION * 1000000ull) {
+    world->poisoned = false;
+    world->speed = world->saved_speed;
+    world->saved_speed = 0;
+  }
+
+  struct wpos h = world->body[world->head];
+  switch (world->dir) {
+    case NORTH:
+      h.y--;
+      break;
+    case SOUTH:
+      h.y++;
+      break;
+    case EAST:
+      h.x++;
+      break;
+    case WEST:
+      h.x--;
+      break;
+  }
+
+  // the tail moves on first, unless the snek is still growing
+  if (world->grow > 0) {
+    world->grow--;
+  }
+  else {
+    struct wpos t = world->body[(world->head - (world->len - 1)) & (world->body_cap - 1)];
+    struct chunk *c = chunk_at(world, t.x, t.y);
+    set_cell(c->body, t.x, t.y, false);
+    c->body_cells--;
+    world->len--;
+  }
+
+  struct chunk *c = chunk_at(world, h.x, h.y);
+  if (test_cell(c->walls, h.x, h.y) || test_cell(c->body, h.x, h.y))
+    return true;
+
+  push_head(world, h);
+  set_cell(c->body, h.x, h.y, true);
+  c->body_cells++;
+
+  if (test_cell(c->snacks, h.x, h.y)) {
+    set_cell(c->snacks, h.x, h.y, false);
+    c->dirty = true;
+    world->score += 10;
+    world->grow += 3;
+    if (world->speed > MIN_SPEED)
+      world->speed -= 1000;
+  }
+  else if (test_cell(c->mushrooms, h.x, h.y)) {
+    set_cell(c->mushrooms, h.x, h.y, false);
+    c->dirty = true;
+    world->score += 75;
+    if (world->saved_speed == 0)
+      world->saved_speed = world->speed;
+    world->speed /= 2;
+    world->poisoned = true;
+    world->poisoned_at = world->played;
+  }
+
+  return false;
+}
+
+// Fill in the screen table for a rows x cols screen centred on the head
+static void world_screen(struct world *world, uint8_t *table, uint32_t rows, uint32_t cols)
+{
+  struct wpos h = world->body[world->head];
+  int32_t x0 = h.x - (int32_t) (cols - 2) / 2, y0 = h.y - (int32_t) (rows - 2) / 2;
+
+  memset(table, EMPTY, (size_t) rows * cols);
+  for (uint32_t r = 1; r < rows - 1; r++) {
+    for (uint32_t c = 1; c < cols - 1; c++) {
+      int32_t x = x0 + c - 1, y = y0 + r - 1;
+      struct chunk *ch = chunk_at(world, x, y);
+      uint8_t *cell = &table[r * cols + c];
+
+      if (test_cell(ch->body, x, y))
+        *cell = x == h.x && y == h.y ? SNEK_HEAD : SNEK_BODY;
+      else if (test_cell(ch->walls, x, y))
+        *cell = WALL;
+      else if (test_cell(ch->snacks, x, y))
+        *cell = SNEK_SNACK;
+      else if (test_cell(ch->mushrooms, x, y))
+        *cell = MUSHROOM;
+    }
+  }
+}
+
+// Play a game of survival on a rows x cols screen. Returns false if the
+// player wants to quit rather than play again.
+bool survival(uint32_t rows, uint32_t cols, uint64_t seed, uint32_t *high_score)
+{
+  struct world *world = malloc(sizeof(struct world));
+  uint8_t *table = malloc((size_t) rows * cols);
+  char *frame = malloc((size_t) rows * cols * 16);
+  if (!world || !table || !frame)
+    die("malloc");
+
+  world_init(world, seed);
+  prefetch(world, rows, cols, true);
+
+  bool paused = false;
+  while (true) {
+    char c = get_key();
+    if (c == 'w')
+      world->dir = NORTH;
+    else if (c == 'a')
+      world->dir = WEST;
+    else if (c == 's')
+      world->dir = SOUTH;
+    else if (c == 'd')
+      world->dir = EAST;
+    else if (c == ' ')
+      paused = !paused;
+
+    if (!paused) {
+      bool game_over = world_step(world);
+      prefetch(world, rows, cols, false);
+      world_screen(world, table, rows, cols);
+
+      struct screen screen = { .table = table, .stride = cols, .rows = rows,
+                                .cols = cols, .head = snek_head(world->dir),
+                                .snek_colour = world->poisoned ? PURPLE : GREEN,
+                                .score = world->score };
+
+      if (game_over) {
+        struct message msg[3];
+        size_t num_msgs = 0;
+        uint32_t row = rows / 3;
+
+        msg[num_msgs++] = (struct message) { row, "Oh noes! Game over :(", PURPLE };
+        if (world->score > *high_score) {
+          *high_score = world->score;
+          row += 2;
+          msg[num_msgs++] = (struct message) { row, "A new high score!!", BLUE };
+        }
+        row += 2;
+        msg[num_msgs++] = (struct message) { row, "Press space to play again or q to quit", WHITE };
+
+        draw_screen(&screen, msg, num_msgs, *high_score, frame);
+        break;
+      }
+
+      draw_screen(&screen, NULL, 0, *high_score, frame);
+    }
+
+    game_sleep(world->speed);
+  }
+
+  world_destroy(world);
+  free(world);
+  free(table);
+  free(frame);
+
+  while (true) {
+    char c = get_key();
+    if (c == 'q')
+      return false;
+    else if (c == ' ')
+      return true;
+    game_sleep(10000);
+  }
+}
+
+// Steer the snek a long way across the world without a screen, to check
+// that chunks keep getting loaded ahead of it and memory doesn't grow.
+int bench_survival(uint64_t seed)
+{
+  struct world *world = malloc(sizeof(struct world));
+  if (!world)
+    die("malloc");
+  world_init(world, seed);
+  prefetch(world, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, true);
+
+  size_t ticks = 0, max_ticks = 2000000;
+  double start = now_secs();
+  int turn = 0;
+  for (; ticks < max_ticks; ticks++) {
+    // head east, ducking around anything in the way
+    struct wpos h = world->body[world->head];
+    int dx[] = { 0, 0, 1, -1 }, dy[] = { -1, 1, 0, 0 };
+    uint32_t dirs[] = { EAST, turn ? NORTH : SOUTH, turn ? SOUTH : NORTH, WEST };
+    for (int j = 0; j < 4; j++) {
+      int32_t x = h.x + dx[dirs[j]], y = h.y + dy[dirs[j]];
+      struct chunk *c = chunk_at(world, x, y);
+      if (!test_cell(c->walls, x, y) && !test_cell(c->body, x, y)) {
+        world->dir = dirs[j];
+        break;
+      }
+    }
+    if (ticks % 97 == 0)
+      turn = !turn;
+
+    if (world_step(world))
+      break;
+    prefetch(world, MIN_WIN_HEIGHT, MIN_WIN_WIDTH, false);
+  }
+  double elapsed = now_secs() - start;
+
+  struct wpos h = world->body[world->head];
+  printf("%zu ticks (%.2f us/tick), ended at (%d, %d) with length %zu\n",
+          ticks, elapsed * 1e6 / ticks, h.x, h.y, world->len);
+  printf("chunks: %zu generated, %zu restored from disk, %zu evicted, %zu saves, "
+          "%zu loaded late, %zu in memory\n", world->generated, world->restored,
+          world->evicted, world->saves, world->stalls, world->chunk_count);
+
+  world_destroy(world);
+  free(world);
+
+  return 0;
+}